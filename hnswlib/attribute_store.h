@@ -0,0 +1,217 @@
+#pragma once
+#include "hnswlib.h"
+#include "id_filter.h"
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace hnswlib {
+typedef unsigned int tableint;
+typedef uint32_t attributetype;
+
+static const uint64_t HNSW_ATTRIBUTES_MAGIC = 0x0052545441574e48ULL;  // "HNWATTR"
+
+// a condition of an attribute filter: the value of field is one of values
+struct AttributeCondition {
+    size_t field;
+    std::vector<attributetype> values;
+};
+
+/*
+* Small integer attributes of the elements of a HierarchicalNSW, num_fields values per
+* element, with a posting bitmap of the internal ids for every value of every field.
+* A filter such as "tag in {3, 7} and lang == 2" is the union of the postings of each
+* condition, intersected across conditions, and is then tested by internal id.
+*
+* A posting takes a bit per element of the index, so fields are meant to have few
+* distinct values. Deleted elements are dropped from the postings and keep their values,
+* so unmarking them restores the postings. An element without attributes is in no posting.
+*/
+class AttributeStore {
+    enum ElementState : unsigned char {
+        ELEMENT_NONE = 0,     // no attributes
+        ELEMENT_ACTIVE = 1,   // attributes in the postings
+        ELEMENT_REMOVED = 2   // attributes kept, out of the postings
+    };
+
+    size_t num_fields_{0};
+    size_t max_elements_{0};
+    std::vector<attributetype> values_;  // num_fields_ values per element
+    std::vector<unsigned char> states_;
+    std::vector<std::unordered_map<attributetype, IdFilter>> postings_;  // by field, then by value
+    IdFilter active_;  // the elements in the postings
+    mutable std::mutex lock_;
+
+    void addPostings(tableint id) {
+        for (size_t f = 0; f < num_fields_; f++) {
+            IdFilter &posting = postings_[f][values_[id * num_fields_ + f]];
+            posting.resize(max_elements_);
+            posting.allow(id);
+        }
+        active_.allow(id);
+    }
+
+    void removePostings(tableint id) {
+        for (size_t f = 0; f < num_fields_; f++) {
+            auto found = postings_[f].find(values_[id * num_fields_ + f]);
+            if (found == postings_[f].end())
+                continue;
+            found->second.disallow(id);
+            if (found->second.count() == 0)
+                postings_[f].erase(found);
+        }
+        active_.disallow(id);
+    }
+
+    void rebuildPostings() {
+        for (auto &field : postings_)
+            field.clear();
+        active_ = IdFilter(max_elements_);
+        for (tableint id = 0; id < max_elements_; id++) {
+            if (states_[id] == ELEMENT_ACTIVE)
+                addPostings(id);
+        }
+    }
+
+ public:
+    AttributeStore(size_t num_fields, size_t max_elements)
+        : num_fields_(num_fields), postings_(num_fields) {
+        if (num_fields == 0)
+            throw std::runtime_error("AttributeStore: at least one field is needed");
+        resize(max_elements);
+    }
+
+    void resize(size_t max_elements) {
+        std::unique_lock<std::mutex> lock(lock_);
+        max_elements_ = max_elements;
+        values_.resize(max_elements * num_fields_, 0);
+        states_.resize(max_elements, ELEMENT_NONE);
+        for (auto &field : postings_) {
+            for (auto &posting : field)
+                posting.second.resize(max_elements);
+        }
+        active_.resize(max_elements);
+    }
+
+    size_t numFields() const {
+        return num_fields_;
+    }
+
+    // sets the num_fields values of the element, replacing those it had
+    void set(tableint id, const attributetype *values, bool deleted = false) {
+        std::unique_lock<std::mutex> lock(lock_);
+        if (states_[id] == ELEMENT_ACTIVE)
+            removePostings(id);
+        std::copy(values, values + num_fields_, values_.begin() + id * num_fields_);
+        states_[id] = deleted ? ELEMENT_REMOVED : ELEMENT_ACTIVE;
+        if (!deleted)
+            addPostings(id);
+    }
+
+    // copies the values of the element to values, returns false if it has none
+    bool get(tableint id, attributetype *values) const {
+        std::unique_lock<std::mutex> lock(lock_);
+        if (states_[id] == ELEMENT_NONE)
+            return false;
+        std::copy(values_.begin() + id * num_fields_, values_.begin() + (id + 1) * num_fields_, values);
+        return true;
+    }
+
+    // the element is deleted: out of the postings until restore
+    void remove(tableint id) {
+        std::unique_lock<std::mutex> lock(lock_);
+        if (states_[id] != ELEMENT_ACTIVE)
+            return;
+        removePostings(id);
+        states_[id] = ELEMENT_REMOVED;
+    }
+
+    void restore(tableint id) {
+        std::unique_lock<std::mutex> lock(lock_);
+        if (states_[id] != ELEMENT_REMOVED)
+            return;
+        states_[id] = ELEMENT_ACTIVE;
+        addPostings(id);
+    }
+
+    // the element is reused for another one, which starts without attributes
+    void erase(tableint id) {
+        std::unique_lock<std::mutex> lock(lock_);
+        if (states_[id] == ELEMENT_ACTIVE)
+            removePostings(id);
+        states_[id] = ELEMENT_NONE;
+    }
+
+    // the elements allowed by every condition, an element with its attributes if none is given
+    IdFilter evaluate(const std::vector<AttributeCondition> &conditions) const {
+        std::unique_lock<std::mutex> lock(lock_);
+        IdFilter result = active_;
+        for (const AttributeCondition &condition : conditions) {
+            if (condition.field >= num_fields_)
+                throw std::runtime_error("AttributeStore: the field of a condition is out of range");
+            IdFilter matching(max_elements_);
+            for (attributetype value : condition.values) {
+                auto found = postings_[condition.field].find(value);
+                if (found != postings_[condition.field].end())
+                    matching.unionWith(found->second);
+            }
+            result.intersectWith(matching);
+        }
+        return result;
+    }
+
+    // new position -> old id, as in HierarchicalNSW::reorderIndex
+    void permute(const std::vector<tableint> &order) {
+        std::unique_lock<std::mutex> lock(lock_);
+        std::vector<attributetype> values(values_.size(), 0);
+        std::vector<unsigned char> states(states_.size(), ELEMENT_NONE);
+        for (size_t i = 0; i < order.size(); i++) {
+            std::copy(values_.begin() + order[i] * num_fields_, values_.begin() + (order[i] + 1) * num_fields_,
+                      values.begin() + i * num_fields_);
+            states[i] = states_[order[i]];
+        }
+        values_.swap(values);
+        states_.swap(states);
+        rebuildPostings();
+    }
+
+    // the values and states of the first count elements, the postings are rebuilt on load
+    void save(const std::string &location, size_t count) const {
+        std::unique_lock<std::mutex> lock(lock_);
+        std::ofstream output(location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("AttributeStore: cannot open " + location);
+        writeBinaryPOD(output, HNSW_ATTRIBUTES_MAGIC);
+        writeBinaryPOD(output, num_fields_);
+        writeBinaryPOD(output, count);
+        output.write((const char *) states_.data(), count);
+        output.write((const char *) values_.data(), count * num_fields_ * sizeof(attributetype));
+    }
+
+    static AttributeStore *load(const std::string &location, size_t max_elements) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("AttributeStore: cannot open " + location);
+        uint64_t magic = 0;
+        size_t num_fields = 0;
+        size_t count = 0;
+        readBinaryPOD(input, magic);
+        readBinaryPOD(input, num_fields);
+        readBinaryPOD(input, count);
+        if (magic != HNSW_ATTRIBUTES_MAGIC || num_fields == 0 || count > max_elements)
+            throw std::runtime_error("AttributeStore: " + location + " seems to be corrupted");
+        AttributeStore *store = new AttributeStore(num_fields, max_elements);
+        input.read((char *) store->states_.data(), count);
+        input.read((char *) store->values_.data(), count * num_fields * sizeof(attributetype));
+        if (!input) {
+            delete store;
+            throw std::runtime_error("AttributeStore: " + location + " is truncated");
+        }
+        store->rebuildPostings();
+        return store;
+    }
+};
+
+}  // namespace hnswlib
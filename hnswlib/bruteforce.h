@@ -7,6 +7,17 @@
 #include <iostream>
 
 namespace hnswlib {
+
+// Offers a scanned element to top, a max-heap of the k closest elements scanned so far
+template<typename heap_t, typename dist_t, typename id_t>
+inline void keepClosest(heap_t &top, size_t k, dist_t dist, id_t id) {
+    if (top.size() < k || dist < top.top().first) {
+        top.emplace(dist, id);
+        if (top.size() > k)
+            top.pop();
+    }
+}
+
 template<typename dist_t>
 class BruteforceSearch : public AlgorithmInterface<dist_t> {
  public:
@@ -16,7 +27,9 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
     size_t size_per_element_;
 
     size_t data_size_;
+    SpaceInterface<dist_t> *space_;
     DISTFUNC <dist_t> fstdistfunc_;
+    DISTFUNC <dist_t> query_distfunc_;
     void *dist_func_param_;
     std::mutex index_lock;
 
@@ -29,6 +42,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
             cur_element_count(0),
             size_per_element_(0),
             data_size_(0),
+            space_(s),
             dist_func_param_(nullptr) {
     }
 
@@ -39,6 +53,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
             cur_element_count(0),
             size_per_element_(0),
             data_size_(0),
+            space_(s),
             dist_func_param_(nullptr) {
         loadIndex(location, s);
     }
@@ -46,8 +61,10 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
     BruteforceSearch(SpaceInterface <dist_t> *s, size_t maxElements) {
         maxelements_ = maxElements;
+        space_ = s;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        query_distfunc_ = s->get_query_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         size_per_element_ = data_size_ + sizeof(labeltype);
         data_ = (char *) malloc(maxElements * size_per_element_);
@@ -80,7 +97,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
             }
         }
         memcpy(data_ + size_per_element_ * idx + data_size_, &label, sizeof(labeltype));  // put the label at the end of datapoint
-        memcpy(data_ + size_per_element_ * idx, datapoint, data_size_);
+        space_->encode(datapoint, data_ + size_per_element_ * idx);
     }
 
     labeltype get_label(int idx) const {
@@ -119,29 +136,15 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
         std::priority_queue<std::pair<dist_t, labeltype >> topResults;
         if (cur_element_count == 0) return topResults;
 
-        // insert the first k datapoint's distance in the PQ.
-        for (int i = 0; i < k; i++) {
-            dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
-            labeltype label = get_label(i);
-            if ((!isIdAllowed) || (*isIdAllowed)(label)) {  // if isIdAllowed == nullptr or the filer funcion returns true
-                topResults.emplace(dist, label);
-            }
-        }
+        std::vector<char> query_state;
+        const void *query = space_->prepare_query_state(query_data, query_state);
 
-        // check the rest of datapoints' distance and keep maintaining the topResults.
-        dist_t lastdist = topResults.empty() ? std::numeric_limits<dist_t>::max() : topResults.top().first;
-        for (int i = k; i < cur_element_count; i++) {
-            dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
-            if (dist <= lastdist) {
+        for (int i = 0; i < cur_element_count; i++) {
+            dist_t dist = query_distfunc_(query, data_ + size_per_element_ * i, dist_func_param_);
+            if (topResults.size() < k || dist < topResults.top().first) {
                 labeltype label = get_label(i);
-                if ((!isIdAllowed) || (*isIdAllowed)(label)) {
-                    topResults.emplace(dist, label);
-                }
-                if (topResults.size() > k)
-                    topResults.pop();
-
-                if (!topResults.empty()) {
-                    lastdist = topResults.top().first;
+                if ((!isIdAllowed) || (*isIdAllowed)(label)) {  // if isIdAllowed == nullptr or the filer funcion returns true
+                    keepClosest(topResults, k, dist, label);
                 }
             }
         }
@@ -171,8 +174,10 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
         readBinaryPOD(input, size_per_element_);
         readBinaryPOD(input, cur_element_count);
 
+        space_ = s;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        query_distfunc_ = s->get_query_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         size_per_element_ = data_size_ + sizeof(labeltype);
         data_ = (char *) malloc(maxelements_ * size_per_element_);
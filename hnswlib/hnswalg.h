@@ -3,10 +3,21 @@
 #include "visited_list_pool.h"
 #include "hnswlib.h"
 #include "mutexed_data.h"
+#include "rerank_store.h"
+#include "mapped_file.h"
+#include "link_arena.h"
+#include "spin_lock.h"
+#include "id_filter.h"
+#include "attribute_store.h"
+#include "namespace_store.h"
+#include "work_stealing.h"
+#include <algorithm>
 #include <atomic>
 #include <random>
+#include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <cstdio>
 #include <unordered_set>
 #include <list>
 #include <memory>
@@ -15,6 +26,69 @@ namespace hnswlib {
 typedef unsigned int tableint;
 typedef unsigned int linklistsizeint;
 
+/*
+* How the level-0 records are stored. INTERLEAVED keeps the links, the vector and the
+* label of an element in one record of data_level0_memory_. SPLIT keeps them in three
+* dense arrays: reading the links of a node then does not pull its vector into the cache,
+* and the vector array can hold any encoding without changing the link layout.
+*/
+enum Level0Layout {
+    LEVEL0_INTERLEAVED = 0,
+    LEVEL0_SPLIT = 1
+};
+
+// orders computed by HierarchicalNSW::reorderIndex
+enum ReorderMethod {
+    REORDER_BFS = 0,  // breadth-first walk of the base layer from the entry point
+    REORDER_RCM = 1   // reverse Cuthill-McKee: low-degree neighbors first, then reversed
+};
+
+// visited sets used by searches, see HierarchicalNSW::setVisitedMode
+enum VisitedMode {
+    VISITED_AUTO = 0,    // sparse for small ef on large indexes, dense otherwise
+    VISITED_DENSE = 1,   // a tag per element of the index
+    VISITED_SPARSE = 2   // a hash set of the visited ids
+};
+
+// how searches with an IdFilter find the allowed elements, see HierarchicalNSW::setFilterMode
+enum FilterMode {
+    FILTER_AUTO = 0,    // a scan for filters allowing few elements, the graph otherwise
+    FILTER_GRAPH = 1,   // the graph search, skipping the elements the filter rejects
+    FILTER_SCAN = 2     // an exact scan of the allowed elements
+};
+
+// how addPoints inserts the elements, see HierarchicalNSW::addPoints
+enum BuildMode {
+    BUILD_FAST = 0,          // concurrent inserts, the graph depends on the thread timing
+    BUILD_DETERMINISTIC = 1  // the same graph for the same seed and input, whatever the threads
+};
+
+// counters of one search, filled by the searches instantiated with collect_metrics
+struct SearchStats {
+    size_t hops{0};  // link lists expanded, on all levels
+    size_t distance_computations{0};
+    size_t visited_nodes{0};  // elements marked visited on the base layer
+    size_t heap_pushes{0};  // pushes to the candidate and result heaps of the base layer
+    size_t levels_descended{0};  // upper levels walked down before the base layer
+
+    SearchStats &operator+=(const SearchStats &other) {
+        hops += other.hops;
+        distance_computations += other.distance_computations;
+        visited_nodes += other.visited_nodes;
+        heap_pushes += other.heap_pushes;
+        levels_descended += other.levels_descended;
+        return *this;
+    }
+};
+
+// saveIndex starts the file with this magic and the format version. Files written before
+// the version field start with max_elements_, which never takes this value.
+static const uint64_t HNSW_INDEX_MAGIC = 0x0058444957534e48ULL;  // "HNSWIDX"
+static const uint32_t HNSW_INDEX_FORMAT_STREAMED = 1;  // saveIndex(location)
+static const uint32_t HNSW_INDEX_FORMAT_PAGE_ALIGNED = 2;  // saveIndex(location, true), can be mapped
+static const uint32_t HNSW_INDEX_FORMAT_VERSION = HNSW_INDEX_FORMAT_PAGE_ALIGNED;  // newest readable version
+static const size_t HNSW_INDEX_PAGE_SIZE = 4096;  // alignment of the sections of the page-aligned format
+
 template<typename dist_t>
 class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
@@ -27,8 +101,132 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     using Candidate = std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>;
 
+    // unvisited neighbors gathered from one link list, their distances are computed in one call
+    struct NeighborBatch {
+        std::vector<tableint> ids;
+        std::vector<const void *> vectors;
+        std::vector<dist_t> dists;
+        size_t size{0};
+
+        explicit NeighborBatch(size_t capacity) : ids(capacity), vectors(capacity), dists(capacity) {}
+
+        inline void add(tableint id, const void *vector) {
+            ids[size] = id;
+            vectors[size++] = vector;
+        }
+
+        // grows to capacity, a batch reused across searches allocates only once
+        void reserve(size_t capacity) {
+            if (ids.size() < capacity) {
+                ids.resize(capacity);
+                vectors.resize(capacity);
+                dists.resize(capacity);
+            }
+        }
+    };
+
+    /*
+    * The operations of Candidate on a vector owned by someone else, a SearchContext, so
+    * the storage is kept between searches. The heap order is the one of priority_queue,
+    * a search gives the same results with either.
+    */
+    class VectorHeap {
+        std::vector<std::pair<dist_t, tableint>> &items_;
+
+     public:
+        explicit VectorHeap(std::vector<std::pair<dist_t, tableint>> &items) : items_(items) {}
+
+        inline void emplace(dist_t dist, tableint id) {
+            items_.emplace_back(dist, id);
+            std::push_heap(items_.begin(), items_.end(), CompareByFirst());
+        }
+
+        inline void pop() {
+            std::pop_heap(items_.begin(), items_.end(), CompareByFirst());
+            items_.pop_back();
+        }
+
+        inline const std::pair<dist_t, tableint> &top() const {
+            return items_.front();
+        }
+
+        inline size_t size() const {
+            return items_.size();
+        }
+
+        inline bool empty() const {
+            return items_.empty();
+        }
+    };
+
+    inline void computeBatchDistances(DISTFUNC_BATCH<dist_t> batch_func, DISTFUNC<dist_t> func,
+                                      const void *data_point, NeighborBatch &batch) const {
+        if (batch_func) {
+            batch_func(data_point, batch.vectors.data(), batch.size, dist_func_param_, batch.dists.data());
+            return;
+        }
+        for (size_t i = 0; i < batch.size; i++) {
+            batch.dists[i] = func(data_point, batch.vectors[i], dist_func_param_);
+        }
+    }
+
+    // exact if the distance is <= bound, otherwise a value > bound
+    inline dist_t boundedDistance(DISTFUNC_BOUNDED<dist_t> bounded_func, DISTFUNC<dist_t> func,
+                                  const void *a, const void *b, dist_t bound) const {
+        if (bounded_func)
+            return bounded_func(a, b, dist_func_param_, bound);
+        return func(a, b, dist_func_param_);
+    }
+
+    // (Re)allocates the level-0 arrays for max_elements and sets the vector and label bases
+    void allocateLevel0(size_t max_elements) {
+        char *data_level0_memory_new = (char *) realloc(data_level0_memory_, max_elements * size_data_per_element_);
+        if (data_level0_memory_new == nullptr)
+            throw std::runtime_error("Not enough memory: failed to allocate the base layer");
+        data_level0_memory_ = data_level0_memory_new;
+        if (level0_layout_ == LEVEL0_INTERLEAVED) {
+            vector_memory_ = data_level0_memory_ + offsetData_;
+            label_memory_ = data_level0_memory_ + label_offset_;
+            return;
+        }
+        char *vector_memory_new = (char *) realloc(vector_memory_, max_elements * vector_stride_);
+        if (vector_memory_new == nullptr)
+            throw std::runtime_error("Not enough memory: failed to allocate the vectors of the base layer");
+        vector_memory_ = vector_memory_new;
+        char *label_memory_new = (char *) realloc(label_memory_, max_elements * label_stride_);
+        if (label_memory_new == nullptr)
+            throw std::runtime_error("Not enough memory: failed to allocate the labels of the base layer");
+        label_memory_ = label_memory_new;
+    }
+
+    // record sizes and offsets of the level-0 layout, size_links_level0 bytes of links per element
+    void setLevel0Layout(Level0Layout layout, size_t size_links_level0) {
+        level0_layout_ = layout;
+        if (layout == LEVEL0_INTERLEAVED) {
+            size_data_per_element_ = size_links_level0 + data_size_ + sizeof(labeltype);
+            offsetData_ = size_links_level0;
+            label_offset_ = size_links_level0 + data_size_;
+            vector_stride_ = size_data_per_element_;
+            label_stride_ = size_data_per_element_;
+        } else {
+            size_data_per_element_ = size_links_level0;
+            offsetData_ = 0;
+            label_offset_ = 0;
+            vector_stride_ = data_size_;
+            label_stride_ = sizeof(labeltype);
+        }
+    }
+
+    // bytes of level-0 data for element_count elements, as written by saveIndex
+    size_t level0Size(size_t element_count) const {
+        size_t size = element_count * size_data_per_element_;
+        if (level0_layout_ == LEVEL0_SPLIT)
+            size += element_count * (vector_stride_ + label_stride_);
+        return size;
+    }
+
     void init(SpaceInterface<dist_t> *s, size_t max_elements, size_t M, size_t ef_construction,
-        size_t random_seed, bool allow_replace_deleted) {
+        size_t random_seed, bool allow_replace_deleted, Level0Layout layout) {
         cur_element_count = 0;
         max_elements_ = max_elements;
         num_deleted_ = 0;
@@ -37,8 +235,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         enterpoint_node_ = -1;
         maxlevel_ = -1;
 
+        space_ = s;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        query_distfunc_ = s->get_query_dist_func();
+        batch_distfunc_ = s->get_batch_dist_func();
+        query_batch_distfunc_ = s->get_query_batch_dist_func();
+        bounded_distfunc_ = s->get_bounded_dist_func();
+        query_bounded_distfunc_ = s->get_query_bounded_dist_func();
         dist_func_param_ = s->get_dist_func_param();
 
         // Adjust M value
@@ -60,42 +264,52 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         
         // configuration variables for level0
         size_t size_links_per_element_level0 = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        size_data_per_element_ = size_links_per_element_level0 + data_size_ + sizeof(labeltype);
-        offsetData_ = size_links_per_element_level0;
-        label_offset_ = size_links_per_element_level0 + data_size_;
+        setLevel0Layout(layout, size_links_per_element_level0);
         // offsetLevel0_ = 0;  // not used?
 
         // Memory allocation for the internal data structure
         // level0: data (from s->get_data_size, data*dim) + M_*2 (links) + links_size + label
         // level0 -> data only
-        data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);  // level0 data
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory");
+        allocateLevel0(max_elements_);
 
         visited_list_pool_ = std::unique_ptr<VisitedListPool>(new VisitedListPool(1, max_elements));
+        sparse_visited_list_pool_.reset(new VisitedListPool(0, max_elements, true));
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements_);  // level1~n 
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: HierarchicalNSW failed to allocate linklists");
-        
+        link_arena_.resize(max_elements_);  // level1~n
     }
 
     void clear() {
-        free(data_level0_memory_);
-        data_level0_memory_ = nullptr;
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
+        id_generation_++;
+        // a mapped index points into the mapping
+        if (!mapped_file_) {
+            free(data_level0_memory_);
+            if (level0_layout_ == LEVEL0_SPLIT) {
+                free(vector_memory_);
+                free(label_memory_);
+            }
         }
-        free(linkLists_);
-        linkLists_ = nullptr;
+        link_arena_.clear();
+        mapped_file_.reset(nullptr);
+        data_level0_memory_ = nullptr;
+        vector_memory_ = nullptr;
+        label_memory_ = nullptr;
         cur_element_count = 0;
         visited_list_pool_.reset(nullptr);
+        sparse_visited_list_pool_.reset(nullptr);
+        rerank_store_.reset(nullptr);
+        attributes_.reset(nullptr);
+        namespaces_.reset(nullptr);
     }
 
  public:
     static const tableint MAX_LABEL_OPERATION_LOCKS = 65536;
     static const unsigned char DELETE_MARK = 0x01;
+    static const size_t SPARSE_VISITED_MIN_ELEMENTS = 1 << 20;  // VISITED_AUTO keeps dense lists below
+    static const size_t SPARSE_VISITED_RATIO = 64;  // and while ef * maxM0_ * ratio exceeds the size
+    static const size_t FILTER_SCAN_RATIO = 2;  // FILTER_AUTO scans while count^2 <= ef * maxM0_ * ratio * size
+    static const size_t BATCH_INTERLEAVED_QUERIES = 8;  // queries of searchKnnBatch searched in turn
+    static const size_t BUILD_SERIAL_ELEMENTS = 2048;  // addPoints inserts serially until the index has as many
+    static const size_t BUILD_ROUND_ELEMENTS = 512;  // elements of a round of BUILD_DETERMINISTIC
 
     size_t max_elements_{0};
     size_t size_data_per_element_{0};
@@ -111,26 +325,50 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     int maxlevel_{0};
 
     std::unique_ptr<VisitedListPool> visited_list_pool_{nullptr};
+    std::unique_ptr<VisitedListPool> sparse_visited_list_pool_{nullptr};
+    VisitedMode visited_mode_{VISITED_AUTO};
+    FilterMode filter_mode_{FILTER_AUTO};
 
     // Locks operations with element by label value
     mutable std::vector<std::mutex> label_op_locks_;
     
-    std::vector<std::mutex> link_list_locks_;
+    std::vector<SpinLock> link_list_locks_;  // one byte per element, guards its link lists
 
     tableint enterpoint_node_{0};
+    std::mutex entry_point_lock_;  // held by the inserts of elements above maxlevel_
 
     // size_t size_links_level0_{0};
     size_t offsetData_{0}, label_offset_{ 0 };
 
-    char *data_level0_memory_{nullptr};
-    char **linkLists_{nullptr};
+    Level0Layout level0_layout_{LEVEL0_INTERLEAVED};
+    char *data_level0_memory_{nullptr};  // level-0 records, only the links with LEVEL0_SPLIT
+    char *vector_memory_{nullptr};  // first stored vector, inside data_level0_memory_ unless split
+    char *label_memory_{nullptr};  // first label, inside data_level0_memory_ unless split
+    size_t vector_stride_{0}, label_stride_{0};
+    LinkArena link_arena_;  // upper-layer link lists by internal id
     std::vector<int> element_levels_;  // keeps level of each element
 
     size_t data_size_{0};
 
-    DISTFUNC<dist_t> fstdistfunc_;
+    SpaceInterface<dist_t> *space_{nullptr};
+    DISTFUNC<dist_t> fstdistfunc_;  // between two stored vectors
+    DISTFUNC<dist_t> query_distfunc_;  // between a query passed by the user and a stored vector
+    DISTFUNC_BATCH<dist_t> batch_distfunc_{nullptr};  // one-to-many versions of the above, may be nullptr
+    DISTFUNC_BATCH<dist_t> query_batch_distfunc_{nullptr};
+    DISTFUNC_BOUNDED<dist_t> bounded_distfunc_{nullptr};  // early-abandoning versions, may be nullptr
+    DISTFUNC_BOUNDED<dist_t> query_bounded_distfunc_{nullptr};
     void *dist_func_param_{nullptr};
 
+    // set by mapIndex, the index is then read-only
+    std::unique_ptr<MappedFile> mapped_file_{nullptr};
+
+    // optional full-precision vectors used to re-rank the results of searchKnn
+    std::unique_ptr<RerankStore> rerank_store_{nullptr};
+    std::unique_ptr<AttributeStore> attributes_{nullptr};
+    std::unique_ptr<NamespaceStore> namespaces_{nullptr};
+    DISTFUNC<dist_t> rerank_distfunc_;
+    void *rerank_dist_func_param_{nullptr};
+
     // mutable std::mutex label_lookup_lock;  // lock for label_lookup_ is mutable to pass the multiThreadLoad_test.cpp compilation
     // std::unordered_map<labeltype, tableint> label_lookup_;
     LabelLookup label_lookup;
@@ -138,11 +376,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     std::default_random_engine level_generator_;
     std::default_random_engine update_probability_generator_;
 
-    mutable std::atomic<long> metric_distance_computations{0};
-    mutable std::atomic<long> metric_hops{0};
     
     bool allow_replace_deleted_ = false;  // flag to replace deleted elements (marked as deleted) during insertions
 
+    // changes whenever internal ids may be given to other elements: on replacing a deleted
+    // element, reorderIndex and clear. IdFilters record it, see checkIdFilter
+    std::atomic<uint64_t> id_generation_{1};
+
     //std::mutex deleted_elements_lock;  // lock for deleted_elements
     //std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
     DeletedElement deleted_elements;
@@ -168,12 +408,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         size_t M = 16,
         size_t ef_construction = 200,
         size_t random_seed = 100,
-        bool allow_replace_deleted = false)
+        bool allow_replace_deleted = false,
+        Level0Layout layout = LEVEL0_INTERLEAVED)
         : label_op_locks_(MAX_LABEL_OPERATION_LOCKS),
             link_list_locks_(max_elements),
             element_levels_(max_elements),
             allow_replace_deleted_(allow_replace_deleted) {
-        init(s, max_elements, M, ef_construction, random_seed, allow_replace_deleted);
+        init(s, max_elements, M, ef_construction, random_seed, allow_replace_deleted, layout);
     }
 
     ~HierarchicalNSW() {
@@ -187,6 +428,67 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    void setVisitedMode(VisitedMode mode) {
+        visited_mode_ = mode;
+    }
+
+
+    void setFilterMode(FilterMode mode) {
+        filter_mode_ = mode;
+    }
+
+
+    /*
+    * A graph search with a filter allowing a fraction s of the elements expands about
+    * ef / s elements to collect ef allowed ones, computing ef * maxM0_ / s distances, and
+    * loses recall when the allowed elements are not connected through each other. A scan
+    * of the allowed elements computes s * size distances and is exact, so it is chosen
+    * when count^2 is small against ef * maxM0_ * size.
+    */
+    bool useFilteredScan(const IdFilter *id_filter, size_t ef) const {
+        return id_filter && useScan(id_filter->count(), ef);
+    }
+
+
+    // a scan of count allowed elements is cheaper than the graph search, see useFilteredScan
+    bool useScan(size_t count, size_t ef) const {
+        if (filter_mode_ == FILTER_GRAPH)
+            return false;
+        if (filter_mode_ == FILTER_SCAN)
+            return true;
+        return (double) count * count <= (double) ef * maxM0_ * FILTER_SCAN_RATIO * cur_element_count;
+    }
+
+
+    /*
+    * A dense visited list costs 2 bytes per element of the index for every concurrent
+    * search, and each search touches random lines of it. A search visits about
+    * ef * maxM0_ elements, so for a small ef on a large index a hash set of the visited ids
+    * is far smaller and stays in cache. ef is 0 when a stop condition bounds the search.
+    */
+    bool useSparseVisited(size_t ef) const {
+        if (visited_mode_ != VISITED_AUTO)
+            return visited_mode_ == VISITED_SPARSE;
+        return ef != 0 && max_elements_ >= SPARSE_VISITED_MIN_ELEMENTS &&
+            ef * maxM0_ * SPARSE_VISITED_RATIO <= max_elements_;
+    }
+
+
+    VisitedList *getFreeVisitedList(size_t ef) const {
+        if (useSparseVisited(ef))
+            return sparse_visited_list_pool_->getFreeVisitedList();
+        return visited_list_pool_->getFreeVisitedList();
+    }
+
+
+    void releaseVisitedList(VisitedList *vl) const {
+        if (vl->isSparse())
+            sparse_visited_list_pool_->releaseVisitedList(vl);
+        else
+            visited_list_pool_->releaseVisitedList(vl);
+    }
+
+
     inline std::mutex& getLabelOpMutex(labeltype label) const {
         // calculate hash
         size_t lock_id = label & (MAX_LABEL_OPERATION_LOCKS - 1);
@@ -196,23 +498,23 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     inline labeltype getExternalLabel(tableint internal_id) const {
         labeltype return_label;
-        memcpy(&return_label, (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), sizeof(labeltype));
+        memcpy(&return_label, (label_memory_ + internal_id * label_stride_), sizeof(labeltype));
         return return_label;
     }
 
 
     inline void setExternalLabel(tableint internal_id, labeltype label) const {
-        memcpy((data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_), &label, sizeof(labeltype));
+        memcpy((label_memory_ + internal_id * label_stride_), &label, sizeof(labeltype));
     }
 
 
     inline labeltype *getExternalLabeLp(tableint internal_id) const {
-        return (labeltype *) (data_level0_memory_ + internal_id * size_data_per_element_ + label_offset_);
+        return (labeltype *) (label_memory_ + internal_id * label_stride_);
     }
 
 
     inline char *getDataByInternalId(tableint internal_id) const {
-        return (data_level0_memory_ + internal_id * size_data_per_element_ + offsetData_);
+        return (vector_memory_ + internal_id * vector_stride_);
     }
 
 
@@ -239,12 +541,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     Candidate searchBaseLayer(tableint ep_id, const void *data_point, int layer) {
-        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
+        VisitedList *vl = getFreeVisitedList(ef_construction_);
 
         Candidate top_candidates;  // W
         Candidate candidateSet;  // C
+        NeighborBatch batch(maxM0_);
 
         dist_t lowerBound;
         if (!isMarkedDeleted(ep_id)) {
@@ -256,7 +557,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             lowerBound = std::numeric_limits<dist_t>::max();
             candidateSet.emplace(-lowerBound, ep_id);
         }
-        visited_array[ep_id] = visited_array_tag;
+        vl->visit(ep_id);
 
         while (!candidateSet.empty()) {
             std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
@@ -267,7 +568,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
             tableint curNodeNum = curr_el_pair.second;
 
-            std::unique_lock <std::mutex> lock(link_list_locks_[curNodeNum]);
+            std::unique_lock <SpinLock> lock(link_list_locks_[curNodeNum]);
 
             int *data;  // = (int *)(linkList0_ + curNodeNum * size_links_per_element0_);
             if (layer == 0) {
@@ -279,24 +580,28 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             size_t size = getListCount((linklistsizeint*)data);
             tableint *datal = (tableint *) (data + 1);
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
+            vl->prefetch(*(data + 1));
+            vl->prefetch(*(data + 1) + 64);
             _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
             _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
 #endif
 
+            batch.size = 0;
             for (size_t j = 0; j < size; j++) {
                 tableint candidate_id = *(datal + j);
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(datal + j + 1)), _MM_HINT_T0);
+                vl->prefetch(*(datal + j + 1));
                 _mm_prefetch(getDataByInternalId(*(datal + j + 1)), _MM_HINT_T0);
 #endif
-                if (visited_array[candidate_id] == visited_array_tag) continue;
-                visited_array[candidate_id] = visited_array_tag;
-                char *currObj1 = (getDataByInternalId(candidate_id));
+                if (!vl->visit(candidate_id)) continue;
+                batch.add(candidate_id, getDataByInternalId(candidate_id));
+            }
+            computeBatchDistances(batch_distfunc_, fstdistfunc_, data_point, batch);
 
-                dist_t dist1 = fstdistfunc_(data_point, currObj1, dist_func_param_);
+            for (size_t j = 0; j < batch.size; j++) {
+                tableint candidate_id = batch.ids[j];
+                dist_t dist1 = batch.dists[j];
                 if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
                     candidateSet.emplace(-dist1, candidate_id);
 #ifdef USE_SSE
@@ -314,7 +619,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
             }
         }
-        visited_list_pool_->releaseVisitedList(vl);
+        releaseVisitedList(vl);
 
         return top_candidates;
     }
@@ -327,31 +632,61 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         const void *data_point,
         size_t ef,
         BaseFilterFunctor* isIdAllowed = nullptr,
-        BaseSearchStopCondition<dist_t>* stop_condition = nullptr) const {
-        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
-        vl_type *visited_array = vl->mass;
-        vl_type visited_array_tag = vl->curV;
-
+        BaseSearchStopCondition<dist_t>* stop_condition = nullptr,
+        SearchStats* stats = nullptr) const {
         Candidate top_candidates;
         Candidate candidate_set;
+        NeighborBatch batch(maxM0_);
+        searchBaseLayerST<bare_bone_search, collect_metrics>(
+            ep_id, data_point, ef, isIdAllowed, stop_condition, top_candidates, candidate_set, batch, stats);
+        return top_candidates;
+    }
+
+
+    /*
+    * The search itself, on heaps and a batch provided by the caller, Candidate or VectorHeap.
+    * With collect_metrics the search adds its counters to stats, without it the counting
+    * is compiled out.
+    */
+    template <bool bare_bone_search, bool collect_metrics, typename heap_t>
+    void searchBaseLayerST(
+        tableint ep_id,
+        const void *data_point,
+        size_t ef,
+        BaseFilterFunctor* isIdAllowed,
+        BaseSearchStopCondition<dist_t>* stop_condition,
+        heap_t &top_candidates,
+        heap_t &candidate_set,
+        NeighborBatch &batch,
+        SearchStats* stats = nullptr) const {
+        const IdFilter *id_filter = checkedIdFilter(isIdAllowed);
+        VisitedList *vl = getFreeVisitedList(ef);
+        const NamespaceFilter *namespace_filter = isIdAllowed ? isIdAllowed->asNamespaceFilter() : nullptr;
 
         dist_t lowerBound;
-        if (bare_bone_search || 
-            (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id))))) {
+        if (bare_bone_search || isAllowed(ep_id, isIdAllowed, id_filter, namespace_filter)) {
             char* ep_data = getDataByInternalId(ep_id);
-            dist_t dist = fstdistfunc_(data_point, ep_data, dist_func_param_);
+            dist_t dist = query_distfunc_(data_point, ep_data, dist_func_param_);
             lowerBound = dist;
             top_candidates.emplace(dist, ep_id);
             if (!bare_bone_search && stop_condition) {
                 stop_condition->add_point_to_result(getExternalLabel(ep_id), ep_data, dist);
             }
             candidate_set.emplace(-dist, ep_id);
+            if (collect_metrics) {
+                stats->distance_computations++;
+                stats->heap_pushes++;
+            }
         } else {
             lowerBound = std::numeric_limits<dist_t>::max();
             candidate_set.emplace(-lowerBound, ep_id);
         }
 
-        visited_array[ep_id] = visited_array_tag;
+        vl->visit(ep_id);
+        if (collect_metrics) {
+            stats->visited_nodes++;
+            stats->heap_pushes++;
+        }
 
         while (!candidate_set.empty()) {
             std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
@@ -377,78 +712,155 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             size_t size = getListCount((linklistsizeint*)data);
 //                bool cur_node_deleted = isMarkedDeleted(current_node_id);
             if (collect_metrics) {
-                metric_hops++;
-                metric_distance_computations+=size;
+                stats->hops++;
             }
 
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
-            _mm_prefetch(data_level0_memory_ + (*(data + 1)) * size_data_per_element_ + offsetData_, _MM_HINT_T0);
+            vl->prefetch(*(data + 1));
+            vl->prefetch(*(data + 1) + 64);
+            _mm_prefetch(getDataByInternalId(*(data + 1)), _MM_HINT_T0);
             _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
 #endif
 
+            batch.size = 0;
             for (size_t j = 1; j <= size; j++) {
                 int candidate_id = *(data + j);
 //                    if (candidate_id == 0) continue;
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
-                                _MM_HINT_T0);  ////////////
+                vl->prefetch(*(data + j + 1));
+                _mm_prefetch(getDataByInternalId(*(data + j + 1)), _MM_HINT_T0);  ////////////
 #endif
-                if (!(visited_array[candidate_id] == visited_array_tag)) {
-                    visited_array[candidate_id] = visited_array_tag;
-
-                    char *currObj1 = (getDataByInternalId(candidate_id));
-                    dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+                if (vl->visit(candidate_id)) {
+                    batch.add(candidate_id, getDataByInternalId(candidate_id));
+                }
+            }
+            if (collect_metrics) {
+                stats->distance_computations += batch.size;
+                stats->visited_nodes += batch.size;
+            }
+            // with an early-abandoning kernel the distances are computed one by one below,
+            // against the bound of the moment
+            if (!query_bounded_distfunc_)
+                computeBatchDistances(query_batch_distfunc_, query_distfunc_, data_point, batch);
+
+            for (size_t j = 0; j < batch.size; j++) {
+                tableint candidate_id = batch.ids[j];
+                const void *currObj1 = batch.vectors[j];
+                dist_t dist;
+                if (query_bounded_distfunc_) {
+                    bool unbounded = top_candidates.size() < ef || (!bare_bone_search && stop_condition);
+                    dist = query_bounded_distfunc_(data_point, currObj1, dist_func_param_,
+                                                   unbounded ? std::numeric_limits<dist_t>::max() : lowerBound);
+                } else {
+                    dist = batch.dists[j];
+                }
 
-                    bool flag_consider_candidate;
-                    if (!bare_bone_search && stop_condition) {
-                        flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
-                    } else {
-                        flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
-                    }
+                bool flag_consider_candidate;
+                if (!bare_bone_search && stop_condition) {
+                    flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
+                } else {
+                    flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
+                }
 
-                    if (flag_consider_candidate) {
-                        candidate_set.emplace(-dist, candidate_id);
+                if (flag_consider_candidate) {
+                    candidate_set.emplace(-dist, candidate_id);
+                    if (collect_metrics)
+                        stats->heap_pushes++;
 #ifdef USE_SSE
-                        _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_, _MM_HINT_T0);
+                    _mm_prefetch((char *) get_linklist0(candidate_set.top().second), _MM_HINT_T0);
 #endif
 
-                        if (bare_bone_search || 
-                            (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) {
-                            top_candidates.emplace(dist, candidate_id);
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
-                            }
+                    if (bare_bone_search || isAllowed(candidate_id, isIdAllowed, id_filter, namespace_filter)) {
+                        top_candidates.emplace(dist, candidate_id);
+                        if (collect_metrics)
+                            stats->heap_pushes++;
+                        if (!bare_bone_search && stop_condition) {
+                            stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
                         }
+                    }
 
-                        bool flag_remove_extra = false;
+                    bool flag_remove_extra = false;
+                    if (!bare_bone_search && stop_condition) {
+                        flag_remove_extra = stop_condition->should_remove_extra();
+                    } else {
+                        flag_remove_extra = top_candidates.size() > ef;
+                    }
+                    while (flag_remove_extra) {
+                        tableint id = top_candidates.top().second;
+                        top_candidates.pop();
                         if (!bare_bone_search && stop_condition) {
+                            stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), dist);
                             flag_remove_extra = stop_condition->should_remove_extra();
                         } else {
                             flag_remove_extra = top_candidates.size() > ef;
                         }
-                        while (flag_remove_extra) {
-                            tableint id = top_candidates.top().second;
-                            top_candidates.pop();
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), dist);
-                                flag_remove_extra = stop_condition->should_remove_extra();
-                            } else {
-                                flag_remove_extra = top_candidates.size() > ef;
-                            }
-                        }
-
-                        if (!top_candidates.empty())
-                            lowerBound = top_candidates.top().first;
                     }
+
+                    if (!top_candidates.empty())
+                        lowerBound = top_candidates.top().first;
                 }
             }
         }
 
-        visited_list_pool_->releaseVisitedList(vl);
-        return top_candidates;
+        releaseVisitedList(vl);
+    }
+
+
+    // a list of ids enumerated like an IdFilter, for searchFilteredScan
+    struct IdList {
+        const std::vector<tableint> &ids;
+
+        explicit IdList(const std::vector<tableint> &ids) : ids(ids) {}
+
+        template<typename visitor_t>
+        void forEachAllowed(visitor_t visit) const {
+            for (tableint id : ids)
+                visit(id);
+        }
+    };
+
+
+    /*
+    * The ef closest elements among ids, an IdFilter or an IdList, that isIdAllowed allows
+    * too, by a scan in the manner of BruteforceSearch, with the distances computed in
+    * batches like the neighbors of a hop.
+    */
+    template <bool collect_metrics, typename ids_t, typename heap_t>
+    void searchFilteredScan(
+        const void *data_point,
+        size_t ef,
+        const ids_t &ids,
+        BaseFilterFunctor* isIdAllowed,
+        heap_t &top_candidates,
+        NeighborBatch &batch,
+        SearchStats* stats = nullptr) const {
+        size_t max_id = cur_element_count;
+        const IdFilter *id_filter = checkedIdFilter(isIdAllowed);
+        batch.reserve(maxM0_);
+        batch.size = 0;
+        auto scan_batch = [&]() {
+            computeBatchDistances(query_batch_distfunc_, query_distfunc_, data_point, batch);
+            for (size_t j = 0; j < batch.size; j++) {
+                keepClosest(top_candidates, ef, batch.dists[j], batch.ids[j]);
+            }
+            if (collect_metrics)
+                stats->distance_computations += batch.size;
+            batch.size = 0;
+        };
+        ids.forEachAllowed([&](tableint id) {
+            if (id >= max_id || !isAllowed(id, isIdAllowed, id_filter))
+                return;
+            batch.add(id, getDataByInternalId(id));
+            if (batch.size == maxM0_)
+                scan_batch();
+        });
+        scan_batch();
+    }
+
+
+    inline void throwIfMapped() const {
+        if (mapped_file_)
+            throw std::runtime_error("The index is mapped read-only by mapIndex and cannot be modified");
     }
 
 
@@ -474,9 +886,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
             for (std::pair<dist_t, tableint> second_pair : return_list) {
                 dist_t curdist =
-                        fstdistfunc_(getDataByInternalId(second_pair.second),
+                        boundedDistance(bounded_distfunc_, fstdistfunc_,
+                                        getDataByInternalId(second_pair.second),
                                         getDataByInternalId(curent_pair.second),
-                                        dist_func_param_);
+                                        dist_to_query);
                 if (curdist < dist_to_query) {
                     good = false;
                     break;
@@ -504,7 +917,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     linklistsizeint *get_linklist(tableint internal_id, int level) const {
-        return (linklistsizeint *) (linkLists_[internal_id] + (level - 1) * size_links_per_element_);
+        return (linklistsizeint *) (link_arena_.get(internal_id) + (level - 1) * size_links_per_element_);
     }
 
 
@@ -536,7 +949,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         {
             // lock only during the update
             // because during the addition the lock for cur_c is already acquired
-            std::unique_lock <std::mutex> lock(link_list_locks_[cur_c], std::defer_lock);
+            std::unique_lock <SpinLock> lock(link_list_locks_[cur_c], std::defer_lock);
             if (isUpdate) {
                 lock.lock();
             }
@@ -563,7 +976,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     
         for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
-            std::unique_lock <std::mutex> lock(link_list_locks_[selectedNeighbors[idx]]);
+            std::unique_lock <SpinLock> lock(link_list_locks_[selectedNeighbors[idx]]);
 
             linklistsizeint *ll_other;
             if (level == 0)
@@ -630,32 +1043,221 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     void resizeIndex(size_t new_max_elements) {
+        throwIfMapped();
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
 
         visited_list_pool_.reset(new VisitedListPool(1, new_max_elements));
+        sparse_visited_list_pool_.reset(new VisitedListPool(0, new_max_elements, true));
 
         element_levels_.resize(new_max_elements);
 
-        std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
+        std::vector<SpinLock>(new_max_elements).swap(link_list_locks_);
 
         // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
-        if (data_level0_memory_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
-        data_level0_memory_ = data_level0_memory_new;
+        allocateLevel0(new_max_elements);
 
         // Reallocate all other layers
-        char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
-        if (linkLists_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
-        linkLists_ = linkLists_new;
+        link_arena_.resize(new_max_elements);
+
+        if (rerank_store_)
+            rerank_store_->resize(new_max_elements);
+        if (attributes_)
+            attributes_->resize(new_max_elements);
+        if (namespaces_)
+            namespaces_->resize(new_max_elements);
 
         max_elements_ = new_max_elements;
     }
 
-    size_t indexFileSize() const {
+
+    // new position -> old internal id, a walk of the level-0 graph that visits every element
+    std::vector<tableint> reorderPermutation(ReorderMethod method) const {
+        size_t count = cur_element_count;
+        auto degree = [this](tableint id) { return getListCount(get_linklist0(id)); };
+        std::vector<tableint> roots;  // walks start at the first unvisited root
+        if (method == REORDER_BFS)
+            roots.push_back(enterpoint_node_);
+        for (tableint i = 0; i < count; i++)
+            roots.push_back(i);
+        if (method == REORDER_RCM)
+            std::stable_sort(roots.begin(), roots.end(),
+                             [&](tableint a, tableint b) { return degree(a) < degree(b); });
+
+        std::vector<tableint> order;
+        order.reserve(count);
+        std::vector<bool> visited(count, false);
+        std::vector<tableint> neighbors;
+        for (tableint root : roots) {
+            if (visited[root])
+                continue;
+            visited[root] = true;
+            order.push_back(root);
+            for (size_t head = order.size() - 1; head < order.size(); head++) {
+                linklistsizeint *ll = get_linklist0(order[head]);
+                tableint *links = (tableint *) (ll + 1);
+                size_t size = getListCount(ll);
+                neighbors.clear();
+                for (size_t j = 0; j < size; j++) {
+                    if (!visited[links[j]]) {
+                        visited[links[j]] = true;
+                        neighbors.push_back(links[j]);
+                    }
+                }
+                if (method == REORDER_RCM)
+                    std::stable_sort(neighbors.begin(), neighbors.end(),
+                                     [&](tableint a, tableint b) { return degree(a) < degree(b); });
+                order.insert(order.end(), neighbors.begin(), neighbors.end());
+            }
+        }
+        if (method == REORDER_RCM)
+            std::reverse(order.begin(), order.end());
+        return order;
+    }
+
+
+    /*
+    * Renumbers the internal ids so that elements linked in the graph are stored close to
+    * each other, and a search reads fewer cache lines and pages. Vectors, labels, links
+    * and deletion marks move with their element, so searches return the same results.
+    * Needs a temporary copy of the largest level-0 array. Not thread safe: run it once the
+    * index is built, e.g. before saveIndex, while no other operation uses the index.
+    */
+    void reorderIndex(ReorderMethod method = REORDER_BFS) {
+        throwIfMapped();
+        size_t count = cur_element_count;
+        if (count == 0)
+            return;
+        std::vector<tableint> order = reorderPermutation(method);
+        id_generation_++;
+        std::vector<tableint> new_id(count);
+        for (tableint i = 0; i < count; i++)
+            new_id[order[i]] = i;
+
+        auto permute = [&](char *base, size_t stride) {
+            std::vector<char> permuted(count * stride);
+            for (size_t i = 0; i < count; i++)
+                memcpy(permuted.data() + i * stride, base + order[i] * stride, stride);
+            memcpy(base, permuted.data(), permuted.size());
+        };
+        permute(data_level0_memory_, size_data_per_element_);
+        if (level0_layout_ == LEVEL0_SPLIT) {
+            permute(vector_memory_, vector_stride_);
+            permute(label_memory_, label_stride_);
+        }
+        if (rerank_store_)
+            permute(rerank_store_->get(0), rerank_store_->vectorSize());
+        if (attributes_)
+            attributes_->permute(order);
+
+        std::vector<size_t> link_offsets(count);
+        for (tableint i = 0; i < count; i++)
+            link_offsets[i] = link_arena_.getOffset(i);
+        std::vector<int> levels(element_levels_.begin(), element_levels_.begin() + count);
+        for (tableint i = 0; i < count; i++) {
+            link_arena_.setOffset(i, link_offsets[order[i]]);
+            element_levels_[i] = levels[order[i]];
+        }
+        if (namespaces_)
+            namespaces_->permute(order, element_levels_);
+
+        label_lookup.clear();
+        deleted_elements.clear();
+        for (tableint i = 0; i < count; i++) {
+            for (int level = 0; level <= element_levels_[i]; level++) {
+                linklistsizeint *ll = get_linklist_at_level(i, level);
+                tableint *links = (tableint *) (ll + 1);
+                size_t size = getListCount(ll);
+                for (size_t j = 0; j < size; j++)
+                    links[j] = new_id[links[j]];
+            }
+            label_lookup.add_label_without_lock(getExternalLabel(i), i);
+            if (allow_replace_deleted_ && isMarkedDeleted(i))
+                deleted_elements.add_deleted_id_without_lock(i);
+        }
+        enterpoint_node_ = new_id[enterpoint_node_];
+    }
+
+
+    /*
+    * Keeps a copy of every added vector in the space s (normally the float32 space the
+    * index space approximates, e.g. L2Space for L2SpaceSQ8) and re-ranks the final ef
+    * candidates of searchKnn with it. Without a path the copies are kept in memory and
+    * must be set up before the first point is added. With a path they are kept in a
+    * memory-mapped file, which can be reopened after loadIndex.
+    */
+    void setRerankSpace(SpaceInterface<dist_t> *s, const std::string &path = "") {
+        if (path.empty() && cur_element_count > 0)
+            throw std::runtime_error("setRerankSpace without a file must be called before adding points");
+        rerank_store_.reset(new RerankStore(max_elements_, s->get_data_size(), path));
+        rerank_distfunc_ = s->get_query_dist_func();
+        rerank_dist_func_param_ = s->get_dist_func_param();
+    }
+
+
+    void rerankCandidates(const void *query_data, Candidate &top_candidates) const {
+        std::vector<std::pair<dist_t, tableint>> reranked;
+        reranked.reserve(top_candidates.size());
+        while (!top_candidates.empty()) {
+            tableint id = top_candidates.top().second;
+            top_candidates.pop();
+            reranked.emplace_back(rerank_distfunc_(query_data, rerank_store_->get(id), rerank_dist_func_param_), id);
+        }
+        top_candidates = Candidate(CompareByFirst(), std::move(reranked));
+    }
+
+
+    // the same on the heap of a SearchContext, in place
+    void rerankCandidates(const void *query_data, std::vector<std::pair<dist_t, tableint>> &heap) const {
+        for (std::pair<dist_t, tableint> &candidate : heap)
+            candidate.first = rerank_distfunc_(query_data, rerank_store_->get(candidate.second), rerank_dist_func_param_);
+        std::make_heap(heap.begin(), heap.end(), CompareByFirst());
+    }
+
+    // offsets of the sections of a page-aligned index file, the header takes the first page
+    struct IndexSections {
+        size_t level0, vectors, labels, levels, deleted, upper;
+    };
+
+    static size_t alignToPage(size_t offset) {
+        return (offset + HNSW_INDEX_PAGE_SIZE - 1) / HNSW_INDEX_PAGE_SIZE * HNSW_INDEX_PAGE_SIZE;
+    }
+
+    IndexSections indexSections(size_t num_deleted) const {
+        size_t count = cur_element_count;
+        IndexSections sections;
+        sections.level0 = HNSW_INDEX_PAGE_SIZE;
+        size_t end = sections.level0 + count * size_data_per_element_;
+        sections.vectors = sections.labels = end;
+        if (level0_layout_ == LEVEL0_SPLIT) {
+            sections.vectors = alignToPage(end);
+            sections.labels = alignToPage(sections.vectors + count * vector_stride_);
+            end = sections.labels + count * label_stride_;
+        }
+        sections.levels = alignToPage(end);
+        sections.deleted = sections.levels + count * sizeof(int);
+        sections.upper = alignToPage(sections.deleted + num_deleted * sizeof(tableint));
+        return sections;
+    }
+
+    // bytes of the upper-layer links of all elements, stored back to back by the page-aligned format
+    size_t upperLinksSize() const {
+        size_t size = 0;
+        for (size_t i = 0; i < cur_element_count; i++) {
+            size += size_links_per_element_ * element_levels_[i];
+        }
+        return size;
+    }
+
+    size_t indexFileSize(bool page_aligned = false) const {
+        if (page_aligned)
+            return indexSections(num_deleted_).upper + upperLinksSize();
+
         size_t size = 0;
+        size += sizeof(HNSW_INDEX_MAGIC);
+        size += sizeof(HNSW_INDEX_FORMAT_VERSION);
+        size += sizeof(uint32_t);  // layout
+        size += sizeof(data_size_);
         //size += sizeof(offsetLevel0_);
         size += sizeof(max_elements_);
         size += sizeof(cur_element_count);
@@ -670,7 +1272,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         //size += sizeof(mult_);
         size += sizeof(ef_construction_);
 
-        size += cur_element_count * size_data_per_element_;
+        size += level0Size(cur_element_count);
 
         for (size_t i = 0; i < cur_element_count; i++) {
             unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
@@ -680,10 +1282,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         return size;
     }
 
-    void saveIndex(const std::string &location) {
-        std::ofstream output(location, std::ios::binary);
-        std::streampos position;
-
+    void writeIndexHeader(std::ofstream &output, uint32_t version) const {
+        writeBinaryPOD(output, HNSW_INDEX_MAGIC);
+        writeBinaryPOD(output, version);
+        writeBinaryPOD(output, (uint32_t) level0_layout_);
+        writeBinaryPOD(output, data_size_);
         //writeBinaryPOD(output, offsetLevel0_);
         writeBinaryPOD(output, max_elements_);
         writeBinaryPOD(output, cur_element_count);
@@ -697,30 +1300,155 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         writeBinaryPOD(output, M_);
         //writeBinaryPOD(output, mult_);
         writeBinaryPOD(output, ef_construction_);
+    }
+
+    // zeros up to the next section, which is less than a page away
+    static void padToOffset(std::ofstream &output, size_t offset) {
+        static const char zeros[HNSW_INDEX_PAGE_SIZE] = {};
+        output.write(zeros, offset - (size_t) output.tellp());
+    }
+
+    /*
+    * With page_aligned the index is saved in a format that mapIndex can open without
+    * reading it: every section starts on a page boundary and the upper-layer links are
+    * stored back to back, so they can be used in place. loadIndex reads both formats.
+    * The index is written to location + ".tmp" and then renamed over location, so a
+    * process that has the old file mapped keeps reading the old contents.
+    */
+    void saveIndex(const std::string &location) {
+        saveIndex(location, false);
+    }
+
+    void saveIndex(const std::string &location, bool page_aligned) {
+        std::string temp_location = location + ".tmp";
+        std::ofstream output(temp_location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        if (page_aligned)
+            savePageAligned(output);
+        else
+            saveStreamed(output);
+        output.close();
+        if (output.fail()) {
+            std::remove(temp_location.c_str());
+            throw std::runtime_error("Cannot write file");
+        }
+        replaceFile(temp_location, location);
+        saveSideFiles(location);
+    }
+
+    // renames from over to, which rename does not do on Windows when to exists
+    static void replaceFile(const std::string &from, const std::string &to) {
+        if (std::rename(from.c_str(), to.c_str()) == 0)
+            return;
+        std::remove(to.c_str());
+        if (std::rename(from.c_str(), to.c_str()) != 0) {
+            std::remove(from.c_str());
+            throw std::runtime_error("Cannot write file");
+        }
+    }
+
+
+    void saveStreamed(std::ofstream &output) const {
+        writeIndexHeader(output, HNSW_INDEX_FORMAT_STREAMED);
 
         output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+        if (level0_layout_ == LEVEL0_SPLIT) {
+            output.write(vector_memory_, cur_element_count * vector_stride_);
+            output.write(label_memory_, cur_element_count * label_stride_);
+        }
 
         for (size_t i = 0; i < cur_element_count; i++) {
             unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
             writeBinaryPOD(output, linkListSize);
             if (linkListSize)
-                output.write(linkLists_[i], linkListSize);
+                output.write(link_arena_.get(i), linkListSize);
         }
-        output.close();
     }
 
 
-    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
-        std::ifstream input(location, std::ios::binary);
+    void savePageAligned(std::ofstream &output) const {
+        size_t count = cur_element_count;
+        std::vector<tableint> deleted;
+        for (tableint i = 0; i < count; i++) {
+            if (isMarkedDeleted(i))
+                deleted.push_back(i);
+        }
+        IndexSections sections = indexSections(deleted.size());
+
+        writeIndexHeader(output, HNSW_INDEX_FORMAT_PAGE_ALIGNED);
+        writeBinaryPOD(output, deleted.size());
+
+        padToOffset(output, sections.level0);
+        output.write(data_level0_memory_, count * size_data_per_element_);
+        if (level0_layout_ == LEVEL0_SPLIT) {
+            padToOffset(output, sections.vectors);
+            output.write(vector_memory_, count * vector_stride_);
+            padToOffset(output, sections.labels);
+            output.write(label_memory_, count * label_stride_);
+        }
+        padToOffset(output, sections.levels);
+        output.write((const char *) element_levels_.data(), count * sizeof(int));
+        output.write((const char *) deleted.data(), deleted.size() * sizeof(tableint));
+        padToOffset(output, sections.upper);
+        for (size_t i = 0; i < count; i++) {
+            if (element_levels_[i] > 0)
+                output.write(link_arena_.get(i), size_links_per_element_ * element_levels_[i]);
+        }
+    }
 
-        if (!input.is_open())
-            throw std::runtime_error("Cannot open file");
 
-        clear();
-        // get file size:
-        input.seekg(0, input.end);
-        std::streampos total_filesize = input.tellg();
-        input.seekg(0, input.beg);
+    // the attributes and namespaces are saved next to the index, in location + ".attributes"
+    // and location + ".namespaces"
+    static std::string attributesLocation(const std::string &location) {
+        return location + ".attributes";
+    }
+
+    static std::string namespacesLocation(const std::string &location) {
+        return location + ".namespaces";
+    }
+
+    // replaces or removes the side files of an index previously saved to location
+    void saveSideFiles(const std::string &location) const {
+        if (attributes_)
+            attributes_->save(attributesLocation(location), cur_element_count);
+        else
+            std::remove(attributesLocation(location).c_str());
+        if (namespaces_)
+            namespaces_->save(namespacesLocation(location), cur_element_count);
+        else
+            std::remove(namespacesLocation(location).c_str());
+    }
+
+    // after the levels are loaded
+    void loadSideFiles(const std::string &location) {
+        if (std::ifstream(attributesLocation(location)).good())
+            attributes_.reset(AttributeStore::load(attributesLocation(location), max_elements_));
+        if (std::ifstream(namespacesLocation(location)).good())
+            namespaces_.reset(NamespaceStore::load(namespacesLocation(location), max_elements_, element_levels_));
+    }
+
+
+    // reads the header of any format version and sets up the space, returns the version
+    uint32_t readIndexHeader(std::ifstream &input, SpaceInterface<dist_t> *s, size_t max_elements_i) {
+        // files without the magic predate the version field and use the interleaved layout
+        uint64_t magic = 0;
+        uint32_t version = 0;
+        uint32_t layout = LEVEL0_INTERLEAVED;
+        size_t stored_data_size = 0;
+        readBinaryPOD(input, magic);
+        if (magic == HNSW_INDEX_MAGIC) {
+            readBinaryPOD(input, version);
+            if (version > HNSW_INDEX_FORMAT_VERSION)
+                throw std::runtime_error("The index was saved by a newer version of hnswlib");
+            readBinaryPOD(input, layout);
+            if (layout != LEVEL0_INTERLEAVED && layout != LEVEL0_SPLIT)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            readBinaryPOD(input, stored_data_size);
+        } else {
+            input.seekg(0, input.beg);
+        }
 
         //readBinaryPOD(input, offsetLevel0_);
         readBinaryPOD(input, max_elements_);
@@ -739,17 +1467,102 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         readBinaryPOD(input, maxM0_);
         readBinaryPOD(input, M_);
         readBinaryPOD(input, ef_construction_);
+        if (version >= HNSW_INDEX_FORMAT_PAGE_ALIGNED) {
+            size_t num_deleted;
+            readBinaryPOD(input, num_deleted);
+            num_deleted_ = num_deleted;
+        }
 
+        space_ = s;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        query_distfunc_ = s->get_query_dist_func();
+        batch_distfunc_ = s->get_batch_dist_func();
+        query_batch_distfunc_ = s->get_query_batch_dist_func();
+        bounded_distfunc_ = s->get_bounded_dist_func();
+        query_bounded_distfunc_ = s->get_query_bounded_dist_func();
         dist_func_param_ = s->get_dist_func_param();
+        if (version > 0 && stored_data_size != data_size_)
+            throw std::runtime_error("The index was saved with a space of another data size");
 
+        level0_layout_ = (Level0Layout) layout;
+        if (level0_layout_ == LEVEL0_INTERLEAVED) {
+            vector_stride_ = size_data_per_element_;
+            label_stride_ = size_data_per_element_;
+        } else {
+            setLevel0Layout(LEVEL0_SPLIT, size_data_per_element_);
+        }
+        size_links_per_element_ = M_ * sizeof(tableint) + sizeof(linklistsizeint);
+        return version;
+    }
 
-        auto pos = input.tellg();
 
-        /// Optional - check if index is ok:
-        input.seekg(cur_element_count * size_data_per_element_, input.cur);
-        for (size_t i = 0; i < cur_element_count; i++) {
+    // locks, visited lists and link list pointers for a loaded index of max_elements
+    void initLoadedIndex(size_t max_elements) {
+        //size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+        std::vector<SpinLock>(max_elements).swap(link_list_locks_);
+        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+
+        visited_list_pool_.reset(new VisitedListPool(1, max_elements));
+        sparse_visited_list_pool_.reset(new VisitedListPool(0, max_elements, true));
+
+        link_arena_.resize(max_elements);
+        element_levels_ = std::vector<int>(max_elements);
+        //revSize_ = 1.0 / mult_;
+        ef_ = 10;
+    }
+
+
+    // uses a block of the upper-layer link lists of all elements stored back to back by id
+    void setUpperLinks(char *block, size_t size, bool owned) {
+        size_t offset = link_arena_.addBlock(block, size, owned);
+        for (tableint i = 0; i < cur_element_count; i++) {
+            link_arena_.setOffset(i, offset);
+            offset += size_links_per_element_ * element_levels_[i];
+        }
+    }
+
+
+    // label lookup and deleted ids of a loaded page-aligned index
+    void indexLoadedElements(const tableint *deleted) {
+        for (size_t i = 0; i < cur_element_count; i++) {
+            label_lookup.add_label_without_lock(getExternalLabel(i), i);
+        }
+        if (allow_replace_deleted_) {
+            for (size_t i = 0; i < num_deleted_; i++)
+                deleted_elements.add_deleted_id_without_lock(deleted[i]);
+        }
+    }
+
+
+    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
+        std::ifstream input(location, std::ios::binary);
+
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        clear();
+        // get file size:
+        input.seekg(0, input.end);
+        std::streampos total_filesize = input.tellg();
+        input.seekg(0, input.beg);
+
+        uint32_t version = readIndexHeader(input, s, max_elements_i);
+        size_t max_elements = max_elements_;
+        if (version >= HNSW_INDEX_FORMAT_PAGE_ALIGNED) {
+            loadPageAligned(input, total_filesize);
+            input.close();
+            loadSideFiles(location);
+            return;
+        }
+
+
+        auto pos = input.tellg();
+
+        /// Optional - check if index is ok:
+        size_t upper_size = 0;
+        input.seekg(level0Size(cur_element_count), input.cur);
+        for (size_t i = 0; i < cur_element_count; i++) {
             if (input.tellg() < 0 || input.tellg() >= total_filesize) {
                 throw std::runtime_error("Index seems to be corrupted or unsupported");
             }
@@ -758,6 +1571,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             readBinaryPOD(input, linkListSize);
             if (linkListSize != 0) {
                 input.seekg(linkListSize, input.cur);
+                upper_size += linkListSize;
             }
         }
 
@@ -770,42 +1584,30 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         input.seekg(pos, input.beg);
 
-        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
+        allocateLevel0(max_elements);
         input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
+        if (level0_layout_ == LEVEL0_SPLIT) {
+            input.read(vector_memory_, cur_element_count * vector_stride_);
+            input.read(label_memory_, cur_element_count * label_stride_);
+        }
 
-        size_links_per_element_ = M_ * sizeof(tableint) + sizeof(linklistsizeint);
-
-        //size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
-        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
-
-        visited_list_pool_.reset(new VisitedListPool(1, max_elements));
-
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
-        if (linkLists_ == nullptr)
+        initLoadedIndex(max_elements);
+        // all link lists go to one block
+        char *upper = (char *) malloc(upper_size);
+        if (upper == nullptr && upper_size > 0)
             throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
-        element_levels_ = std::vector<int>(max_elements);
-        //revSize_ = 1.0 / mult_;
-        ef_ = 10;
+        size_t upper_pos = 0;
         for (size_t i = 0; i < cur_element_count; i++) {
             
             //label_lookup_[getExternalLabel(i)] = i;
             label_lookup.add_label_without_lock(getExternalLabel(i), i);
             unsigned int linkListSize;
             readBinaryPOD(input, linkListSize);
-            if (linkListSize == 0) {
-                element_levels_[i] = 0;
-                linkLists_[i] = nullptr;
-            } else {
-                element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char *) malloc(linkListSize);
-                if (linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                input.read(linkLists_[i], linkListSize);
-            }
+            element_levels_[i] = linkListSize / size_links_per_element_;
+            input.read(upper + upper_pos, linkListSize);
+            upper_pos += linkListSize;
         }
+        setUpperLinks(upper, upper_size, true);
 
         for (size_t i = 0; i < cur_element_count; i++) {
             if (isMarkedDeleted(i)) {
@@ -815,11 +1617,95 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         }
 
         input.close();
+        loadSideFiles(location);
 
         return;
     }
 
 
+    void loadPageAligned(std::ifstream &input, size_t total_filesize) {
+        size_t count = cur_element_count;
+        IndexSections sections = indexSections(num_deleted_);
+        if (total_filesize < sections.upper)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        initLoadedIndex(max_elements_);
+        input.seekg(sections.levels, input.beg);
+        input.read((char *) element_levels_.data(), count * sizeof(int));
+        std::vector<tableint> deleted(num_deleted_);
+        input.read((char *) deleted.data(), num_deleted_ * sizeof(tableint));
+        if (!input || sections.upper + upperLinksSize() != total_filesize)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        allocateLevel0(max_elements_);
+        input.seekg(sections.level0, input.beg);
+        input.read(data_level0_memory_, count * size_data_per_element_);
+        if (level0_layout_ == LEVEL0_SPLIT) {
+            input.seekg(sections.vectors, input.beg);
+            input.read(vector_memory_, count * vector_stride_);
+            input.seekg(sections.labels, input.beg);
+            input.read(label_memory_, count * label_stride_);
+        }
+
+        size_t upper_size = upperLinksSize();
+        char *upper = (char *) malloc(upper_size);
+        if (upper == nullptr && upper_size > 0)
+            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+        input.seekg(sections.upper, input.beg);
+        input.read(upper, upper_size);
+        setUpperLinks(upper, upper_size, true);
+        indexLoadedElements(deleted.data());
+    }
+
+
+    /*
+    * Opens an index saved with saveIndex(location, true) without reading it. The file is
+    * mapped read-only and the level-0 arrays and upper-layer links point into the mapping,
+    * so pages are read on first access and processes mapping the same file share them in
+    * the page cache. Only the labels, levels and deleted ids are read at startup, which is
+    * fastest with LEVEL0_SPLIT where the labels are a dense array.
+    * The index cannot be modified: adding, deleting, resizing or reordering throws.
+    * The file must not be rewritten in place while it is mapped: pages past a new, shorter
+    * end fault with SIGBUS. Replace it with saveIndex, which renames a new file over it.
+    */
+    void mapIndex(const std::string &location, SpaceInterface<dist_t> *s) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        clear();
+        uint32_t version = readIndexHeader(input, s, 0);
+        input.close();
+        if (version < HNSW_INDEX_FORMAT_PAGE_ALIGNED)
+            throw std::runtime_error("mapIndex needs an index saved with saveIndex(location, true)");
+
+        size_t count = cur_element_count;
+        max_elements_ = count;
+        IndexSections sections = indexSections(num_deleted_);
+        mapped_file_.reset(new MappedFile(location));
+        char *base = mapped_file_->data();
+        if (mapped_file_->size() < sections.upper)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        initLoadedIndex(count);
+        memcpy(element_levels_.data(), base + sections.levels, count * sizeof(int));
+        if (sections.upper + upperLinksSize() != mapped_file_->size())
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        data_level0_memory_ = base + sections.level0;
+        if (level0_layout_ == LEVEL0_INTERLEAVED) {
+            vector_memory_ = data_level0_memory_ + offsetData_;
+            label_memory_ = data_level0_memory_ + label_offset_;
+        } else {
+            vector_memory_ = base + sections.vectors;
+            label_memory_ = base + sections.labels;
+        }
+        setUpperLinks(base + sections.upper, mapped_file_->size() - sections.upper, false);
+        indexLoadedElements((const tableint *) (base + sections.deleted));
+        loadSideFiles(location);
+    }
+
+
     template<typename data_t>
     std::vector<data_t> getDataByLabel(labeltype label) const {
         // lock all operations with element by label
@@ -831,10 +1717,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             throw std::runtime_error("Label not found in isMarkedDeleted.");
         }
 
-        char* data_ptrv = getDataByInternalId(internalId);
+        std::vector<char> decoded(space_->get_input_size());
+        space_->decode(getDataByInternalId(internalId), decoded.data());
         size_t dim = *((size_t *) dist_func_param_);
         std::vector<data_t> data;
-        data_t* data_ptr = (data_t*) data_ptrv;
+        data_t* data_ptr = (data_t*) decoded.data();
         for (size_t i = 0; i < dim; i++) {
             data.push_back(*data_ptr);
             data_ptr += 1;
@@ -843,6 +1730,141 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+    * Filter allowing the elements with the given labels, labels not in the index or marked
+    * deleted are skipped. Searches of this index test it by internal id without any call
+    * per element. Replacing a deleted element or reorderIndex makes it out of date, and
+    * searches with it then throw: create it again.
+    */
+    IdFilter createIdFilter(const labeltype *labels, size_t count) const {
+        IdFilter filter(cur_element_count);
+        filter.setGeneration(id_generation_);
+        tableint id;
+        for (size_t i = 0; i < count; i++) {
+            if (label_lookup.try_get_id(labels[i], id) && !isMarkedDeleted(id))
+                filter.allow(id);
+        }
+        return filter;
+    }
+
+
+    // throws if id_filter was created before internal ids were given to other elements
+    void checkIdFilter(const IdFilter *id_filter) const {
+        if (id_filter && id_filter->generation() != 0 && id_filter->generation() != id_generation_)
+            throw std::runtime_error("The IdFilter is out of date: elements were replaced or reordered since it was created");
+    }
+
+
+    // the IdFilter isIdAllowed is, if any, after checking it and the one inside a namespace filter
+    const IdFilter *checkedIdFilter(BaseFilterFunctor* isIdAllowed) const {
+        if (!isIdAllowed)
+            return nullptr;
+        const NamespaceFilter *namespace_filter = isIdAllowed->asNamespaceFilter();
+        if (namespace_filter)
+            checkIdFilter(namespace_filter->innerIdFilter());
+        const IdFilter *id_filter = isIdAllowed->asIdFilter();
+        checkIdFilter(id_filter);
+        return id_filter;
+    }
+
+
+    /*
+    * Keeps num_fields small integer attributes per element, set with setAttributes or the
+    * addPoint taking attributes, and queried with createAttributeFilter. They are saved and
+    * loaded with the index.
+    */
+    void enableAttributes(size_t num_fields) {
+        if (attributes_) {
+            if (attributes_->numFields() != num_fields)
+                throw std::runtime_error("The attributes are already enabled with another number of fields");
+            return;
+        }
+        attributes_.reset(new AttributeStore(num_fields, max_elements_));
+    }
+
+
+    // sets the attributes of the element with the given label, one value per field
+    void setAttributes(labeltype label, const attributetype *values) {
+        if (!attributes_)
+            throw std::runtime_error("The attributes are not enabled, call enableAttributes first");
+        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+        tableint internalId = label_lookup.find_label_get_id(label);
+        attributes_->set(internalId, values, isMarkedDeleted(internalId));
+    }
+
+
+    // the attributes of the element with the given label, empty if it has none
+    std::vector<attributetype> getAttributes(labeltype label) const {
+        if (!attributes_)
+            throw std::runtime_error("The attributes are not enabled, call enableAttributes first");
+        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+        tableint internalId = label_lookup.find_label_get_id(label);
+        std::vector<attributetype> values(attributes_->numFields());
+        if (!attributes_->get(internalId, values.data()))
+            values.clear();
+        return values;
+    }
+
+
+    /*
+    * Filter allowing the elements whose attributes meet every condition, e.g. the
+    * conditions {{0, {3, 7}}, {1, {2}}} for "field 0 in {3, 7} and field 1 == 2". It is
+    * built from the posting bitmaps, and reflects the index at the time of the call. Like
+    * createIdFilter's, it is out of date once a deleted element is replaced or the index
+    * is reordered.
+    */
+    IdFilter createAttributeFilter(const std::vector<AttributeCondition> &conditions) const {
+        if (!attributes_)
+            throw std::runtime_error("The attributes are not enabled, call enableAttributes first");
+        uint64_t generation = id_generation_;
+        IdFilter filter = attributes_->evaluate(conditions);
+        filter.setGeneration(generation);
+        return filter;
+    }
+
+
+    /*
+    * Keeps a namespace per element, set with setNamespace or addPointToNamespace, so that
+    * many tenants can share the index and search only their elements through
+    * createNamespaceFilter. They are saved and loaded with the index.
+    */
+    void enableNamespaces() {
+        if (!namespaces_)
+            namespaces_.reset(new NamespaceStore(max_elements_));
+    }
+
+
+    // moves the element with the given label to namespace ns, or out of any with NO_NAMESPACE
+    void setNamespace(labeltype label, namespacetype ns) {
+        if (!namespaces_)
+            throw std::runtime_error("The namespaces are not enabled, call enableNamespaces first");
+        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+        tableint internalId = label_lookup.find_label_get_id(label);
+        namespaces_->set(internalId, ns, element_levels_);
+    }
+
+
+    namespacetype getNamespace(labeltype label) const {
+        if (!namespaces_)
+            throw std::runtime_error("The namespaces are not enabled, call enableNamespaces first");
+        std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
+        return namespaces_->get(label_lookup.find_label_get_id(label));
+    }
+
+
+    /*
+    * Filter allowing the elements of namespace ns that isIdAllowed, if any, allows too.
+    * Searches with it scan the elements of a small namespace and walk the graph from the
+    * entry point of the namespace otherwise, see useFilteredScan. It follows the elements
+    * added to or moved out of ns, and is valid until the index is cleared or loaded again.
+    */
+    NamespaceFilter createNamespaceFilter(namespacetype ns, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        if (!namespaces_)
+            throw std::runtime_error("The namespaces are not enabled, call enableNamespaces first");
+        return NamespaceFilter(namespaces_.get(), ns, isIdAllowed);
+    }
+
+
     /*
     * Marks an element with the given label deleted, does NOT really change the current graph.
     */
@@ -861,6 +1883,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     * whereas maxM0_ has to be limited to the lower 16 bits, however, still large enough in almost all cases.
     */
     void markDeletedInternal(tableint internalId) {
+        throwIfMapped();
         assert(internalId < cur_element_count);
         if (!isMarkedDeleted(internalId)) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
@@ -869,6 +1892,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             if (allow_replace_deleted_) {
                 deleted_elements.add_deleted_id(internalId);
             }
+            if (attributes_)
+                attributes_->remove(internalId);
         } else {
             throw std::runtime_error("The requested to delete element is already deleted");
         }
@@ -896,6 +1921,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     * Remove the deleted mark of the node.
     */
     void unmarkDeletedInternal(tableint internalId) {
+        throwIfMapped();
         assert(internalId < cur_element_count);
         if (isMarkedDeleted(internalId)) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
@@ -904,6 +1930,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             if (allow_replace_deleted_) {
                 deleted_elements.remove_deleted_id(internalId);
             }
+            if (attributes_)
+                attributes_->restore(internalId);
         } else {
             throw std::runtime_error("The requested to undelete element is not deleted");
         }
@@ -919,6 +1947,23 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    // an element may be returned by a search: not deleted and passing the filter, if any
+    inline bool isAllowed(tableint internalId, BaseFilterFunctor* isIdAllowed, const IdFilter *id_filter,
+                          const NamespaceFilter *namespace_filter = nullptr) const {
+        if (isMarkedDeleted(internalId))
+            return false;
+        if (namespace_filter) {
+            if (!namespace_filter->isAllowed(internalId))
+                return false;
+            isIdAllowed = namespace_filter->inner();
+            id_filter = namespace_filter->innerIdFilter();
+        }
+        if (id_filter)
+            return id_filter->isAllowed(internalId);
+        return !isIdAllowed || (*isIdAllowed)(getExternalLabel(internalId));
+    }
+
+
     unsigned short int getListCount(linklistsizeint * ptr) const {
         return *((unsigned short int *)ptr);
     }
@@ -934,6 +1979,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     * If replacement of deleted elements is enabled: replaces previously deleted point if any, updating it with new point
     */
     void addPoint(const void *data_point, labeltype label, bool replace_deleted = false) {
+        throwIfMapped();
         if ((allow_replace_deleted_ == false) && (replace_deleted == true)) {
             throw std::runtime_error("Replacement of deleted elements is disabled in constructor");
         }
@@ -952,9 +1998,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         {  // replace the selected deleted point with the data_point.
             // we assume that there are no concurrent operations on deleted element
             labeltype label_replaced = getExternalLabel(internal_id_replaced);
+            id_generation_++;
             setExternalLabel(internal_id_replaced, label);
 
             label_lookup.replace_label(label_replaced, label, internal_id_replaced);
+            if (attributes_)
+                attributes_->erase(internal_id_replaced);
+            if (namespaces_)
+                namespaces_->set(internal_id_replaced, NO_NAMESPACE, element_levels_);
 
             unmarkDeletedInternal(internal_id_replaced);
             updatePoint(data_point, internal_id_replaced, 1.0);
@@ -962,9 +2013,187 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    // addPoint that also sets the attributes of the element, one value per field
+    void addPoint(const void *data_point, labeltype label, const attributetype *attributes, bool replace_deleted = false) {
+        if (!attributes_)
+            throw std::runtime_error("The attributes are not enabled, call enableAttributes first");
+        addPoint(data_point, label, replace_deleted);
+        setAttributes(label, attributes);
+    }
+
+
+    // addPoint that also moves the element to namespace ns
+    void addPointToNamespace(const void *data_point, labeltype label, namespacetype ns, bool replace_deleted = false) {
+        if (!namespaces_)
+            throw std::runtime_error("The namespaces are not enabled, call enableNamespaces first");
+        addPoint(data_point, label, replace_deleted);
+        setNamespace(label, ns);
+    }
+
+
+    /*
+    * Adds the n vectors stored back to back at data with the given labels, on num_threads
+    * threads, 0 meaning one per core. Labels already in the index update their element,
+    * as in addPoint. The first elements are inserted one by one until the index has
+    * BUILD_SERIAL_ELEMENTS, since concurrent inserts into a tiny graph make a poorly
+    * connected one, then the rest:
+    * - BUILD_FAST: concurrently, threads running out of elements taking over part of the
+    *   share of slower ones, see WorkStealingRange;
+    * - BUILD_DETERMINISTIC: in rounds of BUILD_ROUND_ELEMENTS, see addRound. The graph only
+    *   depends on the index, its seed and the input, not on the threads.
+    * The levels are drawn in input order in both modes. No other insert may run meanwhile.
+    */
+    void addPoints(const void *data, const labeltype *labels, size_t n, size_t num_threads,
+                   BuildMode mode = BUILD_FAST) {
+        throwIfMapped();
+        const char *input = (const char *) data;
+        size_t input_size = space_->get_input_size();
+        size_t count = cur_element_count;
+        size_t serial = count < (size_t) BUILD_SERIAL_ELEMENTS ? std::min(n, (size_t) BUILD_SERIAL_ELEMENTS - count) : 0;
+        for (size_t i = 0; i < serial; i++)
+            addPoint(input + i * input_size, labels[i]);
+
+        if (mode == BUILD_DETERMINISTIC) {
+            for (size_t start = serial; start < n; start += BUILD_ROUND_ELEMENTS) {
+                size_t size = std::min((size_t) BUILD_ROUND_ELEMENTS, n - start);
+                addRound(input + start * input_size, labels + start, size, num_threads);
+            }
+            return;
+        }
+
+        // the level generator is not thread-safe
+        std::vector<int> levels(n);
+        for (size_t i = serial; i < n; i++)
+            levels[i] = getRandomLevel();
+        parallelFor(serial, n, num_threads, [&](size_t i, size_t) {
+            std::unique_lock <std::mutex> lock_label(getLabelOpMutex(labels[i]));
+            addPoint_(input + i * input_size, labels[i], levels[i]);
+        });
+    }
+
+
+    // an element of a round of addRound
+    struct RoundElement {
+        const void *data_point{nullptr};
+        labeltype label{0};
+        tableint id{0};
+        int level{-1};  // -1 for an update, the label is in the index or earlier in the round
+        std::vector<Candidate> candidates;  // by level
+    };
+
+
+    /*
+    * Inserts n elements in three steps, so that the graph does not depend on the threads:
+    * - serially, in input order, draws the levels and assigns the ids;
+    * - on the threads, searches the candidate neighbors of each element in the graph as
+    *   it was before the round, as addPoint_ would, and adds the elements of the round
+    *   before it, by their distance. The graph is read only;
+    * - serially, in input order, links each element to its candidates as addPoint_ does.
+    * The searches, most of the cost of an insert, run in parallel, but an element only
+    * finds the elements of its round directly, not through the graph, which makes rounds
+    * small against the index.
+    */
+    void addRound(const char *data, const labeltype *labels, size_t n, size_t num_threads) {
+        size_t input_size = space_->get_input_size();
+        std::vector<RoundElement> round(n);
+        std::unordered_set<labeltype> round_labels;
+        size_t next_id = cur_element_count;
+        for (size_t i = 0; i < n; i++) {
+            RoundElement &element = round[i];
+            element.data_point = data + i * input_size;
+            element.label = labels[i];
+            if (label_lookup.find_label(labels[i]) || !round_labels.insert(labels[i]).second)
+                continue;
+            if (next_id >= max_elements_)
+                throw std::runtime_error("The number of elements exceeds the specified limit");
+            element.id = (tableint) next_id++;
+            element.level = getRandomLevel();
+        }
+
+        std::vector<char> encoded(n * data_size_);
+        parallelFor(0, n, num_threads, [&](size_t i, size_t) {
+            if (round[i].level >= 0)
+                space_->encode(round[i].data_point, encoded.data() + i * data_size_);
+        });
+
+        tableint entry_point = enterpoint_node_;
+        int maxlevel = maxlevel_;
+        bool entry_point_deleted = isMarkedDeleted(entry_point);
+        parallelFor(0, n, num_threads, [&](size_t i, size_t) {
+            RoundElement &element = round[i];
+            if (element.level < 0)
+                return;
+            const void *data_point = encoded.data() + i * data_size_;
+            element.candidates.resize(element.level + 1);
+
+            tableint currObj = entry_point;
+            if (element.level < maxlevel)
+                currObj = descendToLevel(data_point, currObj, maxlevel, element.level);
+            for (int level = std::min(element.level, maxlevel); level >= 0; level--) {
+                Candidate &top_candidates = element.candidates[level];
+                top_candidates = searchBaseLayer(currObj, data_point, level);
+                if (entry_point_deleted) {
+                    top_candidates.emplace(fstdistfunc_(data_point, getDataByInternalId(entry_point), dist_func_param_), entry_point);
+                    if (top_candidates.size() > ef_construction_)
+                        top_candidates.pop();
+                }
+                // the next level starts from the closest candidate
+                Candidate closest = top_candidates;
+                while (closest.size() > 1)
+                    closest.pop();
+                currObj = closest.top().second;
+            }
+
+            for (size_t j = 0; j < i; j++) {
+                if (round[j].level < 0)
+                    continue;
+                dist_t dist = fstdistfunc_(data_point, encoded.data() + j * data_size_, dist_func_param_);
+                for (int level = std::min(element.level, round[j].level); level >= 0; level--) {
+                    Candidate &top_candidates = element.candidates[level];
+                    if (top_candidates.size() < ef_construction_ || dist < top_candidates.top().first) {
+                        top_candidates.emplace(dist, round[j].id);
+                        if (top_candidates.size() > ef_construction_)
+                            top_candidates.pop();
+                    }
+                }
+            }
+        });
+
+        for (size_t i = 0; i < n; i++) {
+            RoundElement &element = round[i];
+            if (element.level < 0) {
+                addPoint(element.data_point, element.label);
+                continue;
+            }
+            std::unique_lock <std::mutex> lock_label(getLabelOpMutex(element.label));
+            tableint cur_c = cur_element_count++;
+            if (cur_c != element.id)
+                throw std::runtime_error("Elements were inserted during addPoints");
+            label_lookup.add_label(element.label, cur_c);
+
+            std::unique_lock <SpinLock> lock_el(link_list_locks_[cur_c]);
+            element_levels_[cur_c] = element.level;
+            const void *data_point = initElement(cur_c, element.data_point, element.label, element.level);
+            for (int level = std::min(element.level, maxlevel_); level >= 0; level--) {
+                if (!element.candidates[level].empty())
+                    mutuallyConnectNewElement(data_point, cur_c, element.candidates[level], level, false);
+            }
+            if (element.level > maxlevel_) {
+                enterpoint_node_ = cur_c;
+                maxlevel_ = element.level;
+            }
+            element.candidates.clear();
+        }
+    }
+
+
     void updatePoint(const void *dataPoint, tableint internalId, float updateNeighborProbability) {
         // update the feature vector associated with existing point with new vector
-        memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
+        if (rerank_store_)
+            rerank_store_->set(internalId, dataPoint);
+        space_->encode(dataPoint, getDataByInternalId(internalId));
+        // the rest of the update works on the stored representation
+        dataPoint = getDataByInternalId(internalId);
 
         // If point to be updated is entry point and graph just contains single element then just return.
         if (enterpoint_node_ == internalId && cur_element_count == 1)
@@ -1027,7 +2256,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 getNeighborsByHeuristic2(candidates, layer == 0 ? maxM0_ : M_);
 
                 {
-                    std::unique_lock <std::mutex> lock(link_list_locks_[neigh]);
+                    std::unique_lock <SpinLock> lock(link_list_locks_[neigh]);
                     linklistsizeint *ll_cur;
                     ll_cur = get_linklist_at_level(neigh, layer);
                     size_t candSize = candidates.size();
@@ -1059,7 +2288,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 while (changed) {
                     changed = false;
                     unsigned int *data;
-                    std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
+                    std::unique_lock <SpinLock> lock(link_list_locks_[currObj]);
                     data = get_linklist_at_level(currObj, level);
                     int size = getListCount(data);
                     tableint *datal = (tableint *) (data + 1);
@@ -1114,7 +2343,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     std::vector<tableint> getConnectionsWithLock(tableint internalId, int level) {
-        std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
+        std::unique_lock <SpinLock> lock(link_list_locks_[internalId]);
         unsigned int *data = get_linklist_at_level(internalId, level);
         int size = getListCount(data);
         std::vector<tableint> result(size);
@@ -1162,66 +2391,29 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             label_lookup.add_label(label, cur_c);
         }
 
-        std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
-        int curlevel = getRandomLevel();  // Alg1.4  assign new element's level
-        
-        if (assigned_level > 0)  // -1 is common case -> not using assigned_level
-            curlevel = assigned_level;
-
+        std::unique_lock <SpinLock> lock_el(link_list_locks_[cur_c]);
+        // Alg1.4  assign new element's level, -1 is common case -> not using assigned_level
+        int curlevel = assigned_level >= 0 ? assigned_level : getRandomLevel();
         element_levels_[cur_c] = curlevel;
 
-        //std::unique_lock <std::mutex> templock(global);
+        // an element above the top level becomes the entry point, concurrent inserts of
+        // such elements wait for it
+        std::unique_lock <std::mutex> lock_entry_point(entry_point_lock_);
         int cur_maxlevel = maxlevel_;
-        // if (curlevel <= cur_maxlevel) {            
-        //  ;//   templock.unlock();
-        // } else {
-        //  ;//   templock.unlock();; // templock needs to pass MultithreadLoadTest
-        // }
-        
+        if (curlevel <= cur_maxlevel)
+            lock_entry_point.unlock();
+
         tableint currObj = enterpoint_node_;
         tableint enterpoint_copy = enterpoint_node_;
 
-        memset(data_level0_memory_ + cur_c * size_data_per_element_, 0, size_data_per_element_);
-
-        // Initialisation of the data and label
-        memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
-        memcpy(getDataByInternalId(cur_c), data_point, data_size_);
-
-        if (curlevel) {
-            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
-            if (linkLists_[cur_c] == nullptr)
-                throw std::runtime_error("Not enough memory: addPoint_ failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
-        }
+        // insertion compares the stored copy with other stored vectors
+        data_point = initElement(cur_c, data_point, label, curlevel);
 
         if ((signed)currObj != -1) {
             if (curlevel < cur_maxlevel) {
                 // Alg1.6. Search-Layer (1st): Get the nearest element from the top level to Ml+1 layer
                 //                             It is the starting point of SEARCH_LAYER with efConstruction
-                dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
-                for (int level = cur_maxlevel; level > curlevel; level--) {
-                    bool changed = true;
-                    while (changed) {
-                        changed = false;
-                        unsigned int *data;
-                        std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
-                        data = get_linklist(currObj, level);
-                        int size = getListCount(data);
-
-                        tableint *datal = (tableint *) (data + 1);
-                        for (int i = 0; i < size; i++) {
-                            tableint cand = datal[i];
-                            if (cand < 0 || cand > max_elements_)
-                                throw std::runtime_error("cand error");
-                            dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
-                            if (d < curdist) {
-                                curdist = d;
-                                currObj = cand;
-                                changed = true;
-                            }
-                        }
-                    }
-                }
+                currObj = descendToLevel(data_point, currObj, cur_maxlevel, curlevel);
             }
 
             bool epDeleted = isMarkedDeleted(enterpoint_copy);
@@ -1252,15 +2444,71 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    std::priority_queue<std::pair<dist_t, labeltype >>
-    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        std::priority_queue<std::pair<dist_t, labeltype >> result;
-        if (cur_element_count == 0) return result;
+    // the level-0 record and the upper links of a new element, returns its stored vector
+    const void *initElement(tableint cur_c, const void *data_point, labeltype label, int level) {
+        memset(get_linklist0(cur_c), 0, size_data_per_element_);
 
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        // Initialisation of the data and label
+        memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
+        if (rerank_store_)
+            rerank_store_->set(cur_c, data_point);
+        space_->encode(data_point, getDataByInternalId(cur_c));
+
+        if (level) {
+            link_arena_.allocate(cur_c, size_links_per_element_ * level);
+        }
+        return getDataByInternalId(cur_c);
+    }
+
+
+    // greedy descent of an insert from currObj on from_level to the closest element on to_level + 1
+    tableint descendToLevel(const void *data_point, tableint currObj, int from_level, int to_level) {
+        dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
+        for (int level = from_level; level > to_level; level--) {
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                unsigned int *data;
+                std::unique_lock <SpinLock> lock(link_list_locks_[currObj]);
+                data = get_linklist(currObj, level);
+                int size = getListCount(data);
+
+                tableint *datal = (tableint *) (data + 1);
+                for (int i = 0; i < size; i++) {
+                    tableint cand = datal[i];
+                    if (cand < 0 || cand > max_elements_)
+                        throw std::runtime_error("cand error");
+                    dist_t d = boundedDistance(bounded_distfunc_, fstdistfunc_, data_point, getDataByInternalId(cand), curdist);
+                    if (d < curdist) {
+                        curdist = d;
+                        currObj = cand;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        return currObj;
+    }
+
+
+    // greedy descent from the entry point to the closest element on level 1
+    template <bool collect_metrics = false>
+    tableint searchUpperLayers(const void *query, SearchStats* stats = nullptr) const {
+        return searchUpperLayers<collect_metrics>(query, enterpoint_node_, maxlevel_, stats);
+    }
+
+
+    // greedy descent from entry_point, an element on entry_level
+    template <bool collect_metrics = false>
+    tableint searchUpperLayers(const void *query, tableint entry_point, int entry_level, SearchStats* stats = nullptr) const {
+        tableint currObj = entry_point;
+        dist_t curdist = query_distfunc_(query, getDataByInternalId(entry_point), dist_func_param_);
+        if (collect_metrics) {
+            stats->distance_computations++;
+            stats->levels_descended += entry_level;
+        }
 
-        for (int level = maxlevel_; level > 0; level--) {
+        for (int level = entry_level; level > 0; level--) {
             bool changed = true;
             while (changed) {
                 changed = false;
@@ -1268,15 +2516,17 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                 data = (unsigned int *) get_linklist(currObj, level);
                 int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
+                if (collect_metrics) {
+                    stats->hops++;
+                    stats->distance_computations += size;
+                }
 
                 tableint *datal = (tableint *) (data + 1);
                 for (int i = 0; i < size; i++) {
                     tableint cand = datal[i];
                     if (cand < 0 || cand > max_elements_)
                         throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+                    dist_t d = boundedDistance(query_bounded_distfunc_, query_distfunc_, query, getDataByInternalId(cand), curdist);
 
                     if (d < curdist) {
                         curdist = d;
@@ -1286,16 +2536,82 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
             }
         }
+        return currObj;
+    }
 
-        Candidate top_candidates;
+
+    /*
+    * The ef closest elements allowed by isIdAllowed, on the heaps of the caller: a scan of
+    * the allowed elements when they are few, see useFilteredScan, the graph search
+    * otherwise. The graph search of a NamespaceFilter starts from the entry point of its
+    * namespace, a small one is scanned in place under the shared lock of the store.
+    */
+    template <bool collect_metrics, typename heap_t>
+    void searchCandidates(const void *query, size_t ef, BaseFilterFunctor* isIdAllowed, heap_t &top_candidates,
+                          heap_t &candidate_set, NeighborBatch &batch, SearchStats* stats) const {
+        const IdFilter *id_filter = checkedIdFilter(isIdAllowed);
+        const NamespaceFilter *namespace_filter = isIdAllowed ? isIdAllowed->asNamespaceFilter() : nullptr;
+        tableint entry_point = enterpoint_node_;
+        int entry_level = maxlevel_;
+        if (namespace_filter) {
+            const NamespaceStore &store = namespace_filter->store();
+            size_t count = store.lookup(namespace_filter->getNamespace(), entry_point, entry_level);
+            if (count == 0)
+                return;
+            if (useScan(count, ef)) {
+                store.withMembers(namespace_filter->getNamespace(), [&](const std::vector<tableint> &members) {
+                    searchFilteredScan<collect_metrics>(
+                            query, ef, IdList(members), namespace_filter->inner(), top_candidates, batch, stats);
+                });
+                return;
+            }
+        } else if (useFilteredScan(id_filter, ef)) {
+            searchFilteredScan<collect_metrics>(query, ef, *id_filter, nullptr, top_candidates, batch, stats);
+            return;
+        }
+
+        tableint currObj = searchUpperLayers<collect_metrics>(query, entry_point, entry_level, stats);
         bool bare_bone_search = !num_deleted_ && !isIdAllowed;
         if (bare_bone_search) {
-            top_candidates = searchBaseLayerST<true>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+            searchBaseLayerST<true, collect_metrics>(
+                    currObj, query, ef, isIdAllowed, nullptr, top_candidates, candidate_set, batch, stats);
         } else {
-            top_candidates = searchBaseLayerST<false>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+            searchBaseLayerST<false, collect_metrics>(
+                    currObj, query, ef, isIdAllowed, nullptr, top_candidates, candidate_set, batch, stats);
         }
+    }
+
+
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        return searchKnn_<false>(query_data, k, isIdAllowed, nullptr);
+    }
+
+
+    // searchKnn that also reports what the search did, stats is overwritten
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnnWithStats(const void *query_data, size_t k, SearchStats &stats, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        stats = SearchStats();
+        return searchKnn_<true>(query_data, k, isIdAllowed, &stats);
+    }
+
+
+    template <bool collect_metrics>
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn_(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed, SearchStats* stats) const {
+        std::priority_queue<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) return result;
+
+        std::vector<char> query_state;
+        const void *query = space_->prepare_query_state(query_data, query_state);
+
+        Candidate top_candidates;
+        Candidate candidate_set;
+        NeighborBatch batch(maxM0_);
+        searchCandidates<collect_metrics>(
+                query, std::max(ef_, k), isIdAllowed, top_candidates, candidate_set, batch, stats);
+        if (rerank_store_)
+            rerankCandidates(query_data, top_candidates);
 
         while (top_candidates.size() > k) {
             top_candidates.pop();
@@ -1309,51 +2625,299 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    std::vector<std::pair<dist_t, labeltype >>
-    searchStopConditionClosest(
-        const void *query_data,
-        BaseSearchStopCondition<dist_t>& stop_condition,
-        BaseFilterFunctor* isIdAllowed = nullptr) const {
-        std::vector<std::pair<dist_t, labeltype >> result;
-        if (cur_element_count == 0) return result;
+    /*
+    * Storage of searchKnn with a result buffer, reused across searches. Keep one per thread:
+    * once it has served a search with the largest ef and k it will see, searches make no
+    * heap allocations.
+    */
+    struct SearchContext {
+        std::vector<char> query_state;
+        std::vector<std::pair<dist_t, tableint>> top_candidates;
+        std::vector<std::pair<dist_t, tableint>> candidate_set;
+        NeighborBatch batch{0};
+        SearchStats stats;  // of the last search, when run with collect_metrics
+    };
 
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
 
-        for (int level = maxlevel_; level > 0; level--) {
-            bool changed = true;
-            while (changed) {
-                changed = false;
-                unsigned int *data;
+    /*
+    * searchKnn on the storage of context, writes up to k results to result, closest first,
+    * and returns their number. searchKnn<true> also fills context.stats.
+    */
+    template <bool collect_metrics = false>
+    size_t searchKnn(const void *query_data, size_t k, SearchContext &context,
+                     std::pair<dist_t, labeltype> *result, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        SearchStats *stats = collect_metrics ? &context.stats : nullptr;
+        if (collect_metrics)
+            context.stats = SearchStats();
+        if (cur_element_count == 0) return 0;
+
+        const void *query = space_->prepare_query_state(query_data, context.query_state);
+
+        size_t ef = std::max(ef_, k);
+        context.top_candidates.clear();
+        context.candidate_set.clear();
+        context.top_candidates.reserve(ef + 1);
+        context.batch.reserve(maxM0_);
+        VectorHeap top_candidates(context.top_candidates);
+        VectorHeap candidate_set(context.candidate_set);
+        searchCandidates<collect_metrics>(
+                query, ef, isIdAllowed, top_candidates, candidate_set, context.batch, stats);
+        if (rerank_store_)
+            rerankCandidates(query_data, context.top_candidates);
 
-                data = (unsigned int *) get_linklist(currObj, level);
-                int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
+        while (top_candidates.size() > k) {
+            top_candidates.pop();
+        }
+        size_t count = top_candidates.size();
+        for (size_t i = count; i > 0; i--) {
+            result[i - 1] = std::pair<dist_t, labeltype>(top_candidates.top().first, getExternalLabel(top_candidates.top().second));
+            top_candidates.pop();
+        }
+        return count;
+    }
 
-                tableint *datal = (tableint *) (data + 1);
-                for (int i = 0; i < size; i++) {
-                    tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
-                        throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
 
-                    if (d < curdist) {
-                        curdist = d;
-                        currObj = cand;
-                        changed = true;
+    enum InterleavedStage {
+        INTERLEAVED_LINKS,
+        INTERLEAVED_VISIT,
+        INTERLEAVED_DISTANCES
+    };
+
+    // a query of searchKnnBatch, advanced a stage of a hop at a time
+    struct InterleavedQuery {
+        SearchContext context;
+        const void *query_data{nullptr};
+        const void *query{nullptr};  // the prepared query state
+        tableint ep_id{0};
+        tableint current_node_id{0};  // the candidate being expanded
+        InterleavedStage stage{INTERLEAVED_DISTANCES};
+        VisitedList *vl{nullptr};
+        dist_t lowerBound{0};
+        bool done{true};
+    };
+
+
+    /*
+    * searchKnn for nq queries stored back to back, with the results of query i written to
+    * result + i * k, closest first, and their number to counts[i]. The queries are
+    * searched in groups of BATCH_INTERLEAVED_QUERIES whose base-layer searches advance in
+    * turn, a stage of a hop per turn. A turn ends by prefetching what the query's next turn
+    * reads, and the other queries' turns give the prefetch time to complete, where a single
+    * search would wait for memory. The results are those of searchKnn.
+    */
+    void searchKnnBatch(const void *queries, size_t nq, size_t k, std::pair<dist_t, labeltype> *result,
+                        size_t *counts, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        if (cur_element_count == 0) {
+            std::fill(counts, counts + nq, (size_t) 0);
+            return;
+        }
+        size_t query_size = space_->get_input_size();
+        const IdFilter *id_filter = checkedIdFilter(isIdAllowed);
+        bool namespace_search = isIdAllowed && isIdAllowed->asNamespaceFilter();
+        if (namespace_search || useFilteredScan(id_filter, std::max(ef_, k))) {
+            // the scans read the vectors in order, there is no latency to hide, and the
+            // interleaved searches start from the entry point of the index
+            SearchContext context;
+            for (size_t i = 0; i < nq; i++) {
+                counts[i] = searchKnn((const char *) queries + i * query_size, k, context, result + i * k, isIdAllowed);
+            }
+            return;
+        }
+        std::vector<InterleavedQuery> group(std::min(nq, (size_t) BATCH_INTERLEAVED_QUERIES));
+        bool bare_bone_search = !num_deleted_ && !isIdAllowed;
+        for (size_t start = 0; start < nq; start += group.size()) {
+            size_t count = std::min(group.size(), nq - start);
+            for (size_t i = 0; i < count; i++) {
+                group[i].query_data = (const char *) queries + (start + i) * query_size;
+            }
+            if (bare_bone_search) {
+                searchInterleaved<true>(group.data(), count, k, result + start * k, counts + start, isIdAllowed);
+            } else {
+                searchInterleaved<false>(group.data(), count, k, result + start * k, counts + start, isIdAllowed);
+            }
+        }
+    }
+
+
+    template <bool bare_bone_search>
+    void searchInterleaved(InterleavedQuery *group, size_t count, size_t k, std::pair<dist_t, labeltype> *result,
+                           size_t *counts, BaseFilterFunctor* isIdAllowed) const {
+        size_t ef = std::max(ef_, k);
+        const IdFilter *id_filter = checkedIdFilter(isIdAllowed);
+        for (size_t i = 0; i < count; i++) {
+            InterleavedQuery &q = group[i];
+            q.query = space_->prepare_query_state(q.query_data, q.context.query_state);
+            q.ep_id = searchUpperLayers(q.query);
+        }
+
+        // the base-layer searches start as in searchBaseLayerST
+        for (size_t i = 0; i < count; i++) {
+            InterleavedQuery &q = group[i];
+            q.context.top_candidates.clear();
+            q.context.candidate_set.clear();
+            q.context.top_candidates.reserve(ef + 1);
+            q.context.batch.reserve(maxM0_);
+            q.context.batch.size = 0;
+            q.vl = getFreeVisitedList(ef);
+            q.done = false;
+            VectorHeap top_candidates(q.context.top_candidates);
+            VectorHeap candidate_set(q.context.candidate_set);
+            if (bare_bone_search || isAllowed(q.ep_id, isIdAllowed, id_filter)) {
+                dist_t dist = query_distfunc_(q.query, getDataByInternalId(q.ep_id), dist_func_param_);
+                q.lowerBound = dist;
+                top_candidates.emplace(dist, q.ep_id);
+                candidate_set.emplace(-dist, q.ep_id);
+            } else {
+                q.lowerBound = std::numeric_limits<dist_t>::max();
+                candidate_set.emplace(-q.lowerBound, q.ep_id);
+            }
+            q.vl->visit(q.ep_id);
+            // the first turn picks the entry point as the candidate to expand
+            q.stage = INTERLEAVED_DISTANCES;
+        }
+
+        size_t active = count;
+        while (active > 0) {
+            for (size_t i = 0; i < count; i++) {
+                InterleavedQuery &q = group[i];
+                if (q.done)
+                    continue;
+                advanceInterleaved<bare_bone_search>(q, ef, isIdAllowed, id_filter);
+                if (q.done)
+                    active--;
+            }
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            InterleavedQuery &q = group[i];
+            releaseVisitedList(q.vl);
+            q.vl = nullptr;
+            if (rerank_store_)
+                rerankCandidates(q.query_data, q.context.top_candidates);
+            VectorHeap top_candidates(q.context.top_candidates);
+            while (top_candidates.size() > k) {
+                top_candidates.pop();
+            }
+            counts[i] = top_candidates.size();
+            for (size_t j = counts[i]; j > 0; j--) {
+                result[i * k + j - 1] = std::pair<dist_t, labeltype>(top_candidates.top().first, getExternalLabel(top_candidates.top().second));
+                top_candidates.pop();
+            }
+        }
+    }
+
+
+    /*
+    * One turn of q in searchInterleaved. A hop is split over three turns, each ending with
+    * the prefetch of what the next one reads:
+    * - INTERLEAVED_LINKS: reads the link list of the candidate, prefetches the visited tags
+    *   of its neighbors;
+    * - INTERLEAVED_VISIT: keeps the unvisited neighbors, prefetches their vectors;
+    * - INTERLEAVED_DISTANCES: computes their distances, updates the candidates, then picks
+    *   the next candidate, or ends the search, and prefetches its link list.
+    */
+    template <bool bare_bone_search>
+    inline void advanceInterleaved(InterleavedQuery &q, size_t ef, BaseFilterFunctor* isIdAllowed,
+                                   const IdFilter *id_filter) const {
+        NeighborBatch &batch = q.context.batch;
+        VectorHeap top_candidates(q.context.top_candidates);
+        VectorHeap candidate_set(q.context.candidate_set);
+        switch (q.stage) {
+        case INTERLEAVED_LINKS: {
+            int *data = (int *) get_linklist0(q.current_node_id);
+            size_t size = getListCount((linklistsizeint*)data);
+            for (size_t j = 0; j < size; j++) {
+                tableint candidate_id = *(data + j + 1);
+                q.vl->prefetch(candidate_id);
+                batch.ids[j] = candidate_id;
+            }
+            batch.size = size;
+            q.stage = INTERLEAVED_VISIT;
+            return;
+        }
+        case INTERLEAVED_VISIT: {
+            size_t size = batch.size;
+            batch.size = 0;
+            for (size_t j = 0; j < size; j++) {
+                tableint candidate_id = batch.ids[j];
+                if (q.vl->visit(candidate_id)) {
+                    char *vector = getDataByInternalId(candidate_id);
+#ifdef USE_SSE
+                    for (size_t offset = 0; offset < data_size_; offset += 64)
+                        _mm_prefetch(vector + offset, _MM_HINT_T0);
+#endif
+                    batch.add(candidate_id, vector);
+                }
+            }
+            q.stage = INTERLEAVED_DISTANCES;
+            return;
+        }
+        case INTERLEAVED_DISTANCES:
+            computeBatchDistances(query_batch_distfunc_, query_distfunc_, q.query, batch);
+            for (size_t j = 0; j < batch.size; j++) {
+                tableint candidate_id = batch.ids[j];
+                dist_t dist = batch.dists[j];
+                if (top_candidates.size() < ef || q.lowerBound > dist) {
+                    candidate_set.emplace(-dist, candidate_id);
+                    if (bare_bone_search || isAllowed(candidate_id, isIdAllowed, id_filter)) {
+                        top_candidates.emplace(dist, candidate_id);
                     }
+                    while (top_candidates.size() > ef) {
+                        top_candidates.pop();
+                    }
+                    if (!top_candidates.empty())
+                        q.lowerBound = top_candidates.top().first;
                 }
             }
+            batch.size = 0;
+            break;
         }
 
+        if (candidate_set.empty()) {
+            q.done = true;
+            return;
+        }
+        dist_t candidate_dist = -candidate_set.top().first;
+        bool flag_stop_search;
+        if (bare_bone_search) {
+            flag_stop_search = candidate_dist > q.lowerBound;
+        } else {
+            flag_stop_search = candidate_dist > q.lowerBound && top_candidates.size() == ef;
+        }
+        if (flag_stop_search) {
+            q.done = true;
+            return;
+        }
+        q.current_node_id = candidate_set.top().second;
+        candidate_set.pop();
+#ifdef USE_SSE
+        _mm_prefetch((char *) get_linklist0(q.current_node_id), _MM_HINT_T0);
+#endif
+        q.stage = INTERLEAVED_LINKS;
+    }
+
+
+    std::vector<std::pair<dist_t, labeltype >>
+    searchStopConditionClosest(
+        const void *query_data,
+        BaseSearchStopCondition<dist_t>& stop_condition,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        std::vector<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) return result;
+
+        std::vector<char> query_state;
+        const void *query = space_->prepare_query_state(query_data, query_state);
+
+        tableint currObj = searchUpperLayers(query);
+
         Candidate top_candidates;
-        top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        top_candidates = searchBaseLayerST<false>(currObj, query, 0, isIdAllowed, &stop_condition);
 
         size_t sz = top_candidates.size();
         result.resize(sz);
         while (!top_candidates.empty()) {
-            result[--sz] = top_candidates.top();
+            std::pair<dist_t, tableint> rez = top_candidates.top();
+            result[--sz] = std::pair<dist_t, labeltype>(rez.first, getExternalLabel(rez.second));
             top_candidates.pop();
         }
 
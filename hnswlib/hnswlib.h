@@ -11,10 +11,22 @@
 #ifndef NO_MANUAL_VECTORIZATION
 #if (defined(__SSE__) || _M_IX86_FP > 0 || defined(_M_AMD64) || defined(_M_X64))
 #define USE_SSE
+#ifdef __POPCNT__
+#define USE_POPCNT
+#endif
 #ifdef __AVX__
 #define USE_AVX
+#ifdef __FMA__
+#define USE_FMA
+#endif
+#ifdef __F16C__
+#define USE_F16C
+#endif
 #ifdef __AVX512F__
 #define USE_AVX512
+#ifdef __AVX512VPOPCNTDQ__
+#define USE_AVX512_VPOPCNTDQ
+#endif
 #endif
 #endif
 #endif
@@ -114,6 +126,74 @@ static bool AVX512Capable() {
     }
     return HW_AVX512F && avx512Supported;
 }
+
+static bool FMACapable() {
+    if (!AVXCapable()) return false;
+
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000001, 0);
+    return (cpuInfo[2] & ((int)1 << 12)) != 0;
+}
+
+static bool F16CCapable() {
+    if (!AVXCapable()) return false;
+
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000001, 0);
+    return (cpuInfo[2] & ((int)1 << 29)) != 0;
+}
+
+static bool POPCNTCapable() {
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000001, 0);
+    return (cpuInfo[2] & ((int)1 << 23)) != 0;
+}
+
+static bool AVX512VPOPCNTDQCapable() {
+    if (!AVX512Capable()) return false;
+
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000007, 0);
+    return (cpuInfo[2] & ((int)1 << 14)) != 0;
+}
+
+// Instruction sets the distance kernels can be dispatched to, ordered by preference.
+enum SIMDLevel {
+    SIMD_SSE = 1,
+    SIMD_AVX = 2,
+    SIMD_FMA = 3,  // AVX + FMA3 (Haswell and newer)
+    SIMD_AVX512 = 4
+};
+
+static SIMDLevel detectSIMDLevel() {
+    if (AVX512Capable()) return SIMD_AVX512;
+    if (FMACapable()) return SIMD_FMA;
+    if (AVXCapable()) return SIMD_AVX;
+    return SIMD_SSE;
+}
+
+// CPUID is only queried on the first call
+static SIMDLevel getSIMDLevel() {
+    static const SIMDLevel level = detectSIMDLevel();
+    return level;
+}
+
+// In-register horizontal sums, used by the kernels instead of spilling the accumulator to memory
+static inline float HorizontalSumSSE(__m128 v) {
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+#if defined(USE_AVX)
+static inline float HorizontalSumAVX(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    return HorizontalSumSSE(_mm_add_ps(lo, hi));
+}
+#endif
 #endif
 
 #include <queue>
@@ -124,10 +204,17 @@ static bool AVX512Capable() {
 namespace hnswlib {
 typedef size_t labeltype;
 
+class IdFilter;
+class NamespaceFilter;
+
 // This can be extended to store state for filtering (e.g. from a std::set)
 class BaseFilterFunctor {
  public:
     virtual bool operator()(hnswlib::labeltype id) { return true; }
+    // a filter over internal ids, which HierarchicalNSW tests without calling operator()
+    virtual const IdFilter *asIdFilter() const { return nullptr; }
+    // a filter to the elements of one namespace, which HierarchicalNSW searches from its entry point
+    virtual const NamespaceFilter *asNamespaceFilter() const { return nullptr; }
     virtual ~BaseFilterFunctor() {};
 };
 
@@ -170,6 +257,60 @@ static void readBinaryPOD(std::istream &in, T &podRef) {
 template<typename MTYPE>
 using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+// Distances from one vector to n others: out[i] = dist(query, vectors[i]).
+template<typename MTYPE>
+using DISTFUNC_BATCH = void(*)(const void *query, const void *const *vectors, size_t n, const void *param, MTYPE *out);
+
+// Early-abandoning distance: exact when the distance is <= bound, otherwise any value > bound.
+template<typename MTYPE>
+using DISTFUNC_BOUNDED = MTYPE(*)(const void *, const void *, const void *, MTYPE bound);
+
+// Kernels of one metric, one entry per dimension class. Spaces build a table once
+// from the CPU features and pick the entry for their dimension with select().
+// Entries left as nullptr (no SIMD support compiled in) fall back to generic.
+template<typename MTYPE>
+struct DistFuncTable {
+    // kernels compiled for one exact dimension, checked before the dimension classes below
+    std::vector<std::pair<size_t, DISTFUNC<MTYPE>>> fixed_dim;
+
+    DISTFUNC<MTYPE> generic{nullptr};
+    DISTFUNC<MTYPE> simd16{nullptr};  // dim % 16 == 0
+    DISTFUNC<MTYPE> simd4{nullptr};  // dim % 4 == 0
+    DISTFUNC<MTYPE> simd16_residuals{nullptr};  // dim > 16
+    DISTFUNC<MTYPE> simd4_residuals{nullptr};  // dim > 4
+
+    DISTFUNC_BATCH<MTYPE> batch{nullptr};  // one-to-many kernel, used when dim >= batch_min_dim
+    size_t batch_min_dim{0};
+    DISTFUNC_BOUNDED<MTYPE> bounded{nullptr};  // early-abandoning kernel, used when dim >= bounded_min_dim
+    size_t bounded_min_dim{0};
+
+    DISTFUNC<MTYPE> select(size_t dim) const {
+        for (const auto &entry : fixed_dim) {
+            if (entry.first == dim)
+                return entry.second;
+        }
+
+        DISTFUNC<MTYPE> func = nullptr;
+        if (dim % 16 == 0)
+            func = simd16;
+        else if (dim % 4 == 0)
+            func = simd4;
+        else if (dim > 16)
+            func = simd16_residuals;
+        else if (dim > 4)
+            func = simd4_residuals;
+        return func ? func : generic;
+    }
+
+    DISTFUNC_BATCH<MTYPE> select_batch(size_t dim) const {
+        return dim >= batch_min_dim ? batch : nullptr;
+    }
+
+    DISTFUNC_BOUNDED<MTYPE> select_bounded(size_t dim) const {
+        return dim >= bounded_min_dim ? bounded : nullptr;
+    }
+};
+
 template<typename MTYPE>
 class SpaceInterface {
  public:
@@ -180,6 +321,69 @@ class SpaceInterface {
 
     virtual void *get_dist_func_param() = 0;
 
+    // Spaces that store vectors in a different form than they are passed to addPoint/searchKnn
+    // (e.g. half precision) override the methods below. get_dist_func() then compares two
+    // stored vectors and get_query_dist_func() compares an input query with a stored vector.
+
+    // size of a vector as passed to addPoint/searchKnn
+    virtual size_t get_input_size() {
+        return get_data_size();
+    }
+
+    // converts an input vector into its stored form of get_data_size() bytes
+    virtual void encode(const void *input, void *stored) {
+        memcpy(stored, input, get_data_size());
+    }
+
+    // converts a stored vector back into an input vector of get_input_size() bytes
+    virtual void decode(const void *stored, void *output) {
+        memcpy(output, stored, get_data_size());
+    }
+
+    virtual DISTFUNC<MTYPE> get_query_dist_func() {
+        return get_dist_func();
+    }
+
+    // One-to-many version of get_dist_func(), nullptr if the space has none. The algorithms
+    // then call the single distance function once per vector.
+    virtual DISTFUNC_BATCH<MTYPE> get_batch_dist_func() {
+        return nullptr;
+    }
+
+    virtual DISTFUNC_BATCH<MTYPE> get_query_batch_dist_func() {
+        return get_query_dist_func() == get_dist_func() ? get_batch_dist_func() : nullptr;
+    }
+
+    // Early-abandoning version of get_dist_func(), nullptr if the space has none. Only spaces
+    // whose partial sums never decrease (e.g. squared L2) can provide one.
+    virtual DISTFUNC_BOUNDED<MTYPE> get_bounded_dist_func() {
+        return nullptr;
+    }
+
+    virtual DISTFUNC_BOUNDED<MTYPE> get_query_bounded_dist_func() {
+        return get_query_dist_func() == get_dist_func() ? get_bounded_dist_func() : nullptr;
+    }
+
+    // Per-query precomputation (e.g. a distance lookup table). When get_query_state_size() is
+    // not 0, prepare_query() is called once per search and the query distance function then
+    // receives the prepared state in place of the query vector.
+    virtual size_t get_query_state_size() {
+        return 0;
+    }
+
+    virtual void prepare_query(const void *, void *) {
+    }
+
+    // returns what the query distance function expects for this query, state is used as storage
+    const void *prepare_query_state(const void *query, std::vector<char> &state) {
+        size_t state_size = get_query_state_size();
+        if (state_size == 0)
+            return query;
+        state.resize(state_size);
+        prepare_query(query, state.data());
+        return state.data();
+    }
+
     virtual ~SpaceInterface() {}
 };
 
@@ -221,8 +425,13 @@ AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t
 }
 }  // namespace hnswlib
 
+#include "simd_traits.h"
 #include "space_l2.h"
 #include "space_ip.h"
+#include "space_half.h"
+#include "space_sq8.h"
+#include "space_pq.h"
+#include "space_binary.h"
 #include "stop_condition.h"
 #include "bruteforce.h"
 #include "hnswalg.h"
@@ -0,0 +1,148 @@
+#pragma once
+#include "hnswlib.h"
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+namespace hnswlib {
+typedef unsigned int tableint;
+
+/*
+* A filter over the internal ids of one HierarchicalNSW, stored as a dense bitset. The
+* search tests the bit of every visited element inline, instead of a virtual call with
+* its label, which costs a copy of the label out of the level-0 record. Build it once
+* with HierarchicalNSW::createIdFilter from the allowed labels and reuse it across queries.
+*
+* Elements added after the filter was built are not allowed. The filter records the
+* generation of the index it was built from: replacing a deleted element or reorderIndex
+* gives internal ids to other elements, and searches then reject the filter instead of
+* allowing the wrong elements. A filter built by hand has generation 0 and is not checked.
+* Other indexes see it as a BaseFilterFunctor and test the label as if it were the
+* internal id.
+*/
+class IdFilter : public BaseFilterFunctor {
+    std::vector<uint64_t> bits_;
+    size_t max_elements_{0};
+    size_t count_{0};
+    uint64_t generation_{0};
+
+    // index of the lowest set bit of a non-zero word
+    static inline size_t lowestBit(uint64_t word) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return index;
+#else
+        return __builtin_ctzll(word);
+#endif
+    }
+
+    void recount() {
+        count_ = 0;
+        for (uint64_t word : bits_) {
+            for (; word; word &= word - 1)
+                count_++;
+        }
+    }
+
+    // the older generation of the two, a combination is out of date if either part is
+    void mergeGeneration(const IdFilter &other) {
+        if (generation_ == 0 || (other.generation_ != 0 && other.generation_ < generation_))
+            generation_ = other.generation_;
+    }
+
+ public:
+    explicit IdFilter(size_t max_elements = 0) {
+        resize(max_elements);
+    }
+
+    // grows or shrinks the range of ids, the ids kept stay allowed
+    void resize(size_t max_elements) {
+        bits_.resize((max_elements + 63) / 64, 0);
+        if (max_elements % 64)
+            bits_.back() &= ((uint64_t) 1 << (max_elements % 64)) - 1;
+        if (max_elements < max_elements_)
+            recount();
+        max_elements_ = max_elements;
+    }
+
+    void allow(tableint id) {
+        if (id >= max_elements_)
+            throw std::runtime_error("IdFilter: the id is out of range");
+        uint64_t bit = (uint64_t) 1 << (id & 63);
+        if (!(bits_[id >> 6] & bit)) {
+            bits_[id >> 6] |= bit;
+            count_++;
+        }
+    }
+
+    void disallow(tableint id) {
+        if (id >= max_elements_)
+            return;
+        uint64_t bit = (uint64_t) 1 << (id & 63);
+        if (bits_[id >> 6] & bit) {
+            bits_[id >> 6] &= ~bit;
+            count_--;
+        }
+    }
+
+    // keeps the ids allowed by both filters
+    void intersectWith(const IdFilter &other) {
+        for (size_t w = 0; w < bits_.size(); w++)
+            bits_[w] &= w < other.bits_.size() ? other.bits_[w] : 0;
+        recount();
+        mergeGeneration(other);
+    }
+
+    // adds the ids allowed by other, within the range of this filter
+    void unionWith(const IdFilter &other) {
+        size_t words = std::min(bits_.size(), other.bits_.size());
+        for (size_t w = 0; w < words; w++)
+            bits_[w] |= other.bits_[w];
+        resize(max_elements_);  // clears the bits of other past the range
+        recount();
+        mergeGeneration(other);
+    }
+
+    inline bool isAllowed(tableint id) const {
+        return id < max_elements_ && ((bits_[id >> 6] >> (id & 63)) & 1);
+    }
+
+    // calls visit(id) for every allowed id, in increasing order
+    template<typename visitor_t>
+    void forEachAllowed(visitor_t visit) const {
+        for (size_t w = 0; w < bits_.size(); w++) {
+            for (uint64_t word = bits_[w]; word; word &= word - 1) {
+                visit((tableint) (w * 64 + lowestBit(word)));
+            }
+        }
+    }
+
+    // number of allowed ids
+    size_t count() const {
+        return count_;
+    }
+
+    size_t maxElements() const {
+        return max_elements_;
+    }
+
+    // the generation of the index the filter was built from, 0 if it was built by hand
+    uint64_t generation() const {
+        return generation_;
+    }
+
+    void setGeneration(uint64_t generation) {
+        generation_ = generation;
+    }
+
+    bool operator()(labeltype label) override {
+        return label < max_elements_ && isAllowed((tableint) label);
+    }
+
+    const IdFilter *asIdFilter() const override {
+        return this;
+    }
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,131 @@
+#pragma once
+#include "hnswlib.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace hnswlib {
+typedef unsigned int tableint;
+
+/*
+* Storage of the upper-layer link lists. Instead of one malloc per element the lists are
+* carved out of 1 MiB chunks and found through a table of offsets by internal id. An
+* offset is a position in the concatenation of the chunks, so a block of link lists read
+* from a file, or mapped, is used in place without copying or splitting it.
+*
+* Allocations take a lock, lookups do not: chunks never move, and the chunk table grows by
+* copying it, keeping the previous tables alive until clear() for readers still using them.
+*/
+class LinkArena {
+    static const size_t CHUNK_BITS = 20;
+    static const size_t CHUNK_SIZE = (size_t) 1 << CHUNK_BITS;
+
+    std::vector<size_t> offsets_;  // by internal id, only meaningful for elements with upper levels
+    std::atomic<char **> chunks_{nullptr};  // chunk k covers the offsets [k * CHUNK_SIZE, (k + 1) * CHUNK_SIZE)
+    size_t num_chunks_{0};
+    size_t chunks_capacity_{0};
+    size_t next_offset_{0};
+    std::vector<char *> blocks_;  // memory owned by the arena
+    std::vector<char **> tables_;  // every chunk table published so far
+    std::mutex lock_;
+
+    // maps size bytes of block to new chunks, an allocation or block may span several chunks
+    void addChunks(char *block, size_t size) {
+        size_t count = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        char **table = chunks_.load(std::memory_order_relaxed);
+        if (num_chunks_ + count > chunks_capacity_) {
+            size_t capacity = std::max(std::max(2 * chunks_capacity_, num_chunks_ + count), (size_t) 16);
+            char **table_new = new char *[capacity];
+            std::copy(table, table + num_chunks_, table_new);
+            tables_.push_back(table_new);
+            table = table_new;
+            chunks_capacity_ = capacity;
+        }
+        for (size_t i = 0; i < count; i++) {
+            table[num_chunks_ + i] = block + i * CHUNK_SIZE;
+        }
+        chunks_.store(table, std::memory_order_release);
+        num_chunks_ += count;
+        next_offset_ = num_chunks_ * CHUNK_SIZE;
+    }
+
+ public:
+    LinkArena() = default;
+    LinkArena(const LinkArena &) = delete;
+    LinkArena &operator=(const LinkArena &) = delete;
+
+    ~LinkArena() {
+        clear();
+    }
+
+    // the offset table grows or shrinks, the link lists stay in place
+    void resize(size_t max_elements) {
+        offsets_.resize(max_elements);
+    }
+
+    // zeroed link lists of size bytes for the element id
+    char *allocate(tableint id, size_t size) {
+        std::unique_lock<std::mutex> lock(lock_);
+        size_t offset = next_offset_;
+        if (offset + size > num_chunks_ * CHUNK_SIZE) {
+            // the tail of the last chunk is left unused
+            size_t block_size = std::max(size + CHUNK_SIZE - 1, (size_t) CHUNK_SIZE) / CHUNK_SIZE * CHUNK_SIZE;
+            char *block = (char *) malloc(block_size);
+            if (block == nullptr)
+                throw std::runtime_error("Not enough memory: LinkArena failed to allocate a chunk");
+            blocks_.push_back(block);
+            offset = num_chunks_ * CHUNK_SIZE;
+            addChunks(block, block_size);
+        }
+        next_offset_ = offset + size;
+        offsets_[id] = offset;
+        char *links = get(id);
+        memset(links, 0, size);
+        return links;
+    }
+
+    /*
+    * Uses size bytes of link lists stored back to back, returns the offset of the first
+    * byte to pass to setOffset. The arena frees the block with free() when owned is set,
+    * a mapped block must outlive the arena or its clear().
+    */
+    size_t addBlock(char *block, size_t size, bool owned) {
+        std::unique_lock<std::mutex> lock(lock_);
+        if (owned)
+            blocks_.push_back(block);
+        size_t offset = num_chunks_ * CHUNK_SIZE;
+        addChunks(block, size);
+        return offset;
+    }
+
+    inline char *get(tableint id) const {
+        size_t offset = offsets_[id];
+        return chunks_.load(std::memory_order_acquire)[offset >> CHUNK_BITS] + (offset & (CHUNK_SIZE - 1));
+    }
+
+    inline size_t getOffset(tableint id) const {
+        return offsets_[id];
+    }
+
+    inline void setOffset(tableint id, size_t offset) {
+        offsets_[id] = offset;
+    }
+
+    void clear() {
+        for (char *block : blocks_) {
+            free(block);
+        }
+        for (char **table : tables_) {
+            delete[] table;
+        }
+        blocks_.clear();
+        tables_.clear();
+        chunks_.store(nullptr);
+        num_chunks_ = 0;
+        chunks_capacity_ = 0;
+        next_offset_ = 0;
+        std::vector<size_t>().swap(offsets_);
+    }
+};
+
+}  // namespace hnswlib
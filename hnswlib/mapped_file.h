@@ -0,0 +1,62 @@
+#pragma once
+#include "hnswlib.h"
+#include <string>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hnswlib {
+
+/*
+* A whole file mapped read-only. The mapping is shared, so processes that map the same
+* file use the same pages of the page cache, and pages are only read on first access.
+*/
+class MappedFile {
+    char *data_{nullptr};
+    size_t size_{0};
+
+ public:
+    explicit MappedFile(const std::string &path) {
+#if defined(_WIN32)
+        throw std::runtime_error("MappedFile: memory-mapped files are not supported on this platform");
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("MappedFile: cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            throw std::runtime_error("MappedFile: cannot stat " + path + " or it is empty");
+        }
+        size_ = st.st_size;
+        void *ptr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);  // the mapping stays valid
+        if (ptr == MAP_FAILED)
+            throw std::runtime_error("MappedFile: cannot map " + path);
+        data_ = (char *) ptr;
+#endif
+    }
+
+    ~MappedFile() {
+#if !defined(_WIN32)
+        if (data_ != nullptr)
+            munmap(data_, size_);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    char *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+};
+
+}  // namespace hnswlib
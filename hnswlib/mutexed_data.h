@@ -1,56 +1,109 @@
 #pragma once
 
 #include "hnswlib.h"
+#include <mutex>
+#include <unordered_map>
 #include <unordered_set>
+#if __cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L)
+#include <shared_mutex>
+#endif
 
 namespace hnswlib {
 typedef unsigned int tableint;
 typedef unsigned int linklistsizeint;
 
+#if __cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L)
+typedef std::shared_timed_mutex LabelLookupMutex;
+typedef std::shared_lock<LabelLookupMutex> LabelLookupReadLock;
+#else
+// C++11 has no shared mutex, lookups take the shard lock exclusively
+typedef std::mutex LabelLookupMutex;
+typedef std::unique_lock<LabelLookupMutex> LabelLookupReadLock;
+#endif
+
+/*
+* Label to internal id map, split into shards by a hash of the label. Threads working on
+* different labels rarely share a lock or its cache line, and lookups, which dominate
+* (getDataByLabel, markDelete, the existence check of addPoint), take it shared.
+*/
 class LabelLookup {
-    mutable std::mutex label_lookup_lock;  // lock for label_lookup_ is mutable to pass the multiThreadLoad_test.cpp compilation
-    std::unordered_map<labeltype, tableint> label_lookup_;
+    static const size_t NUM_SHARDS = 64;
+
+    struct Shard {
+        mutable LabelLookupMutex lock;
+        std::unordered_map<labeltype, tableint> label_lookup_;
+    };
+    Shard shards_[NUM_SHARDS];
+
+    // multiplicative hashing, so that labels with a common stride spread over the shards
+    Shard &shard(labeltype label) {
+        return shards_[((uint64_t) label * 0x9E3779B97F4A7C15ULL) >> 58];
+    }
+
+    const Shard &shard(labeltype label) const {
+        return shards_[((uint64_t) label * 0x9E3779B97F4A7C15ULL) >> 58];
+    }
 
     public:
-    void replace_label(tableint label_replaced, tableint new_label, tableint internal_id_replaced) {
-        std::lock_guard<std::mutex> lock_table(label_lookup_lock);
-        label_lookup_.erase(label_replaced);
-        label_lookup_[new_label] = internal_id_replaced;    
-    }
-
-    bool find_label(tableint label) {
-        std::lock_guard<std::mutex> lock_table(label_lookup_lock);
-        auto found = label_lookup_.find(label);
-        if (found != label_lookup_.end())
-            return true;
-        else
-            return false;
+    void replace_label(labeltype label_replaced, labeltype new_label, tableint internal_id_replaced) {
+        {
+            Shard &old_shard = shard(label_replaced);
+            std::lock_guard<LabelLookupMutex> lock_table(old_shard.lock);
+            old_shard.label_lookup_.erase(label_replaced);
+        }
+        add_label(new_label, internal_id_replaced);
     }
 
-    void add_label(tableint label, tableint id) {
-        std::lock_guard<std::mutex> lock_table(label_lookup_lock);
-        label_lookup_[label] = id;
+    bool find_label(labeltype label) const {
+        const Shard &s = shard(label);
+        LabelLookupReadLock lock_table(s.lock);
+        return s.label_lookup_.find(label) != s.label_lookup_.end();
     }
 
-    void add_label_without_lock(tableint label, tableint id) {
-        label_lookup_[label] = id;
+    void add_label(labeltype label, tableint id) {
+        Shard &s = shard(label);
+        std::lock_guard<LabelLookupMutex> lock_table(s.lock);
+        s.label_lookup_[label] = id;
     }
 
-    tableint get_id(tableint label) {
-        std::lock_guard<std::mutex> lock_table(label_lookup_lock);  // TODO: Use readlock instead
-        return label_lookup_[label];
+    void add_label_without_lock(labeltype label, tableint id) {
+        shard(label).label_lookup_[label] = id;
     }
 
-    tableint find_label_get_id(tableint label) const {
-        // Assume the label exists in the label_lookup_
-        std::lock_guard<std::mutex> lock_table(label_lookup_lock);
-        auto found = label_lookup_.find(label);
-        if (found != label_lookup_.end()) {
+    // the id of a label known to exist
+    tableint get_id(labeltype label) const {
+        const Shard &s = shard(label);
+        LabelLookupReadLock lock_table(s.lock);
+        return s.label_lookup_.find(label)->second;
+    }
+
+    bool try_get_id(labeltype label, tableint &id) const {
+        const Shard &s = shard(label);
+        LabelLookupReadLock lock_table(s.lock);
+        auto found = s.label_lookup_.find(label);
+        if (found == s.label_lookup_.end())
+            return false;
+        id = found->second;
+        return true;
+    }
+
+    tableint find_label_get_id(labeltype label) const {
+        const Shard &s = shard(label);
+        LabelLookupReadLock lock_table(s.lock);
+        auto found = s.label_lookup_.find(label);
+        if (found != s.label_lookup_.end()) {
             return found->second;
         }
-        
+
         throw std::runtime_error("Label not Found!");
     }
+
+    void clear() {
+        for (Shard &s : shards_) {
+            std::lock_guard<LabelLookupMutex> lock_table(s.lock);
+            s.label_lookup_.clear();
+        }
+    }
 };
 class DeletedElement {
     std::mutex deleted_elements_lock;
@@ -83,6 +136,11 @@ class DeletedElement {
         deleted_elements_.erase(id);
     }
 
+    void clear() {
+        std::lock_guard<std::mutex> lock(deleted_elements_lock);
+        deleted_elements_.clear();
+    }
+
 };
 
 }  // namespace hnswlib
@@ -0,0 +1,259 @@
+#pragma once
+#include "hnswlib.h"
+#include "id_filter.h"
+#include "mutexed_data.h"
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace hnswlib {
+typedef unsigned int tableint;
+typedef uint32_t namespacetype;
+
+// the namespace of the elements added without one, which no namespace search returns
+static const namespacetype NO_NAMESPACE = (namespacetype) -1;
+
+static const uint64_t HNSW_NAMESPACES_MAGIC = 0x00435053574e48ULL;  // "HNWSPC"
+
+/*
+* The namespace of every element of a HierarchicalNSW, for many tenants sharing one graph.
+* Each namespace keeps the list of its elements, for the scan of small namespaces, and an
+* entry point, its element on the highest level, from which the graph search of large
+* ones starts. An element costs 8 bytes and a namespace a few dozen, against the visited
+* lists, locks and entry point of an index of its own.
+*
+* Deleted elements stay in their namespace, as they stay in the graph, and the searches
+* skip them.
+*
+* Searches read the namespace of an element with a relaxed atomic load and take the lock
+* shared to find a namespace or scan its elements in place, so tenants only wait for
+* writers: set, resize and permute take it exclusively.
+*/
+class NamespaceStore {
+    struct Namespace {
+        std::vector<tableint> members;
+        tableint entry_point{0};
+        int entry_level{-1};
+    };
+
+    std::unique_ptr<std::atomic<namespacetype>[]> namespaces_;  // by element
+    size_t max_elements_{0};
+    std::vector<tableint> positions_;  // of the element in the members of its namespace
+    std::unordered_map<namespacetype, Namespace> by_namespace_;
+    mutable LabelLookupMutex lock_;  // the shared mutex of the label lookup, see mutexed_data.h
+
+    void setNamespaceOf(tableint id, namespacetype ns) {
+        namespaces_[id].store(ns, std::memory_order_relaxed);
+    }
+
+    // with the lock held exclusively, added elements have no namespace
+    void setMaxElements(size_t max_elements) {
+        std::unique_ptr<std::atomic<namespacetype>[]> namespaces(new std::atomic<namespacetype>[max_elements]);
+        for (size_t id = 0; id < max_elements; id++)
+            namespaces[id].store(id < max_elements_ ? get(id) : NO_NAMESPACE, std::memory_order_relaxed);
+        namespaces_.swap(namespaces);
+        max_elements_ = max_elements;
+        positions_.resize(max_elements, 0);
+    }
+
+    void addMember(tableint id, namespacetype ns, int level) {
+        Namespace &members = by_namespace_[ns];
+        positions_[id] = (tableint) members.members.size();
+        members.members.push_back(id);
+        if (level > members.entry_level) {
+            members.entry_point = id;
+            members.entry_level = level;
+        }
+    }
+
+    void removeMember(tableint id, const std::vector<int> &levels) {
+        auto found = by_namespace_.find(get(id));
+        Namespace &members = found->second;
+        tableint last = members.members.back();
+        members.members[positions_[id]] = last;
+        positions_[last] = positions_[id];
+        members.members.pop_back();
+        setNamespaceOf(id, NO_NAMESPACE);
+        if (members.members.empty()) {
+            by_namespace_.erase(found);
+            return;
+        }
+        if (members.entry_point != id)
+            return;
+        members.entry_level = -1;
+        for (tableint member : members.members) {
+            if (levels[member] > members.entry_level) {
+                members.entry_point = member;
+                members.entry_level = levels[member];
+            }
+        }
+    }
+
+    void rebuild(const std::vector<int> &levels) {
+        by_namespace_.clear();
+        for (tableint id = 0; id < max_elements_; id++) {
+            if (get(id) != NO_NAMESPACE)
+                addMember(id, get(id), levels[id]);
+        }
+    }
+
+ public:
+    explicit NamespaceStore(size_t max_elements) {
+        resize(max_elements);
+    }
+
+    // not concurrently with searches, like HierarchicalNSW::resizeIndex
+    void resize(size_t max_elements) {
+        std::unique_lock<LabelLookupMutex> lock(lock_);
+        setMaxElements(max_elements);
+    }
+
+    // the namespace of the element, read without the lock by the searches
+    inline namespacetype get(tableint id) const {
+        return namespaces_[id].load(std::memory_order_relaxed);
+    }
+
+    // moves the element to namespace ns, levels are those of the elements in the graph
+    void set(tableint id, namespacetype ns, const std::vector<int> &levels) {
+        std::unique_lock<LabelLookupMutex> lock(lock_);
+        if (get(id) == ns)
+            return;
+        if (get(id) != NO_NAMESPACE)
+            removeMember(id, levels);
+        if (ns != NO_NAMESPACE) {
+            setNamespaceOf(id, ns);
+            addMember(id, ns, levels[id]);
+        }
+    }
+
+    // the number of elements of ns and the entry point of its graph search
+    size_t lookup(namespacetype ns, tableint &entry_point, int &entry_level) const {
+        LabelLookupReadLock lock(lock_);
+        auto found = by_namespace_.find(ns);
+        if (found == by_namespace_.end())
+            return 0;
+        entry_point = found->second.entry_point;
+        entry_level = found->second.entry_level;
+        return found->second.members.size();
+    }
+
+    /*
+    * Calls visit with the elements of ns, in no particular order, unless ns has none. The
+    * list is not copied: the lock is held shared during the call, so visit must not change
+    * the namespaces.
+    */
+    template<typename visitor_t>
+    void withMembers(namespacetype ns, visitor_t visit) const {
+        LabelLookupReadLock lock(lock_);
+        auto found = by_namespace_.find(ns);
+        if (found != by_namespace_.end())
+            visit(found->second.members);
+    }
+
+    size_t numNamespaces() const {
+        LabelLookupReadLock lock(lock_);
+        return by_namespace_.size();
+    }
+
+    // new position -> old id, as in HierarchicalNSW::reorderIndex, with the permuted levels
+    void permute(const std::vector<tableint> &order, const std::vector<int> &levels) {
+        std::unique_lock<LabelLookupMutex> lock(lock_);
+        std::vector<namespacetype> namespaces(max_elements_, NO_NAMESPACE);
+        for (size_t i = 0; i < order.size(); i++)
+            namespaces[i] = get(order[i]);
+        for (tableint id = 0; id < max_elements_; id++)
+            setNamespaceOf(id, namespaces[id]);
+        rebuild(levels);
+    }
+
+    // the namespaces of the first count elements, the lists are rebuilt on load
+    void save(const std::string &location, size_t count) const {
+        std::vector<namespacetype> namespaces(count);
+        {
+            LabelLookupReadLock lock(lock_);
+            for (tableint id = 0; id < count; id++)
+                namespaces[id] = get(id);
+        }
+        std::ofstream output(location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("NamespaceStore: cannot open " + location);
+        writeBinaryPOD(output, HNSW_NAMESPACES_MAGIC);
+        writeBinaryPOD(output, count);
+        output.write((const char *) namespaces.data(), count * sizeof(namespacetype));
+    }
+
+    static NamespaceStore *load(const std::string &location, size_t max_elements, const std::vector<int> &levels) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("NamespaceStore: cannot open " + location);
+        uint64_t magic = 0;
+        size_t count = 0;
+        readBinaryPOD(input, magic);
+        readBinaryPOD(input, count);
+        if (magic != HNSW_NAMESPACES_MAGIC || count > max_elements)
+            throw std::runtime_error("NamespaceStore: " + location + " seems to be corrupted");
+        std::vector<namespacetype> namespaces(count);
+        input.read((char *) namespaces.data(), count * sizeof(namespacetype));
+        if (!input)
+            throw std::runtime_error("NamespaceStore: " + location + " is truncated");
+        NamespaceStore *store = new NamespaceStore(max_elements);
+        for (tableint id = 0; id < count; id++)
+            store->setNamespaceOf(id, namespaces[id]);
+        store->rebuild(levels);
+        return store;
+    }
+};
+
+
+/*
+* Allows the elements of one namespace that inner, if any, allows too. Build it with
+* HierarchicalNSW::createNamespaceFilter: the search then scans the elements of a small
+* namespace, or walks the graph from the entry point of a large one. It follows the
+* changes of namespaces, and is valid until the index is cleared or loaded again.
+*/
+class NamespaceFilter : public BaseFilterFunctor {
+    const NamespaceStore *store_;
+    namespacetype ns_;
+    BaseFilterFunctor *inner_;
+    const IdFilter *inner_id_filter_;
+
+ public:
+    NamespaceFilter(const NamespaceStore *store, namespacetype ns, BaseFilterFunctor *inner = nullptr)
+        : store_(store), ns_(ns), inner_(inner), inner_id_filter_(inner ? inner->asIdFilter() : nullptr) {}
+
+    // the element is in the namespace, inner is tested separately
+    inline bool isAllowed(tableint id) const {
+        return store_->get(id) == ns_;
+    }
+
+    const NamespaceStore &store() const {
+        return *store_;
+    }
+
+    namespacetype getNamespace() const {
+        return ns_;
+    }
+
+    BaseFilterFunctor *inner() const {
+        return inner_;
+    }
+
+    const IdFilter *innerIdFilter() const {
+        return inner_id_filter_;
+    }
+
+    // the namespace is only known by internal id, other indexes see the inner filter
+    bool operator()(labeltype label) override {
+        return !inner_ || (*inner_)(label);
+    }
+
+    const NamespaceFilter *asNamespaceFilter() const override {
+        return this;
+    }
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,110 @@
+#pragma once
+#include "hnswlib.h"
+#include <string>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hnswlib {
+
+/*
+* Full-precision copies of the indexed vectors, addressed by internal id. They
+* live outside data_level0_memory_ so that a compressed space keeps the graph walk
+* small, and are only touched to re-rank the final candidates of a search.
+* With a path the copies are kept in a shared memory-mapped file, so they are
+* paged in on demand and persist next to the saved index.
+*/
+class RerankStore {
+    size_t max_elements_{0};
+    size_t vector_size_{0};
+    char *data_{nullptr};
+    std::string path_;
+    int fd_{-1};
+
+    void map(size_t max_elements) {
+#if defined(_WIN32)
+        throw std::runtime_error("RerankStore: memory-mapped files are not supported on this platform");
+#else
+        size_t bytes = std::max(max_elements * vector_size_, (size_t) 1);
+        struct stat st;
+        if (fstat(fd_, &st) != 0)
+            throw std::runtime_error("RerankStore: cannot stat " + path_);
+        if ((size_t) st.st_size < bytes && ftruncate(fd_, bytes) != 0)
+            throw std::runtime_error("RerankStore: cannot grow " + path_);
+        void *ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (ptr == MAP_FAILED)
+            throw std::runtime_error("RerankStore: cannot map " + path_);
+        data_ = (char *) ptr;
+#endif
+    }
+
+    void unmap() {
+#if !defined(_WIN32)
+        if (data_ != nullptr)
+            munmap(data_, std::max(max_elements_ * vector_size_, (size_t) 1));
+#endif
+        data_ = nullptr;
+    }
+
+ public:
+    RerankStore(size_t max_elements, size_t vector_size, const std::string &path = "")
+        : max_elements_(max_elements), vector_size_(vector_size), path_(path) {
+        if (path_.empty()) {
+            data_ = (char *) malloc(max_elements_ * vector_size_);
+            if (data_ == nullptr)
+                throw std::runtime_error("Not enough memory: RerankStore failed to allocate vectors");
+            return;
+        }
+#if !defined(_WIN32)
+        fd_ = open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0)
+            throw std::runtime_error("RerankStore: cannot open " + path_);
+#endif
+        map(max_elements_);
+    }
+
+    ~RerankStore() {
+        if (path_.empty()) {
+            free(data_);
+            return;
+        }
+        unmap();
+#if !defined(_WIN32)
+        close(fd_);
+#endif
+    }
+
+    bool isMapped() const {
+        return !path_.empty();
+    }
+
+    size_t vectorSize() const {
+        return vector_size_;
+    }
+
+    void resize(size_t new_max_elements) {
+        if (path_.empty()) {
+            char *data_new = (char *) realloc(data_, new_max_elements * vector_size_);
+            if (data_new == nullptr)
+                throw std::runtime_error("Not enough memory: RerankStore failed to resize vectors");
+            data_ = data_new;
+        } else {
+            unmap();
+            map(new_max_elements);
+        }
+        max_elements_ = new_max_elements;
+    }
+
+    inline char *get(size_t id) const {
+        return data_ + id * vector_size_;
+    }
+
+    inline void set(size_t id, const void *vector) {
+        memcpy(get(id), vector, vector_size_);
+    }
+};
+
+}  // namespace hnswlib
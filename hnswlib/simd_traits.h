@@ -0,0 +1,191 @@
+#pragma once
+#include "hnswlib.h"
+
+// Dimensions that get a fully unrolled, fixed-size kernel (common embedding sizes).
+// Every entry must be a multiple of 16. Define before including hnswlib.h to override.
+#ifndef HNSWLIB_FIXED_DIMS
+#define HNSWLIB_FIXED_DIMS 96, 128, 256, 384, 512, 768, 1024, 1536
+#endif
+
+// Early-abandoning kernels compare the running sum with the bound after this many dimensions.
+#ifndef HNSWLIB_EARLY_ABANDON_BLOCK
+#define HNSWLIB_EARLY_ABANDON_BLOCK 32
+#endif
+
+#if defined(_MSC_VER)
+#define HNSWLIB_FORCE_INLINE __forceinline
+#else
+#define HNSWLIB_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace hnswlib {
+
+// Thin wrappers over one instruction set, so a kernel can be written once as a
+// template and instantiated for every SIMD level. mul_add is a single FMA where
+// the instruction set has one.
+
+#if defined(USE_AVX512)
+struct SimdAVX512 {
+    typedef __m512 reg;
+    static const size_t width = 16;
+
+    static HNSWLIB_FORCE_INLINE reg zero() { return _mm512_setzero_ps(); }
+    static HNSWLIB_FORCE_INLINE reg load(const float *p) { return _mm512_loadu_ps(p); }
+    static HNSWLIB_FORCE_INLINE reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+    static HNSWLIB_FORCE_INLINE reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+    static HNSWLIB_FORCE_INLINE reg mul_add(reg a, reg b, reg acc) { return _mm512_fmadd_ps(a, b, acc); }
+    static HNSWLIB_FORCE_INLINE float reduce(reg v) { return _mm512_reduce_add_ps(v); }
+};
+#endif
+
+#if defined(USE_FMA)
+struct SimdFMA {
+    typedef __m256 reg;
+    static const size_t width = 8;
+
+    static HNSWLIB_FORCE_INLINE reg zero() { return _mm256_setzero_ps(); }
+    static HNSWLIB_FORCE_INLINE reg load(const float *p) { return _mm256_loadu_ps(p); }
+    static HNSWLIB_FORCE_INLINE reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    static HNSWLIB_FORCE_INLINE reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+    static HNSWLIB_FORCE_INLINE reg mul_add(reg a, reg b, reg acc) { return _mm256_fmadd_ps(a, b, acc); }
+    static HNSWLIB_FORCE_INLINE float reduce(reg v) { return HorizontalSumAVX(v); }
+};
+#endif
+
+#if defined(USE_AVX)
+struct SimdAVX {
+    typedef __m256 reg;
+    static const size_t width = 8;
+
+    static HNSWLIB_FORCE_INLINE reg zero() { return _mm256_setzero_ps(); }
+    static HNSWLIB_FORCE_INLINE reg load(const float *p) { return _mm256_loadu_ps(p); }
+    static HNSWLIB_FORCE_INLINE reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    static HNSWLIB_FORCE_INLINE reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+    static HNSWLIB_FORCE_INLINE reg mul_add(reg a, reg b, reg acc) { return _mm256_add_ps(acc, _mm256_mul_ps(a, b)); }
+    static HNSWLIB_FORCE_INLINE float reduce(reg v) { return HorizontalSumAVX(v); }
+};
+#endif
+
+#if defined(USE_SSE)
+struct SimdSSE {
+    typedef __m128 reg;
+    static const size_t width = 4;
+
+    static HNSWLIB_FORCE_INLINE reg zero() { return _mm_setzero_ps(); }
+    static HNSWLIB_FORCE_INLINE reg load(const float *p) { return _mm_loadu_ps(p); }
+    static HNSWLIB_FORCE_INLINE reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+    static HNSWLIB_FORCE_INLINE reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+    static HNSWLIB_FORCE_INLINE reg mul_add(reg a, reg b, reg acc) { return _mm_add_ps(acc, _mm_mul_ps(a, b)); }
+    static HNSWLIB_FORCE_INLINE float reduce(reg v) { return HorizontalSumSSE(v); }
+};
+#endif
+
+#if defined(USE_SSE)
+// Loop over BLOCKS register-wide blocks expanded at compile time: no trip counter,
+// no tail. Step::apply consumes one block, accumulators rotate over sum[0..3].
+template<typename Simd, size_t BLOCKS>
+struct SimdUnroll {
+    template<typename Step>
+    static HNSWLIB_FORCE_INLINE void run(const float *a, const float *b, typename Simd::reg *sum) {
+        SimdUnroll<Simd, BLOCKS - 1>::template run<Step>(a, b, sum);
+        Step::apply(a + (BLOCKS - 1) * Simd::width, b + (BLOCKS - 1) * Simd::width, sum[(BLOCKS - 1) % 4]);
+    }
+};
+
+template<typename Simd>
+struct SimdUnroll<Simd, 0> {
+    template<typename Step>
+    static HNSWLIB_FORCE_INLINE void run(const float *, const float *, typename Simd::reg *) {}
+};
+#endif
+
+
+// Per-metric steps shared by the templated kernels: a scalar and a register-wide
+// accumulate, and finalize to turn the accumulated sum into the distance.
+struct L2Metric {
+    static inline float accumulate(float a, float b, float sum) {
+        float t = a - b;
+        return sum + t * t;
+    }
+
+    template<typename Simd>
+    static HNSWLIB_FORCE_INLINE typename Simd::reg accumulate(typename Simd::reg a, typename Simd::reg b, typename Simd::reg sum) {
+        typename Simd::reg diff = Simd::sub(a, b);
+        return Simd::mul_add(diff, diff, sum);
+    }
+
+    static inline float finalize(float sum) {
+        return sum;
+    }
+};
+
+
+struct InnerProductMetric {
+    static inline float accumulate(float a, float b, float sum) {
+        return sum + a * b;
+    }
+
+    template<typename Simd>
+    static HNSWLIB_FORCE_INLINE typename Simd::reg accumulate(typename Simd::reg a, typename Simd::reg b, typename Simd::reg sum) {
+        return Simd::mul_add(a, b, sum);
+    }
+
+    static inline float finalize(float sum) {
+        return 1.0f - sum;
+    }
+};
+
+
+#if defined(USE_SSE)
+// Distances from one query to n vectors, four vectors at a time: every block of the
+// query is loaded once per group and the loads of the four vectors are independent.
+template<typename Metric, typename Simd>
+static void
+BatchDistance(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    const float *q = (const float *) query;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty_simd = qty / Simd::width * Simd::width;
+
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        const float *v0 = (const float *) vectors[j];
+        const float *v1 = (const float *) vectors[j + 1];
+        const float *v2 = (const float *) vectors[j + 2];
+        const float *v3 = (const float *) vectors[j + 3];
+        typename Simd::reg sum0 = Simd::zero(), sum1 = Simd::zero(), sum2 = Simd::zero(), sum3 = Simd::zero();
+        for (size_t i = 0; i < qty_simd; i += Simd::width) {
+            typename Simd::reg qi = Simd::load(q + i);
+            sum0 = Metric::template accumulate<Simd>(qi, Simd::load(v0 + i), sum0);
+            sum1 = Metric::template accumulate<Simd>(qi, Simd::load(v1 + i), sum1);
+            sum2 = Metric::template accumulate<Simd>(qi, Simd::load(v2 + i), sum2);
+            sum3 = Metric::template accumulate<Simd>(qi, Simd::load(v3 + i), sum3);
+        }
+        float res0 = Simd::reduce(sum0), res1 = Simd::reduce(sum1);
+        float res2 = Simd::reduce(sum2), res3 = Simd::reduce(sum3);
+        for (size_t i = qty_simd; i < qty; i++) {
+            res0 = Metric::accumulate(q[i], v0[i], res0);
+            res1 = Metric::accumulate(q[i], v1[i], res1);
+            res2 = Metric::accumulate(q[i], v2[i], res2);
+            res3 = Metric::accumulate(q[i], v3[i], res3);
+        }
+        out[j] = Metric::finalize(res0);
+        out[j + 1] = Metric::finalize(res1);
+        out[j + 2] = Metric::finalize(res2);
+        out[j + 3] = Metric::finalize(res3);
+    }
+    for (; j < n; j++) {
+        const float *v = (const float *) vectors[j];
+        typename Simd::reg sum = Simd::zero();
+        for (size_t i = 0; i < qty_simd; i += Simd::width) {
+            sum = Metric::template accumulate<Simd>(Simd::load(q + i), Simd::load(v + i), sum);
+        }
+        float res = Simd::reduce(sum);
+        for (size_t i = qty_simd; i < qty; i++) {
+            res = Metric::accumulate(q[i], v[i], res);
+        }
+        out[j] = Metric::finalize(res);
+    }
+}
+#endif
+
+}  // namespace hnswlib
@@ -0,0 +1,157 @@
+#pragma once
+#include "hnswlib.h"
+#include <stdint.h>
+
+namespace hnswlib {
+
+// Binary quantization: one bit per dimension, set when the value is positive, so a
+// stored vector takes dim / 8 bytes (32x less than float32). The distance is the
+// Hamming distance between the codes, queries are binarized once per search by
+// prepare_query. Works best with centered embeddings; pair with
+// HierarchicalNSW::setRerankSpace to re-rank the final candidates on the exact vectors.
+
+struct BinaryParam {
+    size_t dim;  // first member: getDataByLabel reads the dimension from the param
+    size_t words;  // 64-bit words per code
+};
+
+
+static inline uint64_t PopCount64(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+
+static float
+Hamming(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const uint64_t *pVect1 = (const uint64_t *) pVect1v;
+    const uint64_t *pVect2 = (const uint64_t *) pVect2v;
+    size_t words = ((const BinaryParam *) param_ptr)->words;
+
+    uint64_t res = 0;
+    for (size_t i = 0; i < words; i++) {
+        res += PopCount64(pVect1[i] ^ pVect2[i]);
+    }
+    return (float) res;
+}
+
+
+#if defined(USE_POPCNT)
+static float
+HammingPOPCNT(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const uint64_t *pVect1 = (const uint64_t *) pVect1v;
+    const uint64_t *pVect2 = (const uint64_t *) pVect2v;
+    size_t words = ((const BinaryParam *) param_ptr)->words;
+
+    uint64_t res0 = 0, res1 = 0;
+    size_t i = 0;
+    for (; i + 2 <= words; i += 2) {
+        res0 += _mm_popcnt_u64(pVect1[i] ^ pVect2[i]);
+        res1 += _mm_popcnt_u64(pVect1[i + 1] ^ pVect2[i + 1]);
+    }
+    if (i < words)
+        res0 += _mm_popcnt_u64(pVect1[i] ^ pVect2[i]);
+    return (float) (res0 + res1);
+}
+#endif
+
+
+#if defined(USE_AVX512_VPOPCNTDQ)
+static float
+HammingAVX512(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const uint64_t *pVect1 = (const uint64_t *) pVect1v;
+    const uint64_t *pVect2 = (const uint64_t *) pVect2v;
+    size_t words = ((const BinaryParam *) param_ptr)->words;
+
+    __m512i sum = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= words; i += 8) {
+        __m512i v1 = _mm512_loadu_si512(pVect1 + i);
+        __m512i v2 = _mm512_loadu_si512(pVect2 + i);
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_xor_si512(v1, v2)));
+    }
+    if (i < words) {  // masked load of the last (words % 8) words
+        __mmask8 mask = (__mmask8) ((1u << (words - i)) - 1);
+        __m512i v1 = _mm512_maskz_loadu_epi64(mask, pVect1 + i);
+        __m512i v2 = _mm512_maskz_loadu_epi64(mask, pVect2 + i);
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_xor_si512(v1, v2)));
+    }
+    return (float) _mm512_reduce_add_epi64(sum);
+}
+#endif
+
+
+static DISTFUNC<float> HammingSelectDistFunc() {
+#if defined(USE_AVX512_VPOPCNTDQ)
+    if (AVX512VPOPCNTDQCapable())
+        return HammingAVX512;
+#endif
+#if defined(USE_POPCNT)
+    if (POPCNTCapable())
+        return HammingPOPCNT;
+#endif
+    return Hamming;
+}
+
+
+class BinarySpace : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    BinaryParam param_;
+
+ public:
+    BinarySpace(size_t dim) {
+        fstdistfunc_ = HammingSelectDistFunc();
+        param_.dim = dim;
+        param_.words = (dim + 63) / 64;
+    }
+
+    size_t get_data_size() override {
+        return param_.words * sizeof(uint64_t);
+    }
+
+    DISTFUNC<float> get_dist_func() override {
+        return fstdistfunc_;
+    }
+
+    void *get_dist_func_param() override {
+        return &param_;
+    }
+
+    size_t get_input_size() override {
+        return param_.dim * sizeof(float);
+    }
+
+    // the query is binarized too, the kernel is the same as for stored codes
+    size_t get_query_state_size() override {
+        return get_data_size();
+    }
+
+    void prepare_query(const void *query, void *state) override {
+        encode(query, state);
+    }
+
+    void encode(const void *input, void *stored) override {
+        const float *src = (const float *) input;
+        uint64_t *code = (uint64_t *) stored;
+        memset(code, 0, get_data_size());
+        for (size_t i = 0; i < param_.dim; i++) {
+            if (src[i] > 0)
+                code[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+    }
+
+    // returns +1 / -1 per dimension
+    void decode(const void *stored, void *output) override {
+        const uint64_t *code = (const uint64_t *) stored;
+        float *dst = (float *) output;
+        for (size_t i = 0; i < param_.dim; i++) {
+            dst[i] = (code[i / 64] >> (i % 64)) & 1 ? 1.0f : -1.0f;
+        }
+    }
+
+    ~BinarySpace() {}
+};
+
+}  // namespace hnswlib
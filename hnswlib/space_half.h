@@ -0,0 +1,251 @@
+#pragma once
+#include "hnswlib.h"
+#include <stdint.h>
+
+namespace hnswlib {
+
+// Spaces that store vectors as 16-bit floats (IEEE half precision or bfloat16),
+// halving the memory and bandwidth of the level-0 data. Vectors are passed to
+// addPoint/searchKnn as 32-bit floats; queries are compared against the stored
+// vectors without being rounded.
+
+struct Float32 {
+    typedef float storage_t;
+
+    static inline float to_float(float f) {
+        return f;
+    }
+
+    template<typename Simd>
+    static HNSWLIB_FORCE_INLINE typename Simd::reg load(Simd, const float *p) {
+        return Simd::load(p);
+    }
+};
+
+
+struct Float16 {
+    typedef uint16_t storage_t;
+
+    static inline float to_float(uint16_t h) {
+        uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+        uint32_t exponent = (h >> 10) & 0x1f;
+        uint32_t mantissa = h & 0x3ff;
+        uint32_t bits;
+        if (exponent == 0x1f) {  // inf / nan
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else if (exponent != 0) {
+            bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+        } else if (mantissa == 0) {
+            bits = sign;
+        } else {  // subnormal, normalize it
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // rounds to nearest even, overflows to inf
+    static inline uint16_t from_float(float f) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        uint16_t sign = (bits >> 16) & 0x8000;
+        uint32_t abs = bits & 0x7fffffff;
+
+        if (abs > 0x7f800000)  // nan
+            return sign | 0x7e00;
+        if (abs >= 0x477ff000)  // rounds to a value above 65504
+            return sign | 0x7c00;
+        if (abs >= 0x38800000) {  // normal half
+            abs += 0xfff + ((abs >> 13) & 1);
+            return sign | (uint16_t) ((abs - (112u << 23)) >> 13);
+        }
+        if (abs < 0x33000000)  // below half of the smallest subnormal
+            return sign;
+
+        uint32_t shift = 126 - (abs >> 23);
+        uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | (uint16_t) half;
+    }
+
+#if defined(USE_AVX512)
+    static HNSWLIB_FORCE_INLINE __m512 load(SimdAVX512, const uint16_t *p) {
+        return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) p));
+    }
+#endif
+#if defined(USE_FMA) && defined(USE_F16C)
+    static HNSWLIB_FORCE_INLINE __m256 load(SimdFMA, const uint16_t *p) {
+        return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) p));
+    }
+#endif
+};
+
+
+struct BFloat16 {
+    typedef uint16_t storage_t;
+
+    static inline float to_float(uint16_t h) {
+        uint32_t bits = (uint32_t) h << 16;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // rounds to nearest even
+    static inline uint16_t from_float(float f) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        if ((bits & 0x7fffffff) > 0x7f800000)  // keep nan a (quiet) nan
+            return (uint16_t) ((bits >> 16) | 0x40);
+        bits += 0x7fff + ((bits >> 16) & 1);
+        return (uint16_t) (bits >> 16);
+    }
+
+#if defined(USE_AVX512)
+    static HNSWLIB_FORCE_INLINE __m512 load(SimdAVX512, const uint16_t *p) {
+        __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) p));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16));
+    }
+#endif
+#if defined(USE_FMA) && defined(USE_F16C)
+    static HNSWLIB_FORCE_INLINE __m256 load(SimdFMA, const uint16_t *p) {
+        // interleaving with zeros puts each value in the upper half of a 32-bit lane
+        __m128i raw = _mm_loadu_si128((const __m128i *) p);
+        __m128i lo = _mm_unpacklo_epi16(_mm_setzero_si128(), raw);
+        __m128i hi = _mm_unpackhi_epi16(_mm_setzero_si128(), raw);
+        return _mm256_castsi256_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+    }
+#endif
+};
+
+
+template<typename Metric, typename CodecA, typename CodecB>
+static float
+HalfDistance(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const typename CodecA::storage_t *pVect1 = (const typename CodecA::storage_t *) pVect1v;
+    const typename CodecB::storage_t *pVect2 = (const typename CodecB::storage_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        res = Metric::accumulate(CodecA::to_float(pVect1[i]), CodecB::to_float(pVect2[i]), res);
+    }
+    return Metric::finalize(res);
+}
+
+
+#if defined(USE_FMA) || defined(USE_AVX512)
+template<typename Metric, typename Simd, typename CodecA, typename CodecB>
+static float
+HalfDistanceSIMD(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const typename CodecA::storage_t *pVect1 = (const typename CodecA::storage_t *) pVect1v;
+    const typename CodecB::storage_t *pVect2 = (const typename CodecB::storage_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    const size_t width = Simd::width;
+
+    typename Simd::reg sum0 = Simd::zero();
+    typename Simd::reg sum1 = Simd::zero();
+    size_t i = 0;
+    for (; i + 2 * width <= qty; i += 2 * width) {
+        sum0 = Metric::template accumulate<Simd>(CodecA::load(Simd(), pVect1 + i), CodecB::load(Simd(), pVect2 + i), sum0);
+        sum1 = Metric::template accumulate<Simd>(
+            CodecA::load(Simd(), pVect1 + i + width), CodecB::load(Simd(), pVect2 + i + width), sum1);
+    }
+    if (i + width <= qty) {
+        sum0 = Metric::template accumulate<Simd>(CodecA::load(Simd(), pVect1 + i), CodecB::load(Simd(), pVect2 + i), sum0);
+        i += width;
+    }
+
+    float res = Simd::reduce(Simd::add(sum0, sum1));
+    for (; i < qty; i++) {
+        res = Metric::accumulate(CodecA::to_float(pVect1[i]), CodecB::to_float(pVect2[i]), res);
+    }
+    return Metric::finalize(res);
+}
+#endif
+
+
+template<typename Metric, typename CodecA, typename CodecB>
+static DISTFUNC<float> HalfSelectDistFunc() {
+#if defined(USE_AVX512)
+    if (getSIMDLevel() >= SIMD_AVX512)
+        return HalfDistanceSIMD<Metric, SimdAVX512, CodecA, CodecB>;
+#endif
+#if defined(USE_FMA) && defined(USE_F16C)
+    if (getSIMDLevel() >= SIMD_FMA && F16CCapable())
+        return HalfDistanceSIMD<Metric, SimdFMA, CodecA, CodecB>;
+#endif
+    return HalfDistance<Metric, CodecA, CodecB>;
+}
+
+
+template<typename Metric, typename Codec>
+class HalfPrecisionSpace : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    DISTFUNC<float> query_distfunc_;
+    size_t data_size_;
+    size_t dim_;
+
+ public:
+    HalfPrecisionSpace(size_t dim) {
+        fstdistfunc_ = HalfSelectDistFunc<Metric, Codec, Codec>();
+        query_distfunc_ = HalfSelectDistFunc<Metric, Float32, Codec>();
+        dim_ = dim;
+        data_size_ = dim * sizeof(typename Codec::storage_t);
+    }
+
+    size_t get_data_size() override {
+        return data_size_;
+    }
+
+    DISTFUNC<float> get_dist_func() override {
+        return fstdistfunc_;
+    }
+
+    DISTFUNC<float> get_query_dist_func() override {
+        return query_distfunc_;
+    }
+
+    void *get_dist_func_param() override {
+        return &dim_;
+    }
+
+    size_t get_input_size() override {
+        return dim_ * sizeof(float);
+    }
+
+    void encode(const void *input, void *stored) override {
+        const float *src = (const float *) input;
+        typename Codec::storage_t *dst = (typename Codec::storage_t *) stored;
+        for (size_t i = 0; i < dim_; i++) {
+            dst[i] = Codec::from_float(src[i]);
+        }
+    }
+
+    void decode(const void *stored, void *output) override {
+        const typename Codec::storage_t *src = (const typename Codec::storage_t *) stored;
+        float *dst = (float *) output;
+        for (size_t i = 0; i < dim_; i++) {
+            dst[i] = Codec::to_float(src[i]);
+        }
+    }
+
+    ~HalfPrecisionSpace() {}
+};
+
+typedef HalfPrecisionSpace<L2Metric, Float16> L2SpaceFP16;
+typedef HalfPrecisionSpace<L2Metric, BFloat16> L2SpaceBF16;
+typedef HalfPrecisionSpace<InnerProductMetric, Float16> InnerProductSpaceFP16;
+typedef HalfPrecisionSpace<InnerProductMetric, BFloat16> InnerProductSpaceBF16;
+
+}  // namespace hnswlib
@@ -18,12 +18,55 @@ InnerProductDistance(const void *pVect1, const void *pVect2, const void *qty_ptr
     return 1.0f - InnerProduct(pVect1, pVect2, qty_ptr);
 }
 
+#if defined(USE_FMA)
+
+// AVX2-era CPUs: 256-bit FMA with independent accumulators.
+static float
+InnerProductSIMD4ExtFMA(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    size_t qty16 = qty / 16;
+    size_t qty4 = qty / 4;
+
+    const float *pEnd1 = pVect1 + 16 * qty16;
+    const float *pEnd2 = pVect1 + 4 * qty4;
+
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+
+    while (pVect1 < pEnd1) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8), sum1);
+        pVect1 += 16;
+        pVect2 += 16;
+    }
+
+    sum0 = _mm256_add_ps(sum0, sum1);
+    __m128 sum_prod = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+
+    while (pVect1 < pEnd2) {
+        sum_prod = _mm_fmadd_ps(_mm_loadu_ps(pVect1), _mm_loadu_ps(pVect2), sum_prod);
+        pVect1 += 4;
+        pVect2 += 4;
+    }
+
+    return HorizontalSumSSE(sum_prod);
+}
+
+static float
+InnerProductDistanceSIMD4ExtFMA(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSIMD4ExtFMA(pVect1v, pVect2v, qty_ptr);
+}
+
+#endif
+
 #if defined(USE_AVX)
 
 // Favor using AVX if available.
 static float
 InnerProductSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
-    float PORTABLE_ALIGN32 TmpRes[8];
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
     size_t qty = *((size_t *) qty_ptr);
@@ -34,38 +77,26 @@ InnerProductSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qt
     const float *pEnd1 = pVect1 + 16 * qty16;
     const float *pEnd2 = pVect1 + 4 * qty4;
 
-    __m256 sum256 = _mm256_set1_ps(0);
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
 
     while (pVect1 < pEnd1) {
-        //_mm_prefetch((char*)(pVect2 + 16), _MM_HINT_T0);
-
-        __m256 v1 = _mm256_loadu_ps(pVect1);
-        pVect1 += 8;
-        __m256 v2 = _mm256_loadu_ps(pVect2);
-        pVect2 += 8;
-        sum256 = _mm256_add_ps(sum256, _mm256_mul_ps(v1, v2));
-
-        v1 = _mm256_loadu_ps(pVect1);
-        pVect1 += 8;
-        v2 = _mm256_loadu_ps(pVect2);
-        pVect2 += 8;
-        sum256 = _mm256_add_ps(sum256, _mm256_mul_ps(v1, v2));
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2)));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8)));
+        pVect1 += 16;
+        pVect2 += 16;
     }
 
-    __m128 v1, v2;
-    __m128 sum_prod = _mm_add_ps(_mm256_extractf128_ps(sum256, 0), _mm256_extractf128_ps(sum256, 1));
+    sum0 = _mm256_add_ps(sum0, sum1);
+    __m128 sum_prod = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
 
     while (pVect1 < pEnd2) {
-        v1 = _mm_loadu_ps(pVect1);
+        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(_mm_loadu_ps(pVect1), _mm_loadu_ps(pVect2)));
         pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
         pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
     }
 
-    _mm_store_ps(TmpRes, sum_prod);
-    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
-    return sum;
+    return HorizontalSumSSE(sum_prod);
 }
 
 static float
@@ -79,7 +110,6 @@ InnerProductDistanceSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const
 
 static float
 InnerProductSIMD4ExtSSE(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
-    float PORTABLE_ALIGN32 TmpRes[8];
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
     size_t qty = *((size_t *) qty_ptr);
@@ -90,47 +120,27 @@ InnerProductSIMD4ExtSSE(const void *pVect1v, const void *pVect2v, const void *qt
     const float *pEnd1 = pVect1 + 16 * qty16;
     const float *pEnd2 = pVect1 + 4 * qty4;
 
-    __m128 v1, v2;
-    __m128 sum_prod = _mm_set1_ps(0);
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    __m128 sum2 = _mm_setzero_ps();
+    __m128 sum3 = _mm_setzero_ps();
 
     while (pVect1 < pEnd1) {
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
-
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
-
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
-
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(pVect1), _mm_loadu_ps(pVect2)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(pVect1 + 4), _mm_loadu_ps(pVect2 + 4)));
+        sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_loadu_ps(pVect1 + 8), _mm_loadu_ps(pVect2 + 8)));
+        sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_loadu_ps(pVect1 + 12), _mm_loadu_ps(pVect2 + 12)));
+        pVect1 += 16;
+        pVect2 += 16;
     }
 
     while (pVect1 < pEnd2) {
-        v1 = _mm_loadu_ps(pVect1);
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(pVect1), _mm_loadu_ps(pVect2)));
         pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
         pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
     }
 
-    _mm_store_ps(TmpRes, sum_prod);
-    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
-
-    return sum;
+    return HorizontalSumSSE(_mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3)));
 }
 
 static float
@@ -145,62 +155,86 @@ InnerProductDistanceSIMD4ExtSSE(const void *pVect1v, const void *pVect2v, const
 
 static float
 InnerProductSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
-    float PORTABLE_ALIGN64 TmpRes[16];
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
     size_t qty = *((size_t *) qty_ptr);
 
     size_t qty16 = qty / 16;
 
-
     const float *pEnd1 = pVect1 + 16 * qty16;
+    const float *pEnd4 = pVect1 + 64 * (qty16 / 4);
+
+    // independent accumulators, a single one serializes on the FMA latency
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps();
+    __m512 sum3 = _mm512_setzero_ps();
+
+    while (pVect1 < pEnd4) {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1), _mm512_loadu_ps(pVect2), sum0);
+        sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + 16), _mm512_loadu_ps(pVect2 + 16), sum1);
+        sum2 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + 32), _mm512_loadu_ps(pVect2 + 32), sum2);
+        sum3 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1 + 48), _mm512_loadu_ps(pVect2 + 48), sum3);
+        pVect1 += 64;
+        pVect2 += 64;
+    }
 
-    __m512 sum512 = _mm512_set1_ps(0);
-
-    size_t loop = qty16 / 4;
-    
-    while (loop--) {
-        __m512 v1 = _mm512_loadu_ps(pVect1);
-        __m512 v2 = _mm512_loadu_ps(pVect2);
+    while (pVect1 < pEnd1) {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(pVect1), _mm512_loadu_ps(pVect2), sum0);
         pVect1 += 16;
         pVect2 += 16;
+    }
 
-        __m512 v3 = _mm512_loadu_ps(pVect1);
-        __m512 v4 = _mm512_loadu_ps(pVect2);
-        pVect1 += 16;
-        pVect2 += 16;
+    sum0 = _mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3));
+    return _mm512_reduce_add_ps(sum0);
+}
 
-        __m512 v5 = _mm512_loadu_ps(pVect1);
-        __m512 v6 = _mm512_loadu_ps(pVect2);
-        pVect1 += 16;
-        pVect2 += 16;
+static float
+InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSIMD16ExtAVX512(pVect1v, pVect2v, qty_ptr);
+}
 
-        __m512 v7 = _mm512_loadu_ps(pVect1);
-        __m512 v8 = _mm512_loadu_ps(pVect2);
-        pVect1 += 16;
-        pVect2 += 16;
+#endif
 
-        sum512 = _mm512_fmadd_ps(v1, v2, sum512);
-        sum512 = _mm512_fmadd_ps(v3, v4, sum512);
-        sum512 = _mm512_fmadd_ps(v5, v6, sum512);
-        sum512 = _mm512_fmadd_ps(v7, v8, sum512);
+#if defined(USE_FMA)
+
+static float
+InnerProductSIMD16ExtFMA(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    size_t qty16 = qty / 16;
+
+    const float *pEnd1 = pVect1 + 16 * qty16;
+    const float *pEnd2 = pVect1 + 32 * (qty16 / 2);
+
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    __m256 sum3 = _mm256_setzero_ps();
+
+    while (pVect1 < pEnd2) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8), sum1);
+        sum2 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + 16), _mm256_loadu_ps(pVect2 + 16), sum2);
+        sum3 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + 24), _mm256_loadu_ps(pVect2 + 24), sum3);
+        pVect1 += 32;
+        pVect2 += 32;
     }
 
-    while (pVect1 < pEnd1) {
-        __m512 v1 = _mm512_loadu_ps(pVect1);
-        __m512 v2 = _mm512_loadu_ps(pVect2);
-        pVect1 += 16;
-        pVect2 += 16;
-        sum512 = _mm512_fmadd_ps(v1, v2, sum512);
+    if (pVect1 < pEnd1) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8), sum1);
     }
 
-    float sum = _mm512_reduce_add_ps(sum512);
-    return sum;
+    sum0 = _mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3));
+    return HorizontalSumAVX(sum0);
 }
 
 static float
-InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
-    return 1.0f - InnerProductSIMD16ExtAVX512(pVect1v, pVect2v, qty_ptr);
+InnerProductDistanceSIMD16ExtFMA(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSIMD16ExtFMA(pVect1v, pVect2v, qty_ptr);
 }
 
 #endif
@@ -209,38 +243,25 @@ InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, co
 
 static float
 InnerProductSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
-    float PORTABLE_ALIGN32 TmpRes[8];
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
     size_t qty = *((size_t *) qty_ptr);
 
     size_t qty16 = qty / 16;
 
-
     const float *pEnd1 = pVect1 + 16 * qty16;
 
-    __m256 sum256 = _mm256_set1_ps(0);
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
 
     while (pVect1 < pEnd1) {
-        //_mm_prefetch((char*)(pVect2 + 16), _MM_HINT_T0);
-
-        __m256 v1 = _mm256_loadu_ps(pVect1);
-        pVect1 += 8;
-        __m256 v2 = _mm256_loadu_ps(pVect2);
-        pVect2 += 8;
-        sum256 = _mm256_add_ps(sum256, _mm256_mul_ps(v1, v2));
-
-        v1 = _mm256_loadu_ps(pVect1);
-        pVect1 += 8;
-        v2 = _mm256_loadu_ps(pVect2);
-        pVect2 += 8;
-        sum256 = _mm256_add_ps(sum256, _mm256_mul_ps(v1, v2));
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2)));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8)));
+        pVect1 += 16;
+        pVect2 += 16;
     }
 
-    _mm256_store_ps(TmpRes, sum256);
-    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
-
-    return sum;
+    return HorizontalSumAVX(_mm256_add_ps(sum0, sum1));
 }
 
 static float
@@ -254,7 +275,6 @@ InnerProductDistanceSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const
 
 static float
 InnerProductSIMD16ExtSSE(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
-    float PORTABLE_ALIGN32 TmpRes[8];
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
     size_t qty = *((size_t *) qty_ptr);
@@ -263,38 +283,21 @@ InnerProductSIMD16ExtSSE(const void *pVect1v, const void *pVect2v, const void *q
 
     const float *pEnd1 = pVect1 + 16 * qty16;
 
-    __m128 v1, v2;
-    __m128 sum_prod = _mm_set1_ps(0);
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    __m128 sum2 = _mm_setzero_ps();
+    __m128 sum3 = _mm_setzero_ps();
 
     while (pVect1 < pEnd1) {
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
-
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
-
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
-
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(pVect1), _mm_loadu_ps(pVect2)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(pVect1 + 4), _mm_loadu_ps(pVect2 + 4)));
+        sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_loadu_ps(pVect1 + 8), _mm_loadu_ps(pVect2 + 8)));
+        sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_loadu_ps(pVect1 + 12), _mm_loadu_ps(pVect2 + 12)));
+        pVect1 += 16;
+        pVect2 += 16;
     }
-    _mm_store_ps(TmpRes, sum_prod);
-    float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
 
-    return sum;
+    return HorizontalSumSSE(_mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3)));
 }
 
 static float
@@ -305,11 +308,7 @@ InnerProductDistanceSIMD16ExtSSE(const void *pVect1v, const void *pVect2v, const
 #endif
 
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
-static DISTFUNC<float> InnerProductSIMD16Ext = InnerProductSIMD16ExtSSE;
-static DISTFUNC<float> InnerProductSIMD4Ext = InnerProductSIMD4ExtSSE;
-static DISTFUNC<float> InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtSSE;
-static DISTFUNC<float> InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtSSE;
-
+template<DISTFUNC<float> InnerProductSIMD16Ext>
 static float
 InnerProductDistanceSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     size_t qty = *((size_t *) qty_ptr);
@@ -323,6 +322,7 @@ InnerProductDistanceSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v,
     return 1.0f - (res + res_tail);
 }
 
+template<DISTFUNC<float> InnerProductSIMD4Ext>
 static float
 InnerProductDistanceSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     size_t qty = *((size_t *) qty_ptr);
@@ -339,45 +339,94 @@ InnerProductDistanceSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v,
 }
 #endif
 
+#if defined(USE_SSE)
+template<typename Simd>
+struct InnerProductStep {
+    static HNSWLIB_FORCE_INLINE void apply(const float *a, const float *b, typename Simd::reg &sum) {
+        sum = Simd::mul_add(Simd::load(a), Simd::load(b), sum);
+    }
+};
+
+// The dimension is a template argument, the third argument is not read.
+template<typename Simd, size_t DIM>
+static float
+InnerProductDistanceFixedDim(const void *pVect1v, const void *pVect2v, const void *) {
+    static_assert(DIM % Simd::width == 0, "fixed dimension must be a multiple of the register width");
+    typename Simd::reg sum[4] = {Simd::zero(), Simd::zero(), Simd::zero(), Simd::zero()};
+    SimdUnroll<Simd, DIM / Simd::width>::template run<InnerProductStep<Simd>>(
+        (const float *) pVect1v, (const float *) pVect2v, sum);
+    return 1.0f - Simd::reduce(Simd::add(Simd::add(sum[0], sum[1]), Simd::add(sum[2], sum[3])));
+}
+
+template<typename Simd, size_t... DIMS>
+static void InnerProductDistanceSetFixedDims(DistFuncTable<float> &table) {
+    table.fixed_dim = {std::make_pair(DIMS, &InnerProductDistanceFixedDim<Simd, DIMS>)...};
+}
+#endif
+
+static DistFuncTable<float> InnerProductDistanceBuildDistFuncTable() {
+    DistFuncTable<float> table;
+    table.generic = InnerProductDistance;
+#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+    table.simd16 = InnerProductDistanceSIMD16ExtSSE;
+    table.simd16_residuals = InnerProductDistanceSIMD16ExtResiduals<InnerProductSIMD16ExtSSE>;
+    table.simd4 = InnerProductDistanceSIMD4ExtSSE;
+    table.simd4_residuals = InnerProductDistanceSIMD4ExtResiduals<InnerProductSIMD4ExtSSE>;
+    InnerProductDistanceSetFixedDims<SimdSSE, HNSWLIB_FIXED_DIMS>(table);
+    table.batch = BatchDistance<InnerProductMetric, SimdSSE>;
+    table.batch_min_dim = SimdSSE::width;
+    #if defined(USE_AVX)
+    SIMDLevel simd_level = getSIMDLevel();
+    if (simd_level >= SIMD_AVX) {
+        table.simd16 = InnerProductDistanceSIMD16ExtAVX;
+        table.simd16_residuals = InnerProductDistanceSIMD16ExtResiduals<InnerProductSIMD16ExtAVX>;
+        InnerProductDistanceSetFixedDims<SimdAVX, HNSWLIB_FIXED_DIMS>(table);
+        table.batch = BatchDistance<InnerProductMetric, SimdAVX>;
+        table.batch_min_dim = SimdAVX::width;
+        table.simd4 = InnerProductDistanceSIMD4ExtAVX;
+        table.simd4_residuals = InnerProductDistanceSIMD4ExtResiduals<InnerProductSIMD4ExtAVX>;
+    }
+    #endif
+    #if defined(USE_FMA)
+    if (simd_level >= SIMD_FMA) {
+        table.simd16 = InnerProductDistanceSIMD16ExtFMA;
+        table.simd16_residuals = InnerProductDistanceSIMD16ExtResiduals<InnerProductSIMD16ExtFMA>;
+        InnerProductDistanceSetFixedDims<SimdFMA, HNSWLIB_FIXED_DIMS>(table);
+        table.batch = BatchDistance<InnerProductMetric, SimdFMA>;
+        table.batch_min_dim = SimdFMA::width;
+        table.simd4 = InnerProductDistanceSIMD4ExtFMA;
+        table.simd4_residuals = InnerProductDistanceSIMD4ExtResiduals<InnerProductSIMD4ExtFMA>;
+    }
+    #endif
+    #if defined(USE_AVX512)
+    if (simd_level >= SIMD_AVX512) {
+        table.simd16 = InnerProductDistanceSIMD16ExtAVX512;
+        table.simd16_residuals = InnerProductDistanceSIMD16ExtResiduals<InnerProductSIMD16ExtAVX512>;
+        InnerProductDistanceSetFixedDims<SimdAVX512, HNSWLIB_FIXED_DIMS>(table);
+        table.batch = BatchDistance<InnerProductMetric, SimdAVX512>;
+        table.batch_min_dim = SimdAVX512::width;
+    }
+    #endif
+#endif
+    return table;
+}
+
+// Built on first use, shared by all inner product spaces afterwards
+static const DistFuncTable<float> &InnerProductDistanceDistFuncTable() {
+    static const DistFuncTable<float> table = InnerProductDistanceBuildDistFuncTable();
+    return table;
+}
+
 class InnerProductSpace : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    DISTFUNC_BATCH<float> batchdistfunc_;
     size_t data_size_;
     size_t dim_;
 
  public:
     InnerProductSpace(size_t dim) {
-        fstdistfunc_ = InnerProductDistance;
-#if defined(USE_AVX) || defined(USE_SSE) || defined(USE_AVX512)
-    #if defined(USE_AVX512)
-        if (AVX512Capable()) {
-            InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX512;
-            InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX512;
-        } else if (AVXCapable()) {
-            InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
-            InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
-        }
-    #elif defined(USE_AVX)
-        if (AVXCapable()) {
-            InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
-            InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
-        }
-    #endif
-    #if defined(USE_AVX)
-        if (AVXCapable()) {
-            InnerProductSIMD4Ext = InnerProductSIMD4ExtAVX;
-            InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtAVX;
-        }
-    #endif
-
-        if (dim % 16 == 0)
-            fstdistfunc_ = InnerProductDistanceSIMD16Ext;
-        else if (dim % 4 == 0)
-            fstdistfunc_ = InnerProductDistanceSIMD4Ext;
-        else if (dim > 16)
-            fstdistfunc_ = InnerProductDistanceSIMD16ExtResiduals;
-        else if (dim > 4)
-            fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
-#endif
+        fstdistfunc_ = InnerProductDistanceDistFuncTable().select(dim);
+        batchdistfunc_ = InnerProductDistanceDistFuncTable().select_batch(dim);
         dim_ = dim;
         data_size_ = dim * sizeof(float);
     }
@@ -390,6 +439,10 @@ class InnerProductSpace : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    DISTFUNC_BATCH<float> get_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
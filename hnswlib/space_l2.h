@@ -22,36 +22,91 @@ L2Sqr(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
 #if defined(USE_AVX512)
 
 // Favor using AVX512 if available.
+// Four independent accumulators keep the FMA units busy instead of waiting on one dependency chain.
 static float
 L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
     size_t qty = *((size_t *) qty_ptr);
-    float PORTABLE_ALIGN64 TmpRes[16];
     size_t qty16 = qty >> 4;
 
     const float *pEnd1 = pVect1 + (qty16 << 4);
-
-    __m512 diff, v1, v2;
-    __m512 sum = _mm512_set1_ps(0);
+    const float *pEnd4 = pVect1 + ((qty16 >> 2) << 6);
+
+    __m512 diff0, diff1, diff2, diff3;
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps();
+    __m512 sum3 = _mm512_setzero_ps();
+
+    while (pVect1 < pEnd4) {
+        diff0 = _mm512_sub_ps(_mm512_loadu_ps(pVect1), _mm512_loadu_ps(pVect2));
+        diff1 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + 16), _mm512_loadu_ps(pVect2 + 16));
+        diff2 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + 32), _mm512_loadu_ps(pVect2 + 32));
+        diff3 = _mm512_sub_ps(_mm512_loadu_ps(pVect1 + 48), _mm512_loadu_ps(pVect2 + 48));
+        pVect1 += 64;
+        pVect2 += 64;
+        sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm512_fmadd_ps(diff1, diff1, sum1);
+        sum2 = _mm512_fmadd_ps(diff2, diff2, sum2);
+        sum3 = _mm512_fmadd_ps(diff3, diff3, sum3);
+    }
 
     while (pVect1 < pEnd1) {
-        v1 = _mm512_loadu_ps(pVect1);
+        diff0 = _mm512_sub_ps(_mm512_loadu_ps(pVect1), _mm512_loadu_ps(pVect2));
         pVect1 += 16;
-        v2 = _mm512_loadu_ps(pVect2);
         pVect2 += 16;
-        diff = _mm512_sub_ps(v1, v2);
-        // sum = _mm512_fmadd_ps(diff, diff, sum);
-        sum = _mm512_add_ps(sum, _mm512_mul_ps(diff, diff));
+        sum0 = _mm512_fmadd_ps(diff0, diff0, sum0);
     }
 
-    _mm512_store_ps(TmpRes, sum);
-    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] +
-            TmpRes[7] + TmpRes[8] + TmpRes[9] + TmpRes[10] + TmpRes[11] + TmpRes[12] +
-            TmpRes[13] + TmpRes[14] + TmpRes[15];
+    sum0 = _mm512_add_ps(_mm512_add_ps(sum0, sum1), _mm512_add_ps(sum2, sum3));
+    return _mm512_reduce_add_ps(sum0);
+}
+#endif
+
+#if defined(USE_FMA)
 
-    return (res);
+// AVX2-era CPUs: 256-bit FMA, two 16-float blocks per iteration.
+static float
+L2SqrSIMD16ExtFMA(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4;
+
+    const float *pEnd1 = pVect1 + (qty16 << 4);
+    const float *pEnd2 = pVect1 + ((qty16 >> 1) << 5);
+
+    __m256 diff0, diff1, diff2, diff3;
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps();
+    __m256 sum3 = _mm256_setzero_ps();
+
+    while (pVect1 < pEnd2) {
+        diff0 = _mm256_sub_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2));
+        diff1 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8));
+        diff2 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + 16), _mm256_loadu_ps(pVect2 + 16));
+        diff3 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + 24), _mm256_loadu_ps(pVect2 + 24));
+        pVect1 += 32;
+        pVect2 += 32;
+        sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+        sum2 = _mm256_fmadd_ps(diff2, diff2, sum2);
+        sum3 = _mm256_fmadd_ps(diff3, diff3, sum3);
+    }
+
+    if (pVect1 < pEnd1) {
+        diff0 = _mm256_sub_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2));
+        diff1 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8));
+        sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+    }
+
+    sum0 = _mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3));
+    return HorizontalSumAVX(sum0);
 }
+
 #endif
 
 #if defined(USE_AVX)
@@ -62,32 +117,24 @@ L2SqrSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
     size_t qty = *((size_t *) qty_ptr);
-    float PORTABLE_ALIGN32 TmpRes[8];
     size_t qty16 = qty >> 4;
 
     const float *pEnd1 = pVect1 + (qty16 << 4);
 
-    __m256 diff, v1, v2;
-    __m256 sum = _mm256_set1_ps(0);
+    __m256 diff0, diff1;
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
 
     while (pVect1 < pEnd1) {
-        v1 = _mm256_loadu_ps(pVect1);
-        pVect1 += 8;
-        v2 = _mm256_loadu_ps(pVect2);
-        pVect2 += 8;
-        diff = _mm256_sub_ps(v1, v2);
-        sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
-
-        v1 = _mm256_loadu_ps(pVect1);
-        pVect1 += 8;
-        v2 = _mm256_loadu_ps(pVect2);
-        pVect2 += 8;
-        diff = _mm256_sub_ps(v1, v2);
-        sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+        diff0 = _mm256_sub_ps(_mm256_loadu_ps(pVect1), _mm256_loadu_ps(pVect2));
+        diff1 = _mm256_sub_ps(_mm256_loadu_ps(pVect1 + 8), _mm256_loadu_ps(pVect2 + 8));
+        pVect1 += 16;
+        pVect2 += 16;
+        sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(diff0, diff0));
+        sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(diff1, diff1));
     }
 
-    _mm256_store_ps(TmpRes, sum);
-    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+    return HorizontalSumAVX(_mm256_add_ps(sum0, sum1));
 }
 
 #endif
@@ -99,53 +146,36 @@ L2SqrSIMD16ExtSSE(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
     size_t qty = *((size_t *) qty_ptr);
-    float PORTABLE_ALIGN32 TmpRes[8];
     size_t qty16 = qty >> 4;
 
     const float *pEnd1 = pVect1 + (qty16 << 4);
 
-    __m128 diff, v1, v2;
-    __m128 sum = _mm_set1_ps(0);
+    __m128 diff0, diff1, diff2, diff3;
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    __m128 sum2 = _mm_setzero_ps();
+    __m128 sum3 = _mm_setzero_ps();
 
     while (pVect1 < pEnd1) {
-        //_mm_prefetch((char*)(pVect2 + 16), _MM_HINT_T0);
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        diff = _mm_sub_ps(v1, v2);
-        sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
-
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        diff = _mm_sub_ps(v1, v2);
-        sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
-
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        diff = _mm_sub_ps(v1, v2);
-        sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
-
-        v1 = _mm_loadu_ps(pVect1);
-        pVect1 += 4;
-        v2 = _mm_loadu_ps(pVect2);
-        pVect2 += 4;
-        diff = _mm_sub_ps(v1, v2);
-        sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+        diff0 = _mm_sub_ps(_mm_loadu_ps(pVect1), _mm_loadu_ps(pVect2));
+        diff1 = _mm_sub_ps(_mm_loadu_ps(pVect1 + 4), _mm_loadu_ps(pVect2 + 4));
+        diff2 = _mm_sub_ps(_mm_loadu_ps(pVect1 + 8), _mm_loadu_ps(pVect2 + 8));
+        diff3 = _mm_sub_ps(_mm_loadu_ps(pVect1 + 12), _mm_loadu_ps(pVect2 + 12));
+        pVect1 += 16;
+        pVect2 += 16;
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(diff0, diff0));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(diff1, diff1));
+        sum2 = _mm_add_ps(sum2, _mm_mul_ps(diff2, diff2));
+        sum3 = _mm_add_ps(sum3, _mm_mul_ps(diff3, diff3));
     }
 
-    _mm_store_ps(TmpRes, sum);
-    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+    return HorizontalSumSSE(_mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3)));
 }
 #endif
 
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
-static DISTFUNC<float> L2SqrSIMD16Ext = L2SqrSIMD16ExtSSE;
-
+// The 16-float kernel is a template argument, so every instruction set gets its own residuals function
+template<DISTFUNC<float> L2SqrSIMD16Ext>
 static float
 L2SqrSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     size_t qty = *((size_t *) qty_ptr);
@@ -164,7 +194,6 @@ L2SqrSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qt
 #if defined(USE_SSE)
 static float
 L2SqrSIMD4Ext(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
-    float PORTABLE_ALIGN32 TmpRes[8];
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
     size_t qty = *((size_t *) qty_ptr);
@@ -185,8 +214,7 @@ L2SqrSIMD4Ext(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
         diff = _mm_sub_ps(v1, v2);
         sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
     }
-    _mm_store_ps(TmpRes, sum);
-    return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+    return HorizontalSumSSE(sum);
 }
 
 static float
@@ -205,34 +233,130 @@ L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty
 }
 #endif
 
+#if defined(USE_SSE)
+template<typename Simd>
+struct L2SqrStep {
+    static HNSWLIB_FORCE_INLINE void apply(const float *a, const float *b, typename Simd::reg &sum) {
+        typename Simd::reg diff = Simd::sub(Simd::load(a), Simd::load(b));
+        sum = Simd::mul_add(diff, diff, sum);
+    }
+};
+
+// The dimension is a template argument, the third argument is not read.
+template<typename Simd, size_t DIM>
+static float
+L2SqrFixedDim(const void *pVect1v, const void *pVect2v, const void *) {
+    static_assert(DIM % Simd::width == 0, "fixed dimension must be a multiple of the register width");
+    typename Simd::reg sum[4] = {Simd::zero(), Simd::zero(), Simd::zero(), Simd::zero()};
+    SimdUnroll<Simd, DIM / Simd::width>::template run<L2SqrStep<Simd>>((const float *) pVect1v, (const float *) pVect2v, sum);
+    return Simd::reduce(Simd::add(Simd::add(sum[0], sum[1]), Simd::add(sum[2], sum[3])));
+}
+
+template<typename Simd, size_t... DIMS>
+static void L2SqrSetFixedDims(DistFuncTable<float> &table) {
+    table.fixed_dim = {std::make_pair(DIMS, &L2SqrFixedDim<Simd, DIMS>)...};
+}
+
+// Gives up once the running sum exceeds bound. The sum is checked after every
+// HNSWLIB_EARLY_ABANDON_BLOCK dimensions, each block is unrolled at compile time.
+template<typename Simd>
+static float
+L2SqrBounded(const void *pVect1v, const void *pVect2v, const void *qty_ptr, float bound) {
+    static_assert(HNSWLIB_EARLY_ABANDON_BLOCK % Simd::width == 0, "the block must be a multiple of the register width");
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    typename Simd::reg sum[4] = {Simd::zero(), Simd::zero(), Simd::zero(), Simd::zero()};
+    size_t i = 0;
+    for (; i + HNSWLIB_EARLY_ABANDON_BLOCK <= qty; i += HNSWLIB_EARLY_ABANDON_BLOCK) {
+        SimdUnroll<Simd, HNSWLIB_EARLY_ABANDON_BLOCK / Simd::width>::template run<L2SqrStep<Simd>>(pVect1 + i, pVect2 + i, sum);
+        float res = Simd::reduce(Simd::add(Simd::add(sum[0], sum[1]), Simd::add(sum[2], sum[3])));
+        if (res > bound)
+            return res;
+    }
+    for (; i + Simd::width <= qty; i += Simd::width) {
+        L2SqrStep<Simd>::apply(pVect1 + i, pVect2 + i, sum[0]);
+    }
+    float res = Simd::reduce(Simd::add(Simd::add(sum[0], sum[1]), Simd::add(sum[2], sum[3])));
+    for (; i < qty; i++) {
+        float t = pVect1[i] - pVect2[i];
+        res += t * t;
+    }
+    return res;
+}
+#endif
+
+static DistFuncTable<float> L2SqrBuildDistFuncTable() {
+    DistFuncTable<float> table;
+    table.generic = L2Sqr;
+#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+    table.simd16 = L2SqrSIMD16ExtSSE;
+    table.simd16_residuals = L2SqrSIMD16ExtResiduals<L2SqrSIMD16ExtSSE>;
+    table.simd4 = L2SqrSIMD4Ext;
+    table.simd4_residuals = L2SqrSIMD4ExtResiduals;
+    L2SqrSetFixedDims<SimdSSE, HNSWLIB_FIXED_DIMS>(table);
+    table.batch = BatchDistance<L2Metric, SimdSSE>;
+    table.batch_min_dim = SimdSSE::width;
+    table.bounded = L2SqrBounded<SimdSSE>;
+    // with fewer dimensions there is at most one check before the end
+    table.bounded_min_dim = 2 * HNSWLIB_EARLY_ABANDON_BLOCK;
+    #if defined(USE_AVX)
+    SIMDLevel simd_level = getSIMDLevel();
+    if (simd_level >= SIMD_AVX) {
+        table.simd16 = L2SqrSIMD16ExtAVX;
+        table.simd16_residuals = L2SqrSIMD16ExtResiduals<L2SqrSIMD16ExtAVX>;
+        L2SqrSetFixedDims<SimdAVX, HNSWLIB_FIXED_DIMS>(table);
+        table.batch = BatchDistance<L2Metric, SimdAVX>;
+        table.batch_min_dim = SimdAVX::width;
+        table.bounded = L2SqrBounded<SimdAVX>;
+    }
+    #endif
+    #if defined(USE_FMA)
+    if (simd_level >= SIMD_FMA) {
+        table.simd16 = L2SqrSIMD16ExtFMA;
+        table.simd16_residuals = L2SqrSIMD16ExtResiduals<L2SqrSIMD16ExtFMA>;
+        L2SqrSetFixedDims<SimdFMA, HNSWLIB_FIXED_DIMS>(table);
+        table.batch = BatchDistance<L2Metric, SimdFMA>;
+        table.batch_min_dim = SimdFMA::width;
+        table.bounded = L2SqrBounded<SimdFMA>;
+    }
+    #endif
+    #if defined(USE_AVX512)
+    if (simd_level >= SIMD_AVX512) {
+        table.simd16 = L2SqrSIMD16ExtAVX512;
+        table.simd16_residuals = L2SqrSIMD16ExtResiduals<L2SqrSIMD16ExtAVX512>;
+        L2SqrSetFixedDims<SimdAVX512, HNSWLIB_FIXED_DIMS>(table);
+        table.batch = BatchDistance<L2Metric, SimdAVX512>;
+        table.batch_min_dim = SimdAVX512::width;
+        table.bounded = L2SqrBounded<SimdAVX512>;
+    }
+    #endif
+#endif
+    return table;
+}
+
+// Built on first use, shared by all L2 spaces afterwards
+static const DistFuncTable<float> &L2SqrDistFuncTable() {
+    static const DistFuncTable<float> table = L2SqrBuildDistFuncTable();
+    return table;
+}
+
 class L2Space : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    DISTFUNC_BATCH<float> batchdistfunc_;
+    DISTFUNC_BOUNDED<float> boundeddistfunc_;
     size_t data_size_;
     size_t dim_;
 
  public:
-    L2Space(size_t dim) {
-        fstdistfunc_ = L2Sqr;
-#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
-    #if defined(USE_AVX512)
-        if (AVX512Capable())
-            L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX512;
-        else if (AVXCapable())
-            L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
-    #elif defined(USE_AVX)
-        if (AVXCapable())
-            L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
-    #endif
-
-        if (dim % 16 == 0)
-            fstdistfunc_ = L2SqrSIMD16Ext;
-        else if (dim % 4 == 0)
-            fstdistfunc_ = L2SqrSIMD4Ext;
-        else if (dim > 16)
-            fstdistfunc_ = L2SqrSIMD16ExtResiduals;
-        else if (dim > 4)
-            fstdistfunc_ = L2SqrSIMD4ExtResiduals;
-#endif
+    // early_abandon makes the index compute neighbor distances one at a time with
+    // the bounded kernel instead of in batches. It only pays off when most
+    // candidates are far above the current bound, so measure on your data first.
+    L2Space(size_t dim, bool early_abandon = false) {
+        fstdistfunc_ = L2SqrDistFuncTable().select(dim);
+        batchdistfunc_ = L2SqrDistFuncTable().select_batch(dim);
+        boundeddistfunc_ = early_abandon ? L2SqrDistFuncTable().select_bounded(dim) : nullptr;
         dim_ = dim;
         data_size_ = dim * sizeof(float);
     }
@@ -245,6 +369,14 @@ class L2Space : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    DISTFUNC_BATCH<float> get_batch_dist_func() {
+        return batchdistfunc_;
+    }
+
+    DISTFUNC_BOUNDED<float> get_bounded_dist_func() {
+        return boundeddistfunc_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
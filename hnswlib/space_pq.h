@@ -0,0 +1,275 @@
+#pragma once
+#include "hnswlib.h"
+#include <stdint.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <random>
+
+namespace hnswlib {
+
+// Product quantization. A vector is split into M sub-vectors of dim / M floats and
+// each sub-vector is replaced by the index of its nearest centroid in a 256-entry
+// codebook trained with k-means, so a stored vector takes M bytes.
+//
+// Searches use asymmetric distances: prepare_query builds a table with the distance
+// from every query sub-vector to every centroid, and a distance to a stored vector
+// is the sum of M table lookups. Distances between two stored vectors (used while
+// building the graph) come from a centroid-to-centroid table computed at training.
+
+struct PQParam {
+    size_t dim;  // first member: getDataByLabel reads the dimension from the param
+    size_t M;
+    const float *centroid_dist;  // M x 256 x 256
+};
+
+
+static const size_t PQ_KSUB = 256;
+
+
+template<typename Metric>
+static float
+PQDistance(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const uint8_t *pVect1 = (const uint8_t *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+    const PQParam *param = (const PQParam *) param_ptr;
+
+    float res = 0;
+    const float *table = param->centroid_dist;
+    for (size_t m = 0; m < param->M; m++) {
+        res += table[(pVect1[m] << 8) + pVect2[m]];
+        table += PQ_KSUB * PQ_KSUB;
+    }
+    return Metric::finalize(res);
+}
+
+
+// The query is the lookup table built by prepare_query: M rows of 256 partial distances.
+template<typename Metric>
+static float
+PQTableDistance(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const float *table = (const float *) pVect1v;
+    const uint8_t *code = (const uint8_t *) pVect2v;
+    size_t M = ((const PQParam *) param_ptr)->M;
+
+    // independent sums so the lookups do not wait on each other
+    float res0 = 0, res1 = 0, res2 = 0, res3 = 0;
+    size_t m = 0;
+    for (; m + 4 <= M; m += 4) {
+        res0 += table[code[m] + m * PQ_KSUB];
+        res1 += table[code[m + 1] + (m + 1) * PQ_KSUB];
+        res2 += table[code[m + 2] + (m + 2) * PQ_KSUB];
+        res3 += table[code[m + 3] + (m + 3) * PQ_KSUB];
+    }
+    for (; m < M; m++) {
+        res0 += table[code[m] + m * PQ_KSUB];
+    }
+    return Metric::finalize((res0 + res1) + (res2 + res3));
+}
+
+
+template<typename Metric>
+class PQSpace : public SpaceInterface<float> {
+    size_t dsub_;
+    std::vector<float> centroids_;  // M x 256 x dsub
+    std::vector<float> centroid_dist_;
+    PQParam param_;
+    bool trained_;
+
+    const float *centroid(size_t m, size_t k) const {
+        return centroids_.data() + (m * PQ_KSUB + k) * dsub_;
+    }
+
+    float partial(const float *a, const float *b) const {
+        float res = 0;
+        for (size_t i = 0; i < dsub_; i++) {
+            res = Metric::accumulate(a[i], b[i], res);
+        }
+        return res;
+    }
+
+    static float sqr_dist(const float *a, const float *b, size_t n) {
+        float res = 0;
+        for (size_t i = 0; i < n; i++) {
+            float t = a[i] - b[i];
+            res += t * t;
+        }
+        return res;
+    }
+
+    size_t nearest_centroid(size_t m, const float *sub) const {
+        size_t best = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (size_t k = 0; k < PQ_KSUB; k++) {
+            float d = sqr_dist(sub, centroid(m, k), dsub_);
+            if (d < best_dist) {
+                best_dist = d;
+                best = k;
+            }
+        }
+        return best;
+    }
+
+    void build_centroid_dist() {
+        centroid_dist_.resize(param_.M * PQ_KSUB * PQ_KSUB);
+        for (size_t m = 0; m < param_.M; m++) {
+            for (size_t a = 0; a < PQ_KSUB; a++) {
+                for (size_t b = 0; b < PQ_KSUB; b++) {
+                    centroid_dist_[(m * PQ_KSUB + a) * PQ_KSUB + b] = partial(centroid(m, a), centroid(m, b));
+                }
+            }
+        }
+        param_.centroid_dist = centroid_dist_.data();
+        trained_ = true;
+    }
+
+ public:
+    PQSpace(size_t dim, size_t M) : trained_(false) {
+        if (M == 0 || dim % M != 0)
+            throw std::runtime_error("PQSpace: the dimension must be a multiple of the number of sub-vectors M");
+        dsub_ = dim / M;
+        param_.dim = dim;
+        param_.M = M;
+        param_.centroid_dist = nullptr;
+    }
+
+    // Trains the codebooks with k-means on n sample vectors stored contiguously (n >= 256).
+    void train(const float *data, size_t n, size_t iterations = 25, size_t random_seed = 100) {
+        if (n < PQ_KSUB)
+            throw std::runtime_error("PQSpace needs at least 256 training vectors");
+        size_t dim = param_.dim;
+        std::default_random_engine rng(random_seed);
+        centroids_.resize(param_.M * PQ_KSUB * dsub_);
+
+        std::vector<float> sub(n * dsub_);
+        std::vector<size_t> assign(n);
+        std::vector<size_t> count(PQ_KSUB);
+        for (size_t m = 0; m < param_.M; m++) {
+            for (size_t j = 0; j < n; j++) {
+                memcpy(&sub[j * dsub_], data + j * dim + m * dsub_, dsub_ * sizeof(float));
+            }
+            float *cent = centroids_.data() + m * PQ_KSUB * dsub_;
+
+            // initialize with distinct random samples
+            std::vector<size_t> perm(n);
+            for (size_t j = 0; j < n; j++) perm[j] = j;
+            std::shuffle(perm.begin(), perm.end(), rng);
+            for (size_t k = 0; k < PQ_KSUB; k++) {
+                memcpy(cent + k * dsub_, &sub[perm[k] * dsub_], dsub_ * sizeof(float));
+            }
+
+            for (size_t it = 0; it < iterations; it++) {
+                for (size_t j = 0; j < n; j++) {
+                    assign[j] = nearest_centroid(m, &sub[j * dsub_]);
+                }
+                std::fill(cent, cent + PQ_KSUB * dsub_, 0.0f);
+                std::fill(count.begin(), count.end(), 0);
+                for (size_t j = 0; j < n; j++) {
+                    count[assign[j]]++;
+                    for (size_t i = 0; i < dsub_; i++) {
+                        cent[assign[j] * dsub_ + i] += sub[j * dsub_ + i];
+                    }
+                }
+                std::uniform_int_distribution<size_t> pick(0, n - 1);
+                for (size_t k = 0; k < PQ_KSUB; k++) {
+                    if (count[k] == 0) {  // empty cluster, restart it from a random sample
+                        memcpy(cent + k * dsub_, &sub[pick(rng) * dsub_], dsub_ * sizeof(float));
+                        continue;
+                    }
+                    for (size_t i = 0; i < dsub_; i++) {
+                        cent[k * dsub_ + i] /= count[k];
+                    }
+                }
+            }
+        }
+        build_centroid_dist();
+    }
+
+    bool isTrained() const {
+        return trained_;
+    }
+
+    void saveCodebook(const std::string &location) const {
+        std::ofstream output(location, std::ios::binary);
+        writeBinaryPOD(output, param_.dim);
+        writeBinaryPOD(output, param_.M);
+        output.write((const char *) centroids_.data(), centroids_.size() * sizeof(float));
+        output.close();
+    }
+
+    void loadCodebook(const std::string &location) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+        size_t dim, M;
+        readBinaryPOD(input, dim);
+        readBinaryPOD(input, M);
+        if (dim != param_.dim || M != param_.M)
+            throw std::runtime_error("PQSpace: the codebook was trained for another dimension or M");
+        centroids_.resize(param_.M * PQ_KSUB * dsub_);
+        input.read((char *) centroids_.data(), centroids_.size() * sizeof(float));
+        if (!input)
+            throw std::runtime_error("PQSpace: the codebook file is truncated");
+        input.close();
+        build_centroid_dist();
+    }
+
+    size_t get_data_size() override {
+        return param_.M;
+    }
+
+    DISTFUNC<float> get_dist_func() override {
+        return PQDistance<Metric>;
+    }
+
+    DISTFUNC<float> get_query_dist_func() override {
+        return PQTableDistance<Metric>;
+    }
+
+    void *get_dist_func_param() override {
+        return &param_;
+    }
+
+    size_t get_input_size() override {
+        return param_.dim * sizeof(float);
+    }
+
+    size_t get_query_state_size() override {
+        return param_.M * PQ_KSUB * sizeof(float);
+    }
+
+    void prepare_query(const void *query, void *state) override {
+        const float *q = (const float *) query;
+        float *table = (float *) state;
+        for (size_t m = 0; m < param_.M; m++) {
+            for (size_t k = 0; k < PQ_KSUB; k++) {
+                table[m * PQ_KSUB + k] = partial(q + m * dsub_, centroid(m, k));
+            }
+        }
+    }
+
+    void encode(const void *input, void *stored) override {
+        if (!trained_)
+            throw std::runtime_error("PQSpace must be trained before adding points");
+        const float *src = (const float *) input;
+        uint8_t *code = (uint8_t *) stored;
+        for (size_t m = 0; m < param_.M; m++) {
+            code[m] = (uint8_t) nearest_centroid(m, src + m * dsub_);
+        }
+    }
+
+    void decode(const void *stored, void *output) override {
+        const uint8_t *code = (const uint8_t *) stored;
+        float *dst = (float *) output;
+        for (size_t m = 0; m < param_.M; m++) {
+            memcpy(dst + m * dsub_, centroid(m, code[m]), dsub_ * sizeof(float));
+        }
+    }
+
+    ~PQSpace() {}
+};
+
+typedef PQSpace<L2Metric> L2SpacePQ;
+typedef PQSpace<InnerProductMetric> InnerProductSpacePQ;
+
+}  // namespace hnswlib
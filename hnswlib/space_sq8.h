@@ -0,0 +1,238 @@
+#pragma once
+#include "hnswlib.h"
+#include <stdint.h>
+#include <algorithm>
+#include <limits>
+
+namespace hnswlib {
+
+// Scalar quantization to one byte per dimension. Each dimension is mapped
+// linearly from its trained [min, max] range onto 0..255, so a stored vector
+// takes a quarter of its float32 size. Queries stay float32 and are compared
+// against the dequantized codes. Pair with HierarchicalNSW::setRerankSpace to
+// re-rank the final candidates on the exact vectors.
+
+struct SQ8Param {
+    size_t dim;  // first member: getDataByLabel reads the dimension from the param
+    const float *lo;
+    const float *scale;
+};
+
+
+template<typename Metric>
+static float
+SQ8Distance(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const uint8_t *pVect1 = (const uint8_t *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+    const SQ8Param *param = (const SQ8Param *) param_ptr;
+
+    float res = 0;
+    for (size_t i = 0; i < param->dim; i++) {
+        float a = param->lo[i] + pVect1[i] * param->scale[i];
+        float b = param->lo[i] + pVect2[i] * param->scale[i];
+        res = Metric::accumulate(a, b, res);
+    }
+    return Metric::finalize(res);
+}
+
+
+template<typename Metric>
+static float
+SQ8QueryDistance(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const float *pVect1 = (const float *) pVect1v;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+    const SQ8Param *param = (const SQ8Param *) param_ptr;
+
+    float res = 0;
+    for (size_t i = 0; i < param->dim; i++) {
+        float b = param->lo[i] + pVect2[i] * param->scale[i];
+        res = Metric::accumulate(pVect1[i], b, res);
+    }
+    return Metric::finalize(res);
+}
+
+
+#if defined(USE_AVX512) || (defined(USE_FMA) && defined(__AVX2__))
+// widens width codes to floats: lo + code * scale
+struct SQ8Codes {
+#if defined(USE_AVX512)
+    static HNSWLIB_FORCE_INLINE __m512 load(SimdAVX512, const uint8_t *p, __m512 lo, __m512 scale) {
+        __m512 codes = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) p)));
+        return _mm512_fmadd_ps(codes, scale, lo);
+    }
+#endif
+#if defined(USE_FMA) && defined(__AVX2__)
+    static HNSWLIB_FORCE_INLINE __m256 load(SimdFMA, const uint8_t *p, __m256 lo, __m256 scale) {
+        __m256 codes = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) p)));
+        return _mm256_fmadd_ps(codes, scale, lo);
+    }
+#endif
+};
+
+
+// QUERY: the first vector is a float32 query rather than a code
+template<typename Metric, typename Simd, bool QUERY>
+static HNSWLIB_FORCE_INLINE typename Simd::reg
+SQ8Step(const void *pVect1v, const uint8_t *pVect2, const SQ8Param *param, size_t i, typename Simd::reg sum) {
+    typename Simd::reg lo = Simd::load(param->lo + i);
+    typename Simd::reg scale = Simd::load(param->scale + i);
+    typename Simd::reg a = QUERY ? Simd::load((const float *) pVect1v + i)
+                                 : SQ8Codes::load(Simd(), (const uint8_t *) pVect1v + i, lo, scale);
+    typename Simd::reg b = SQ8Codes::load(Simd(), pVect2 + i, lo, scale);
+    return Metric::template accumulate<Simd>(a, b, sum);
+}
+
+
+template<typename Metric, typename Simd, bool QUERY>
+static float
+SQ8DistanceSIMD(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const SQ8Param *param = (const SQ8Param *) param_ptr;
+    const uint8_t *pVect2 = (const uint8_t *) pVect2v;
+    const size_t width = Simd::width;
+    size_t qty = param->dim;
+
+    typename Simd::reg sum0 = Simd::zero();
+    typename Simd::reg sum1 = Simd::zero();
+    size_t i = 0;
+    for (; i + 2 * width <= qty; i += 2 * width) {
+        sum0 = SQ8Step<Metric, Simd, QUERY>(pVect1v, pVect2, param, i, sum0);
+        sum1 = SQ8Step<Metric, Simd, QUERY>(pVect1v, pVect2, param, i + width, sum1);
+    }
+    if (i + width <= qty) {
+        sum0 = SQ8Step<Metric, Simd, QUERY>(pVect1v, pVect2, param, i, sum0);
+        i += width;
+    }
+
+    float res = Simd::reduce(Simd::add(sum0, sum1));
+    for (; i < qty; i++) {
+        float a = QUERY ? ((const float *) pVect1v)[i]
+                        : param->lo[i] + ((const uint8_t *) pVect1v)[i] * param->scale[i];
+        float b = param->lo[i] + pVect2[i] * param->scale[i];
+        res = Metric::accumulate(a, b, res);
+    }
+    return Metric::finalize(res);
+}
+#endif
+
+
+template<typename Metric, bool QUERY>
+static DISTFUNC<float> SQ8SelectDistFunc() {
+#if defined(USE_AVX512)
+    if (getSIMDLevel() >= SIMD_AVX512)
+        return SQ8DistanceSIMD<Metric, SimdAVX512, QUERY>;
+#endif
+#if defined(USE_FMA) && defined(__AVX2__)
+    if (getSIMDLevel() >= SIMD_FMA)
+        return SQ8DistanceSIMD<Metric, SimdFMA, QUERY>;
+#endif
+    return QUERY ? SQ8QueryDistance<Metric> : SQ8Distance<Metric>;
+}
+
+
+template<typename Metric>
+class SQ8Space : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    DISTFUNC<float> query_distfunc_;
+    std::vector<float> lo_;
+    std::vector<float> scale_;
+    SQ8Param param_;
+    bool trained_;
+
+ public:
+    SQ8Space(size_t dim) : lo_(dim, 0.0f), scale_(dim, 0.0f), trained_(false) {
+        fstdistfunc_ = SQ8SelectDistFunc<Metric, false>();
+        query_distfunc_ = SQ8SelectDistFunc<Metric, true>();
+        param_.dim = dim;
+        param_.lo = lo_.data();
+        param_.scale = scale_.data();
+    }
+
+    // Learns the per-dimension range from n sample vectors stored contiguously.
+    void train(const float *data, size_t n) {
+        if (n == 0)
+            throw std::runtime_error("SQ8Space needs at least one training vector");
+        size_t dim = param_.dim;
+        std::vector<float> hi(dim, std::numeric_limits<float>::lowest());
+        std::fill(lo_.begin(), lo_.end(), std::numeric_limits<float>::max());
+        for (size_t j = 0; j < n; j++) {
+            for (size_t i = 0; i < dim; i++) {
+                lo_[i] = std::min(lo_[i], data[j * dim + i]);
+                hi[i] = std::max(hi[i], data[j * dim + i]);
+            }
+        }
+        setRange(lo_.data(), hi.data());
+    }
+
+    // Sets the range directly, e.g. one saved with getMin/getMax when reloading an index.
+    void setRange(const float *lo, const float *hi) {
+        for (size_t i = 0; i < param_.dim; i++) {
+            lo_[i] = lo[i];
+            scale_[i] = (hi[i] - lo[i]) / 255.0f;
+        }
+        trained_ = true;
+    }
+
+    std::vector<float> getMin() const {
+        return lo_;
+    }
+
+    std::vector<float> getMax() const {
+        std::vector<float> hi(param_.dim);
+        for (size_t i = 0; i < param_.dim; i++) {
+            hi[i] = lo_[i] + scale_[i] * 255.0f;
+        }
+        return hi;
+    }
+
+    bool isTrained() const {
+        return trained_;
+    }
+
+    size_t get_data_size() override {
+        return param_.dim * sizeof(uint8_t);
+    }
+
+    DISTFUNC<float> get_dist_func() override {
+        return fstdistfunc_;
+    }
+
+    DISTFUNC<float> get_query_dist_func() override {
+        return query_distfunc_;
+    }
+
+    void *get_dist_func_param() override {
+        return &param_;
+    }
+
+    size_t get_input_size() override {
+        return param_.dim * sizeof(float);
+    }
+
+    void encode(const void *input, void *stored) override {
+        if (!trained_)
+            throw std::runtime_error("SQ8Space must be trained before adding points");
+        const float *src = (const float *) input;
+        uint8_t *dst = (uint8_t *) stored;
+        for (size_t i = 0; i < param_.dim; i++) {
+            // values outside the trained range are clamped
+            float code = scale_[i] > 0 ? (src[i] - lo_[i]) / scale_[i] : 0.0f;
+            code = std::min(std::max(code, 0.0f), 255.0f);
+            dst[i] = (uint8_t) (code + 0.5f);
+        }
+    }
+
+    void decode(const void *stored, void *output) override {
+        const uint8_t *src = (const uint8_t *) stored;
+        float *dst = (float *) output;
+        for (size_t i = 0; i < param_.dim; i++) {
+            dst[i] = lo_[i] + src[i] * scale_[i];
+        }
+    }
+
+    ~SQ8Space() {}
+};
+
+typedef SQ8Space<L2Metric> L2SpaceSQ8;
+typedef SQ8Space<InnerProductMetric> InnerProductSpaceSQ8;
+
+}  // namespace hnswlib
@@ -0,0 +1,51 @@
+#pragma once
+#include "hnswlib.h"
+#include <atomic>
+#include <thread>
+
+namespace hnswlib {
+
+/*
+* A one-byte lock for the link lists of an element, usable with std::unique_lock. A
+* std::mutex per element costs 40 bytes, this costs one, so the lock table of a large
+* index is small enough to stay mostly in cache during concurrent inserts.
+*
+* Waiting spins on a plain load, which keeps the cache line shared until the owner
+* releases it, and yields after a while since the owner may hold the lock for a whole
+* insert or be descheduled.
+*/
+class SpinLock {
+    static const size_t SPINS_BEFORE_YIELD = 64;
+
+    std::atomic<unsigned char> locked_{0};
+
+ public:
+    SpinLock() = default;
+    SpinLock(const SpinLock &) = delete;
+    SpinLock &operator=(const SpinLock &) = delete;
+
+    void lock() {
+        size_t spins = 0;
+        while (locked_.exchange(1, std::memory_order_acquire)) {
+            while (locked_.load(std::memory_order_relaxed)) {
+                if (++spins < SPINS_BEFORE_YIELD) {
+#ifdef USE_SSE
+                    _mm_pause();
+#endif
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    bool try_lock() {
+        return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(1, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        locked_.store(0, std::memory_order_release);
+    }
+};
+
+}  // namespace hnswlib
@@ -24,27 +24,7 @@ class MultiVectorL2Space : public BaseMultiVectorSpace<DOCIDTYPE> {
 
  public:
     MultiVectorL2Space(size_t dim) {
-        fstdistfunc_ = L2Sqr;
-#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
-    #if defined(USE_AVX512)
-        if (AVX512Capable())
-            L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX512;
-        else if (AVXCapable())
-            L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
-    #elif defined(USE_AVX)
-        if (AVXCapable())
-            L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
-    #endif
-
-        if (dim % 16 == 0)
-            fstdistfunc_ = L2SqrSIMD16Ext;
-        else if (dim % 4 == 0)
-            fstdistfunc_ = L2SqrSIMD4Ext;
-        else if (dim > 16)
-            fstdistfunc_ = L2SqrSIMD16ExtResiduals;
-        else if (dim > 4)
-            fstdistfunc_ = L2SqrSIMD4ExtResiduals;
-#endif
+        fstdistfunc_ = L2SqrDistFuncTable().select(dim);
         dim_ = dim;
         vector_size_ = dim * sizeof(float);
         data_size_ = vector_size_ + sizeof(DOCIDTYPE);
@@ -83,38 +63,7 @@ class MultiVectorInnerProductSpace : public BaseMultiVectorSpace<DOCIDTYPE> {
 
  public:
     MultiVectorInnerProductSpace(size_t dim) {
-        fstdistfunc_ = InnerProductDistance;
-#if defined(USE_AVX) || defined(USE_SSE) || defined(USE_AVX512)
-    #if defined(USE_AVX512)
-        if (AVX512Capable()) {
-            InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX512;
-            InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX512;
-        } else if (AVXCapable()) {
-            InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
-            InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
-        }
-    #elif defined(USE_AVX)
-        if (AVXCapable()) {
-            InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
-            InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
-        }
-    #endif
-    #if defined(USE_AVX)
-        if (AVXCapable()) {
-            InnerProductSIMD4Ext = InnerProductSIMD4ExtAVX;
-            InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtAVX;
-        }
-    #endif
-
-        if (dim % 16 == 0)
-            fstdistfunc_ = InnerProductDistanceSIMD16Ext;
-        else if (dim % 4 == 0)
-            fstdistfunc_ = InnerProductDistanceSIMD4Ext;
-        else if (dim > 16)
-            fstdistfunc_ = InnerProductDistanceSIMD16ExtResiduals;
-        else if (dim > 4)
-            fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
-#endif
+        fstdistfunc_ = InnerProductDistanceDistFuncTable().select(dim);
         vector_size_ = dim * sizeof(float);
         data_size_ = vector_size_ + sizeof(DOCIDTYPE);
     }
@@ -273,4 +222,92 @@ class EpsilonSearchStopCondition : public BaseSearchStopCondition<dist_t> {
 
     ~EpsilonSearchStopCondition() {}
 };
+
+
+/*
+* Stops a k-nearest neighbor search once the k best results have not changed for
+* patience expansions, instead of always exploring ef candidates. Easy queries settle
+* after a few hops and stop early, hard ones keep going up to max_num_candidates, which
+* bounds the result set like ef does. At least min_num_candidates results are collected
+* before the search may stop early.
+*
+* This is opt-in and usually not faster than setEf. On 100k clustered 64-d vectors
+* (M=16, k=10) it lies on the same recall/work curve as a fixed ef: patience 16 with
+* max_num_candidates 80 reaches recall .976 at 480 distance computations per query,
+* where ef 30 and 40 reach .967 and .984 at 457 and 506. Through the virtual
+* stop-condition path it took 106 us per query at recall .976, a fixed ef about 77 us.
+* Use it when hard queries need a large max_num_candidates and one ef cannot be tuned
+* for all queries, and measure on your data first.
+*/
+template<typename dist_t>
+class AdaptiveSearchStopCondition : public BaseSearchStopCondition<dist_t> {
+    size_t k_;
+    size_t min_num_candidates_;
+    size_t max_num_candidates_;
+    size_t patience_;
+    size_t curr_num_items_;
+    size_t expansions_since_change_;
+    std::priority_queue<dist_t> top_k_;  // distances of the k best results, the k-th on top
+
+ public:
+    AdaptiveSearchStopCondition(size_t k, size_t min_num_candidates, size_t max_num_candidates, size_t patience) {
+        assert(k <= min_num_candidates && min_num_candidates <= max_num_candidates);
+        k_ = k;
+        min_num_candidates_ = min_num_candidates;
+        max_num_candidates_ = max_num_candidates;
+        patience_ = patience;
+        curr_num_items_ = 0;
+        expansions_since_change_ = 0;
+    }
+
+    void add_point_to_result(labeltype label, const void *datapoint, dist_t dist) override {
+        curr_num_items_ += 1;
+        if (top_k_.size() < k_) {
+            top_k_.push(dist);
+            expansions_since_change_ = 0;
+        } else if (dist < top_k_.top()) {
+            top_k_.pop();
+            top_k_.push(dist);
+            expansions_since_change_ = 0;
+        }
+    }
+
+    void remove_point_from_result(labeltype label, const void *datapoint, dist_t dist) override {
+        // the removed point is the farthest of more than max_num_candidates >= k results,
+        // so it is not one of the k best
+        curr_num_items_ -= 1;
+    }
+
+    bool should_stop_search(dist_t candidate_dist, dist_t lowerBound) override {
+        if (candidate_dist > lowerBound && curr_num_items_ == max_num_candidates_) {
+            // new candidate can't improve found results
+            return true;
+        }
+        // called once before each expansion
+        expansions_since_change_ += 1;
+        if (expansions_since_change_ > patience_ && curr_num_items_ >= min_num_candidates_) {
+            // the k best results have settled
+            return true;
+        }
+        return false;
+    }
+
+    bool should_consider_candidate(dist_t candidate_dist, dist_t lowerBound) override {
+        bool flag_consider_candidate = curr_num_items_ < max_num_candidates_ || lowerBound > candidate_dist;
+        return flag_consider_candidate;
+    }
+
+    bool should_remove_extra() override {
+        bool flag_remove_extra = curr_num_items_ > max_num_candidates_;
+        return flag_remove_extra;
+    }
+
+    void filter_results(std::vector<std::pair<dist_t, labeltype >> &candidates) override {
+        while (candidates.size() > k_) {
+            candidates.pop_back();
+        }
+    }
+
+    ~AdaptiveSearchStopCondition() {}
+};
 }  // namespace hnswlib
@@ -1,25 +1,114 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <stdint.h>
 #include <string.h>
 #include <deque>
 
 namespace hnswlib {
 typedef unsigned short int vl_type;
 
+/*
+* The set of elements visited by one search. A dense list keeps a tag per element of the
+* index and is cleared by bumping the tag. A sparse list is an open-addressing hash set of
+* the visited ids, sized by what searches actually visit rather than by the index, for
+* searches with small ef on indexes with many elements.
+*/
 class VisitedList {
+    static const size_t SPARSE_INITIAL_CAPACITY = 1024;
+
+    unsigned int *table{nullptr};  // sparse only, id + 1 per slot, 0 marks an empty slot
+    size_t table_mask{0};
+    size_t table_shift{0};
+    size_t table_count{0};
+
+    void allocateTable(size_t capacity) {
+        delete[] table;
+        table = new unsigned int[capacity]();
+        table_mask = capacity - 1;
+        table_shift = 64;
+        for (size_t c = capacity; c > 1; c >>= 1)
+            table_shift--;
+        table_count = 0;
+    }
+
+    // Fibonacci hashing, the top bits of the product spread consecutive ids
+    inline size_t slotOf(unsigned int id) const {
+        return (size_t) ((id * 0x9E3779B97F4A7C15ULL) >> table_shift);
+    }
+
+    void growTable() {
+        unsigned int *old_table = table;
+        size_t old_capacity = table_mask + 1;
+        table = nullptr;
+        allocateTable(2 * old_capacity);
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_table[i] != 0)
+                visitSparse(old_table[i] - 1);
+        }
+        delete[] old_table;
+    }
+
+    bool visitSparse(unsigned int id) {
+        unsigned int key = id + 1;
+        for (size_t i = slotOf(id);; i = (i + 1) & table_mask) {
+            if (table[i] == key)
+                return false;
+            if (table[i] == 0) {
+                table[i] = key;
+                // keep the load under a half, probes stay short
+                if (++table_count * 2 > table_mask + 1)
+                    growTable();
+                return true;
+            }
+        }
+    }
+
  public:
     vl_type curV;
-    vl_type *mass;
+    vl_type *mass;  // dense only, nullptr for a sparse list
     unsigned int numelements;
 
-    VisitedList(int numelements1) {
+    VisitedList(int numelements1, bool sparse = false) {
         curV = -1;
         numelements = numelements1;
-        mass = new vl_type[numelements];
+        if (sparse) {
+            mass = nullptr;
+            allocateTable(SPARSE_INITIAL_CAPACITY);
+        } else {
+            mass = new vl_type[numelements];
+        }
+    }
+
+    VisitedList(const VisitedList &) = delete;
+    VisitedList &operator=(const VisitedList &) = delete;
+
+    bool isSparse() const {
+        return mass == nullptr;
+    }
+
+    // the number of slots of the hash set, 0 for a dense list
+    size_t tableCapacity() const {
+        return isSparse() ? table_mask + 1 : 0;
     }
 
     void reset() {
+        if (isSparse()) {
+            // one long walk must not leave every later search clearing a large table: when
+            // the last search filled far less than it, start over at four times its count
+            size_t capacity = SPARSE_INITIAL_CAPACITY;
+            while (capacity < 4 * table_count)
+                capacity *= 2;
+            if (table_mask + 1 > 2 * capacity) {
+                allocateTable(capacity);
+                return;
+            }
+            memset(table, 0, sizeof(unsigned int) * (table_mask + 1));
+            table_count = 0;
+            return;
+        }
         curV++;
         if (curV == 0) {
             memset(mass, 0, sizeof(vl_type) * numelements);
@@ -27,7 +116,39 @@ class VisitedList {
         }
     }
 
-    ~VisitedList() { delete[] mass; }
+    // marks id as visited, returns false if it already was
+    inline bool visit(unsigned int id) {
+        if (mass != nullptr) {
+            if (mass[id] == curV)
+                return false;
+            mass[id] = curV;
+            return true;
+        }
+        return visitSparse(id);
+    }
+
+    inline bool isVisited(unsigned int id) const {
+        if (mass != nullptr)
+            return mass[id] == curV;
+        for (size_t i = slotOf(id); table[i] != 0; i = (i + 1) & table_mask) {
+            if (table[i] == id + 1)
+                return true;
+        }
+        return false;
+    }
+
+    // the dense tag of id is read by visit soon, the hash set needs no prefetch
+    inline void prefetch(unsigned int id) const {
+#ifdef USE_SSE
+        if (mass != nullptr)
+            _mm_prefetch((char *) (mass + id), _MM_HINT_T0);
+#endif
+    }
+
+    ~VisitedList() {
+        delete[] mass;
+        delete[] table;
+    }
 };
 ///////////////////////////////////////////////////////////
 //
@@ -35,27 +156,57 @@ class VisitedList {
 //
 /////////////////////////////////////////////////////////
 
+/*
+* Free lists are kept in slots, each thread starts from its own slot, so a search takes
+* and returns the list it used last with one atomic exchange and no lock. Taking is an
+* exchange with nullptr and returning a compare-exchange from nullptr, so a list can't be
+* handed out twice. Lists that find no empty slot, with more threads than slots, go to
+* the deque under poolguard.
+*/
 class VisitedListPool {
+    static const size_t NUM_SLOTS = 64;
+
+    // one free list per cache line, so threads taking from their own slot do not share lines
+    struct Slot {
+        std::atomic<VisitedList *> list{nullptr};
+        char padding[64 - sizeof(std::atomic<VisitedList *>)];
+    };
+
+    std::unique_ptr<Slot[]> slots;
     std::deque<VisitedList *> pool;
     std::mutex poolguard;
     int numelements;
+    bool sparse;
+
+    static size_t homeSlot() {
+        static std::atomic<size_t> next_slot{0};
+        static thread_local size_t slot = next_slot++ % NUM_SLOTS;
+        return slot;
+    }
 
  public:
-    VisitedListPool(int initmaxpools, int numelements1) {
+    VisitedListPool(int initmaxpools, int numelements1, bool sparse1 = false) : slots(new Slot[NUM_SLOTS]) {
         numelements = numelements1;
+        sparse = sparse1;
         for (int i = 0; i < initmaxpools; i++)
-            pool.push_front(new VisitedList(numelements));
+            releaseVisitedList(new VisitedList(numelements, sparse));
     }
 
     VisitedList *getFreeVisitedList() {
-        VisitedList *rez;
-        {
+        VisitedList *rez = nullptr;
+        size_t home = homeSlot();
+        for (size_t i = 0; i < NUM_SLOTS && rez == nullptr; i++) {
+            std::atomic<VisitedList *> &slot = slots[(home + i) % NUM_SLOTS].list;
+            if (slot.load(std::memory_order_relaxed) != nullptr)
+                rez = slot.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (rez == nullptr) {
             std::unique_lock <std::mutex> lock(poolguard);
             if (pool.size() > 0) {
                 rez = pool.front();
                 pool.pop_front();
             } else {
-                rez = new VisitedList(numelements);
+                rez = new VisitedList(numelements, sparse);
             }
         }
         rez->reset();
@@ -63,11 +214,21 @@ class VisitedListPool {
     }
 
     void releaseVisitedList(VisitedList *vl) {
+        size_t home = homeSlot();
+        for (size_t i = 0; i < NUM_SLOTS; i++) {
+            std::atomic<VisitedList *> &slot = slots[(home + i) % NUM_SLOTS].list;
+            VisitedList *empty = nullptr;
+            if (slot.load(std::memory_order_relaxed) == nullptr &&
+                slot.compare_exchange_strong(empty, vl, std::memory_order_release))
+                return;
+        }
         std::unique_lock <std::mutex> lock(poolguard);
         pool.push_front(vl);
     }
 
     ~VisitedListPool() {
+        for (size_t i = 0; i < NUM_SLOTS; i++)
+            delete slots[i].list.load();
         while (pool.size()) {
             VisitedList *rez = pool.front();
             pool.pop_front();
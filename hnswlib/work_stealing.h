@@ -0,0 +1,130 @@
+#pragma once
+#include "hnswlib.h"
+#include "spin_lock.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hnswlib {
+
+/*
+* Runs fn(i, thread_id) for every i in [begin, end) on num_threads threads, 0 meaning
+* one per core. Each thread starts with a contiguous share of the range and works through
+* it in order. A thread that runs out takes the upper half of the largest share left, so
+* the threads stay busy when the cost of the items varies, as the cost of inserting an
+* element does, and neighboring items mostly run on the same thread.
+*
+* The first exception thrown by fn stops the threads and is rethrown.
+*/
+class WorkStealingRange {
+    struct Share {
+        SpinLock lock;
+        size_t next{0};
+        size_t end{0};
+    };
+
+    std::vector<Share> shares_;
+    std::atomic<bool> stopped_{false};
+
+    // the next item of share, false when it is empty
+    bool take(Share &share, size_t &item) {
+        std::unique_lock<SpinLock> lock(share.lock);
+        if (share.next >= share.end)
+            return false;
+        item = share.next++;
+        return true;
+    }
+
+    // moves the upper half of the largest share of the other threads to share
+    bool steal(size_t thread_id) {
+        while (true) {
+            size_t victim = thread_id;
+            size_t largest = 0;
+            for (size_t t = 0; t < shares_.size(); t++) {
+                std::unique_lock<SpinLock> lock(shares_[t].lock);
+                size_t left = shares_[t].end > shares_[t].next ? shares_[t].end - shares_[t].next : 0;
+                if (t != thread_id && left > largest) {
+                    largest = left;
+                    victim = t;
+                }
+            }
+            if (largest == 0)
+                return false;
+
+            size_t next, end;
+            {
+                std::unique_lock<SpinLock> lock(shares_[victim].lock);
+                if (shares_[victim].next >= shares_[victim].end)
+                    continue;  // emptied meanwhile, look again
+                end = shares_[victim].end;
+                next = end - (end - shares_[victim].next + 1) / 2;
+                shares_[victim].end = next;
+            }
+            std::unique_lock<SpinLock> lock(shares_[thread_id].lock);
+            shares_[thread_id].next = next;
+            shares_[thread_id].end = end;
+            return true;
+        }
+    }
+
+ public:
+    template <typename function_t>
+    void run(size_t begin, size_t end, size_t num_threads, function_t fn) {
+        if (num_threads == 0)
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        num_threads = std::min(num_threads, std::max(end, begin + 1) - begin);
+        if (num_threads == 1) {
+            for (size_t i = begin; i < end; i++)
+                fn(i, 0);
+            return;
+        }
+
+        std::vector<Share>(num_threads).swap(shares_);
+        size_t size = end - begin;
+        for (size_t t = 0; t < num_threads; t++) {
+            shares_[t].next = begin + size * t / num_threads;
+            shares_[t].end = begin + size * (t + 1) / num_threads;
+        }
+        stopped_ = false;
+
+        std::exception_ptr exception = nullptr;
+        std::mutex exception_lock;
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; t++) {
+            threads.emplace_back([&, t]() {
+                size_t item;
+                while (!stopped_) {
+                    if (!take(shares_[t], item)) {
+                        if (!steal(t))
+                            break;
+                        continue;
+                    }
+                    try {
+                        fn(item, t);
+                    } catch (...) {
+                        std::unique_lock<std::mutex> lock(exception_lock);
+                        if (!exception)
+                            exception = std::current_exception();
+                        stopped_ = true;
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+
+template <typename function_t>
+void parallelFor(size_t begin, size_t end, size_t num_threads, function_t fn) {
+    WorkStealingRange range;
+    range.run(begin, end, num_threads, fn);
+}
+
+}  // namespace hnswlib
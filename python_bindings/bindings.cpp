@@ -146,6 +146,7 @@ template<typename dist_t, typename data_t = float>
 class Index {
  public:
     static const int ser_version = 1;  // serialization version
+    static const size_t QUERY_CHUNK_SIZE = 64;  // rows of knn_query searched together by a thread
 
     std::string space_name;
     int dim;
@@ -170,8 +171,22 @@ class Index {
         } else if (space_name == "cosine") {
             l2space = new hnswlib::InnerProductSpace(dim);
             normalize = true;
+        } else if (space_name == "l2_fp16") {
+            l2space = new hnswlib::L2SpaceFP16(dim);
+        } else if (space_name == "ip_fp16") {
+            l2space = new hnswlib::InnerProductSpaceFP16(dim);
+        } else if (space_name == "cosine_fp16") {
+            l2space = new hnswlib::InnerProductSpaceFP16(dim);
+            normalize = true;
+        } else if (space_name == "l2_bf16") {
+            l2space = new hnswlib::L2SpaceBF16(dim);
+        } else if (space_name == "ip_bf16") {
+            l2space = new hnswlib::InnerProductSpaceBF16(dim);
+        } else if (space_name == "cosine_bf16") {
+            l2space = new hnswlib::InnerProductSpaceBF16(dim);
+            normalize = true;
         } else {
-            throw std::runtime_error("Space name must be one of l2, ip, or cosine.");
+            throw std::runtime_error("Space name must be one of l2, ip, cosine, or their _fp16/_bf16 variants.");
         }
         appr_alg = NULL;
         ep_added = true;
@@ -609,11 +624,39 @@ class Index {
     }
 
 
+    /*
+    * Filter of knn_query: a boolean mask indexed by label or an array of allowed labels,
+    * both tested by internal id, or else a function of the label called for every element.
+    */
+    std::unique_ptr<hnswlib::BaseFilterFunctor> createFilter(const py::object& filter) {
+        if (filter.is_none())
+            return nullptr;
+        if (py::isinstance<py::array>(filter)) {
+            py::array array = filter.cast<py::array>();
+            std::vector<hnswlib::labeltype> labels;
+            if (array.dtype().kind() == 'b') {
+                py::array_t < bool, py::array::c_style | py::array::forcecast > mask(array);
+                for (py::ssize_t i = 0; i < mask.size(); i++) {
+                    if (mask.data()[i])
+                        labels.push_back(i);
+                }
+            } else {
+                py::array_t < hnswlib::labeltype, py::array::c_style | py::array::forcecast > ids(array);
+                labels.assign(ids.data(), ids.data() + ids.size());
+            }
+            return std::unique_ptr<hnswlib::BaseFilterFunctor>(
+                new hnswlib::IdFilter(appr_alg->createIdFilter(labels.data(), labels.size())));
+        }
+        return std::unique_ptr<hnswlib::BaseFilterFunctor>(
+            new CustomFilterFunctor(filter.cast<std::function<bool(hnswlib::labeltype)>>()));
+    }
+
+
     py::object knnQuery_return_numpy(
         py::object input,
         size_t k = 1,
         int num_threads = -1,
-        const std::function<bool(hnswlib::labeltype)>& filter = nullptr) {
+        const py::object& filter = py::none()) {
         py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
         auto buffer = items.request();
         hnswlib::labeltype* data_numpy_l;
@@ -623,6 +666,11 @@ class Index {
         if (num_threads <= 0)
             num_threads = num_threads_default;
 
+        // Warning: search with a filter function works slow in python in multithreaded mode,
+        // for best performance pass a mask or an array of labels, or set num_threads=1
+        std::unique_ptr<hnswlib::BaseFilterFunctor> idFilter = createFilter(filter);
+        hnswlib::BaseFilterFunctor* p_idFilter = idFilter.get();
+
         {
             py::gil_scoped_release l;
             get_input_array_shapes(buffer, &rows, &features);
@@ -635,45 +683,38 @@ class Index {
             data_numpy_l = new hnswlib::labeltype[rows * k];
             data_numpy_d = new dist_t[rows * k];
 
-            // Warning: search with a filter works slow in python in multithreaded mode. For best performance set num_threads=1
-            CustomFilterFunctor idFilter(filter);
-            CustomFilterFunctor* p_idFilter = filter ? &idFilter : nullptr;
-
-            if (normalize == false) {
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                    std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                        (void*)items.data(row), k, p_idFilter);
-                    if (result.size() != k)
-                        throw std::runtime_error(
-                            "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
-                    for (int i = k - 1; i >= 0; i--) {
-                        auto& result_tuple = result.top();
-                        data_numpy_d[row * k + i] = result_tuple.first;
-                        data_numpy_l[row * k + i] = result_tuple.second;
-                        result.pop();
+            // each thread searches chunks of rows with searchKnnBatch, which interleaves them. The
+            // chunks are small enough that every thread gets some, but hold a full interleaved group
+            size_t chunk_size = (rows + num_threads - 1) / num_threads;
+            chunk_size = std::max(chunk_size, (size_t) hnswlib::HierarchicalNSW<dist_t>::BATCH_INTERLEAVED_QUERIES);
+            chunk_size = std::min(chunk_size, (size_t) QUERY_CHUNK_SIZE);
+            size_t num_chunks = (rows + chunk_size - 1) / chunk_size;
+            ParallelFor(0, num_chunks, num_threads, [&](size_t chunk, size_t threadId) {
+                size_t start = chunk * chunk_size;
+                size_t count = std::min(chunk_size, rows - start);
+                const void* queries = items.data(start);
+                std::vector<float> normalized;
+                if (normalize) {
+                    normalized.resize(count * dim);
+                    for (size_t i = 0; i < count; i++) {
+                        normalize_vector((float*)items.data(start + i), normalized.data() + i * dim);
                     }
-                });
-            } else {
-                std::vector<float> norm_array(num_threads * features);
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                    float* data = (float*)items.data(row);
-
-                    size_t start_idx = threadId * dim;
-                    normalize_vector((float*)items.data(row), (norm_array.data() + start_idx));
+                    queries = normalized.data();
+                }
 
-                    std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                        (void*)(norm_array.data() + start_idx), k, p_idFilter);
-                    if (result.size() != k)
+                std::vector<std::pair<dist_t, hnswlib::labeltype>> result(count * k);
+                std::vector<size_t> counts(count);
+                appr_alg->searchKnnBatch(queries, count, k, result.data(), counts.data(), p_idFilter);
+                for (size_t i = 0; i < count; i++) {
+                    if (counts[i] != k)
                         throw std::runtime_error(
                             "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
-                    for (int i = k - 1; i >= 0; i--) {
-                        auto& result_tuple = result.top();
-                        data_numpy_d[row * k + i] = result_tuple.first;
-                        data_numpy_l[row * k + i] = result_tuple.second;
-                        result.pop();
+                    for (size_t j = 0; j < k; j++) {
+                        data_numpy_d[(start + i) * k + j] = result[i * k + j].first;
+                        data_numpy_l[(start + i) * k + j] = result[i * k + j].second;
                     }
-                });
-            }
+                }
+            });
         }
         py::capsule free_when_done_l(data_numpy_l, [](void* f) {
             delete[] f;
@@ -747,8 +788,22 @@ class BFIndex {
         } else if (space_name == "cosine") {
             space = new hnswlib::InnerProductSpace(dim);
             normalize = true;
+        } else if (space_name == "l2_fp16") {
+            space = new hnswlib::L2SpaceFP16(dim);
+        } else if (space_name == "ip_fp16") {
+            space = new hnswlib::InnerProductSpaceFP16(dim);
+        } else if (space_name == "cosine_fp16") {
+            space = new hnswlib::InnerProductSpaceFP16(dim);
+            normalize = true;
+        } else if (space_name == "l2_bf16") {
+            space = new hnswlib::L2SpaceBF16(dim);
+        } else if (space_name == "ip_bf16") {
+            space = new hnswlib::InnerProductSpaceBF16(dim);
+        } else if (space_name == "cosine_bf16") {
+            space = new hnswlib::InnerProductSpaceBF16(dim);
+            normalize = true;
         } else {
-            throw std::runtime_error("Space name must be one of l2, ip, or cosine.");
+            throw std::runtime_error("Space name must be one of l2, ip, cosine, or their _fp16/_bf16 variants.");
         }
         alg = NULL;
         index_inited = false;
@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include <limits>
+
+typedef float dist_t;
+
+TEST(AdaptiveSearchTest, MODULE_TEST) {
+    int dim = 16;               // Dimension of the elements
+    int max_elements = 10000;   // Maximum number of elements, should be known beforehand
+    int M = 16;                 // Tightly connected with internal dimensionality of the data
+                                // strongly affects the memory consumption
+    int ef_construction = 200;  // Controls index search speed/build speed tradeoff
+
+    int num_queries = 100;
+    size_t k = 10;
+    size_t min_num_candidates = 10;     // Results collected before the search may stop early
+    size_t max_num_candidates = 200;    // Upper bound on the explored results, like ef
+    size_t patience = 20;               // Expansions without a change of the k best results
+
+    // Initing index
+    hnswlib::L2Space space(dim);
+    hnswlib::BruteforceSearch<dist_t>* alg_brute = new hnswlib::BruteforceSearch<dist_t>(&space, max_elements);
+    hnswlib::HierarchicalNSW<dist_t>* alg_hnsw = new hnswlib::HierarchicalNSW<dist_t>(&space, max_elements, M, ef_construction);
+
+    // Generate random data
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib_real;
+
+    float* data = new float[dim * max_elements];
+    for (int i = 0; i < dim * max_elements; i++) {
+        data[i] = distrib_real(rng);
+    }
+
+    // Add data to index, labels differ from the internal ids
+    std::cout << "Building index ...\n";
+    for (int i = 0; i < max_elements; i++) {
+        hnswlib::labeltype label = 3 * i + 1;
+        float* point_data = data + i * dim;
+        alg_hnsw->addPoint(point_data, label);
+        alg_brute->addPoint(point_data, label);
+    }
+    std::cout << "Index is ready\n";
+
+    // Query random vectors
+    float correct = 0;
+    float total = 0;
+    std::vector<float> query_data(dim);
+    for (int i = 0; i < num_queries; i++) {
+        for (int j = 0; j < dim; j++) {
+            query_data[j] = distrib_real(rng);
+        }
+        hnswlib::AdaptiveSearchStopCondition<dist_t> stop_condition(k, min_num_candidates, max_num_candidates, patience);
+        std::vector<std::pair<float, hnswlib::labeltype>> result_hnsw =
+            alg_hnsw->searchStopConditionClosest(query_data.data(), stop_condition);
+
+        // k results, closest first, with the distances of their labels
+        ASSERT_EQ(k, result_hnsw.size());
+        for (size_t j = 0; j < result_hnsw.size(); j++) {
+            if (j > 0) {
+                EXPECT_LE(result_hnsw[j - 1].first, result_hnsw[j].first);
+            }
+            hnswlib::labeltype label = result_hnsw[j].second;
+            ASSERT_EQ(1u, label % 3);
+            float dist = space.get_dist_func()(query_data.data(), data + (label / 3) * dim, space.get_dist_func_param());
+            EXPECT_EQ(dist, result_hnsw[j].first);
+        }
+
+        std::priority_queue<std::pair<float, hnswlib::labeltype>> result_brute =
+            alg_brute->searchKnn(query_data.data(), k);
+        std::unordered_set<hnswlib::labeltype> gt_labels;
+        while (!result_brute.empty()) {
+            gt_labels.insert(result_brute.top().second);
+            result_brute.pop();
+        }
+        for (auto pair : result_hnsw) {
+            if (gt_labels.find(pair.second) != gt_labels.end()) {
+                correct += 1;
+            }
+        }
+        total += k;
+    }
+    float recall = correct / total;
+    std::cout << "Recall: " << recall << "\n";
+    EXPECT_GT(recall, 0.95);
+
+    // Query the elements for themselves, the search stops early on the exact match
+    for (int i = 0; i < max_elements; i += 10) {
+        hnswlib::AdaptiveSearchStopCondition<dist_t> stop_condition(1, 1, max_num_candidates, patience);
+        std::vector<std::pair<float, hnswlib::labeltype>> result =
+            alg_hnsw->searchStopConditionClosest(data + i * dim, stop_condition);
+        ASSERT_EQ(1u, result.size());
+        EXPECT_EQ(0, result[0].first);
+        EXPECT_EQ((hnswlib::labeltype) 3 * i + 1, result[0].second);
+    }
+    std::cout << "Self search is OK\n";
+
+    delete[] data;
+    delete alg_brute;
+    delete alg_hnsw;
+}
+
+// counts the expansions, should_stop_search is called once before each of them
+template<typename dist_t>
+class CountingStopCondition : public hnswlib::AdaptiveSearchStopCondition<dist_t> {
+ public:
+    size_t expansions = 0;
+
+    CountingStopCondition(size_t k, size_t min_num_candidates, size_t max_num_candidates, size_t patience)
+        : hnswlib::AdaptiveSearchStopCondition<dist_t>(k, min_num_candidates, max_num_candidates, patience) {}
+
+    bool should_stop_search(dist_t candidate_dist, dist_t lowerBound) override {
+        expansions += 1;
+        return hnswlib::AdaptiveSearchStopCondition<dist_t>::should_stop_search(candidate_dist, lowerBound);
+    }
+};
+
+TEST(AdaptiveSearchTest, StopsBeforeMaxNumCandidates) {
+    int dim = 16;
+    int max_elements = 10000;
+    size_t k = 10;
+    size_t max_num_candidates = 200;
+    size_t patience = 20;
+
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<dist_t> alg_hnsw(&space, max_elements, 16, 200);
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib_real;
+    std::vector<float> data(dim * max_elements);
+    for (float &x : data) {
+        x = distrib_real(rng);
+    }
+    for (int i = 0; i < max_elements; i++) {
+        alg_hnsw.addPoint(data.data() + i * dim, i);
+    }
+
+    // without patience the search explores max_num_candidates results, like ef
+    size_t adaptive_expansions = 0;
+    size_t full_expansions = 0;
+    std::vector<float> query_data(dim);
+    for (int i = 0; i < 100; i++) {
+        for (int j = 0; j < dim; j++) {
+            query_data[j] = distrib_real(rng);
+        }
+        CountingStopCondition<dist_t> adaptive(k, k, max_num_candidates, patience);
+        alg_hnsw.searchStopConditionClosest(query_data.data(), adaptive);
+        CountingStopCondition<dist_t> full(k, k, max_num_candidates, std::numeric_limits<size_t>::max());
+        alg_hnsw.searchStopConditionClosest(query_data.data(), full);
+        EXPECT_LE(adaptive.expansions, full.expansions);
+        adaptive_expansions += adaptive.expansions;
+        full_expansions += full.expansions;
+    }
+    std::cout << "Expansions: " << adaptive_expansions << " adaptive, " << full_expansions << " without patience\n";
+    EXPECT_LT(adaptive_expansions, full_expansions / 2);
+}
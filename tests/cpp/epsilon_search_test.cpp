@@ -111,3 +111,37 @@ TEST(EpsilonSearchTest, MODULE_TEST) {
     delete alg_brute;
     delete alg_hnsw;
 }
+
+TEST(EpsilonSearchTest, ReturnsLabels) {
+    int dim = 16;
+    int max_elements = 1000;
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<dist_t> alg_hnsw(&space, max_elements);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib_real;
+    std::vector<float> data(dim * max_elements);
+    for (float &x : data) {
+        x = distrib_real(rng);
+    }
+    // labels differ from the internal ids
+    for (int i = 0; i < max_elements; i++) {
+        alg_hnsw.addPoint(data.data() + i * dim, 3 * i + 1);
+    }
+
+    for (int i = 0; i < max_elements; i += 10) {
+        hnswlib::EpsilonSearchStopCondition<dist_t> stop_condition(1.0f, 100, max_elements);
+        std::vector<std::pair<float, hnswlib::labeltype>> result =
+            alg_hnsw.searchStopConditionClosest(data.data() + i * dim, stop_condition);
+        ASSERT_FALSE(result.empty());
+        EXPECT_EQ(0, result[0].first);
+        EXPECT_EQ((hnswlib::labeltype) 3 * i + 1, result[0].second);
+        for (auto &item : result) {
+            ASSERT_EQ(1u, item.second % 3);
+            float dist = space.get_dist_func()(data.data() + i * dim, data.data() + (item.second / 3) * dim,
+                                               space.get_dist_func_param());
+            EXPECT_EQ(dist, item.first);
+        }
+    }
+}
@@ -143,6 +143,56 @@ void test_vs_recall(
         }
     }
 }
+float test_approx_adaptive(
+    float *massQ,
+    size_t qsize,
+    HierarchicalNSW<float> &appr_alg,
+    size_t vecdim,
+    vector<std::priority_queue<std::pair<float, labeltype>>> &answers,
+    size_t k,
+    size_t max_ef,
+    size_t patience) {
+    size_t correct = 0;
+    size_t total = 0;
+    for (int i = 0; i < qsize; i++) {
+        AdaptiveSearchStopCondition<float> stop_condition(k, k, max_ef, patience);
+        std::vector<std::pair<float, labeltype>> result =
+            appr_alg.searchStopConditionClosest(massQ + vecdim * i, stop_condition);
+        std::priority_queue<std::pair<float, labeltype >> gt(answers[i]);
+        unordered_set<labeltype> g;
+        total += gt.size();
+        while (gt.size()) {
+            g.insert(gt.top().second);
+            gt.pop();
+        }
+        for (auto &item : result) {
+            if (g.find(item.second) != g.end())
+                correct++;
+        }
+    }
+    return 1.0f * correct / total;
+}
+
+// adaptive early termination against the fixed ef sweep of test_vs_recall, at the same
+// recall the mean time per query should be lower
+void test_vs_recall_adaptive(
+    float *massQ,
+    size_t qsize,
+    HierarchicalNSW<float> &appr_alg,
+    size_t vecdim,
+    vector<std::priority_queue<std::pair<float, labeltype>>> &answers,
+    size_t k) {
+    vector<size_t> patiences = { 2, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256 };
+    size_t max_ef = 2000;
+    cout << "patience\trecall\ttime (adaptive, max_ef=" << max_ef << ")\n";
+    for (size_t patience : patiences) {
+        StopW stopw = StopW();
+
+        float recall = test_approx_adaptive(massQ, qsize, appr_alg, vecdim, answers, k, max_ef, patience);
+        float time_us_per_query = stopw.getElapsedTimeMicro() / qsize;
+        cout << patience << "\t" << recall << "\t" << time_us_per_query << " us\n";
+    }
+}
 //void get_knn_quality(unsigned int *massA,size_t vecsize, size_t maxn, HierarchicalNSW<float> &appr_alg) {
 //    size_t total = 0;
 //    size_t correct = 0;
@@ -258,6 +308,7 @@ void sift_test() {
     cout << "Loaded gt\n";
     for (int i = 0; i < 1; i++)
         test_vs_recall(massQ, vecsize, qsize, appr_alg, vecdim, answers, k);
+    test_vs_recall_adaptive(massQ, qsize, appr_alg, vecdim, answers, k);
     //cout << "opt:\n";
     //appr_alg.opt = true;
 
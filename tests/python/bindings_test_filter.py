@@ -55,3 +55,13 @@ class RandomSelfTestCase(unittest.TestCase):
 
         labels, distances = bf_index.knn_query(data, k=1, filter=filter_function)
         self.assertEqual(np.mean(labels.reshape(-1) == np.arange(len(data))), .5)
+
+        print("Querying only even elements with a mask and with an array of labels")
+        # A mask or an array of labels is tested by internal id, without calling into python
+        mask = np.arange(num_elements) % 2 == 0
+        labels_mask, distances_mask = hnsw_index.knn_query(data, k=1, filter=mask)
+        self.assertTrue(np.max(np.mod(labels_mask, 2)) == 0)
+        labels_ids, distances_ids = hnsw_index.knn_query(data, k=1, filter=np.flatnonzero(mask))
+        np.testing.assert_array_equal(labels_mask, labels_ids)
+        labels_function, distances_function = hnsw_index.knn_query(data, k=1, num_threads=1, filter=filter_function)
+        np.testing.assert_array_equal(labels_function, labels_mask)
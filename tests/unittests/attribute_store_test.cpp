@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <cstdio>
+#include <set>
+#include <vector>
+
+namespace {
+
+// attributes of the element added i-th: tag = i % 10, lang = i % 3
+hnswlib::attributetype tagOf(size_t i) {
+    return i % 10;
+}
+
+hnswlib::attributetype langOf(size_t i) {
+    return i % 3;
+}
+
+}  // namespace
+
+class AttributeStoreTest : public RandomDataTest<> {
+ protected:
+    std::string path = "attributes_index.bin";
+
+    AttributeStoreTest() : RandomDataTest(2000, 0, 8) {}
+
+    void TearDown() override {
+        remove(path.c_str());
+        remove((path + ".attributes").c_str());
+    }
+
+    void build(hnswlib::HierarchicalNSW<float> &alg) {
+        alg.enableAttributes(2);
+        for (size_t i = 0; i < n; i++) {
+            hnswlib::attributetype attributes[2] = {tagOf(i), langOf(i)};
+            alg.addPoint(data.data() + i * dim, 10 * i, attributes);
+        }
+    }
+
+    // labels allowed by "tag in {3, 7} and lang == 2", given the alive labels
+    std::set<hnswlib::labeltype> expectedLabels(hnswlib::HierarchicalNSW<float> &alg) {
+        std::set<hnswlib::labeltype> labels;
+        for (size_t i = 0; i < n; i++) {
+            if ((tagOf(i) == 3 || tagOf(i) == 7) && langOf(i) == 2 && alg.label_lookup.find_label(10 * i) &&
+                !alg.isMarkedDeleted(alg.label_lookup.get_id(10 * i)))
+                labels.insert(10 * i);
+        }
+        return labels;
+    }
+
+    std::set<hnswlib::labeltype> filterLabels(hnswlib::HierarchicalNSW<float> &alg, const hnswlib::IdFilter &filter) {
+        std::set<hnswlib::labeltype> labels;
+        filter.forEachAllowed([&](hnswlib::tableint id) { labels.insert(alg.getExternalLabel(id)); });
+        return labels;
+    }
+};
+
+static const std::vector<hnswlib::AttributeCondition> conditions = {{0, {3, 7}}, {1, {2}}};
+
+TEST_F(AttributeStoreTest, FilterMatchesAttributes) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 100);
+    build(alg);
+    EXPECT_EQ((std::vector<hnswlib::attributetype>{7, 1}), alg.getAttributes(10 * 7));
+
+    hnswlib::IdFilter filter = alg.createAttributeFilter(conditions);
+    EXPECT_EQ(expectedLabels(alg), filterLabels(alg, filter));
+    EXPECT_EQ(n, alg.createAttributeFilter({}).count());
+    EXPECT_EQ(0u, alg.createAttributeFilter({{0, {42}}}).count());
+    EXPECT_THROW(alg.createAttributeFilter({{2, {0}}}), std::runtime_error);
+
+    alg.setEf(50);
+    for (size_t q = 0; q < 20; q++) {
+        auto result = alg.searchKnn(data.data() + q * dim, k, &filter);
+        EXPECT_EQ(k, result.size());
+        while (!result.empty()) {
+            EXPECT_EQ(1u, expectedLabels(alg).count(result.top().second));
+            result.pop();
+        }
+    }
+
+    // a changed element moves between postings
+    hnswlib::attributetype attributes[2] = {3, 2};
+    alg.setAttributes(10 * 1, attributes);
+    EXPECT_TRUE(alg.createAttributeFilter(conditions).isAllowed(alg.label_lookup.get_id(10)));
+}
+
+TEST_F(AttributeStoreTest, DeletionsUpdatePostings) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 100, 100, true);
+    build(alg);
+    // element 17 has tag 7 and lang 2
+    alg.markDelete(10 * 17);
+    EXPECT_EQ(expectedLabels(alg), filterLabels(alg, alg.createAttributeFilter(conditions)));
+    EXPECT_EQ(0u, expectedLabels(alg).count(10 * 17));
+    alg.unmarkDelete(10 * 17);
+    EXPECT_EQ(1u, filterLabels(alg, alg.createAttributeFilter(conditions)).count(10 * 17));
+
+    // a replacing element starts without attributes
+    alg.markDelete(10 * 17);
+    alg.addPoint(data.data(), 99999, true);
+    EXPECT_TRUE(alg.getAttributes(99999).empty());
+    EXPECT_EQ(expectedLabels(alg), filterLabels(alg, alg.createAttributeFilter(conditions)));
+    EXPECT_EQ(n - 1, alg.createAttributeFilter({}).count());
+}
+
+TEST_F(AttributeStoreTest, SurvivesSaveLoadResizeAndReorder) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 100);
+    build(alg);
+    alg.markDelete(10 * 17);
+    std::set<hnswlib::labeltype> expected = expectedLabels(alg);
+
+    for (bool page_aligned : {false, true}) {
+        alg.saveIndex(path, page_aligned);
+        hnswlib::HierarchicalNSW<float> loaded(&space, path, false, n + 100);
+        EXPECT_EQ(expected, filterLabels(loaded, loaded.createAttributeFilter(conditions)));
+        loaded.unmarkDelete(10 * 17);
+        EXPECT_EQ(1u, filterLabels(loaded, loaded.createAttributeFilter(conditions)).count(10 * 17));
+    }
+    hnswlib::HierarchicalNSW<float> mapped(&space);
+    mapped.mapIndex(path, &space);
+    EXPECT_EQ(expected, filterLabels(mapped, mapped.createAttributeFilter(conditions)));
+
+    alg.resizeIndex(2 * n);
+    hnswlib::attributetype attributes[2] = {3, 2};
+    alg.addPoint(data.data(), 123456, attributes);
+    expected.insert(123456);
+    hnswlib::IdFilter filter = alg.createAttributeFilter(conditions);
+    EXPECT_EQ(expected, filterLabels(alg, filter));
+
+    // reordering gives the ids to other elements, the old filter is rejected
+    alg.reorderIndex();
+    EXPECT_THROW(alg.searchKnn(data.data(), k, &filter), std::runtime_error);
+    filter = alg.createAttributeFilter(conditions);
+    EXPECT_EQ(expected, filterLabels(alg, filter));
+    alg.searchKnn(data.data(), k, &filter);
+    EXPECT_EQ((std::vector<hnswlib::attributetype>{5, 2}), alg.getAttributes(10 * 5));
+
+    // an index saved without attributes does not pick up stale ones
+    hnswlib::HierarchicalNSW<float> plain(&space, n, 16, 100);
+    plain.addPoint(data.data(), 1);
+    plain.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> plain_loaded(&space, path);
+    EXPECT_THROW(plain_loaded.createAttributeFilter({}), std::runtime_error);
+}
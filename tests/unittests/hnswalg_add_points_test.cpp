@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <cstdio>
+#include <set>
+#include <vector>
+
+class HnswAddPointsTest : public RandomDataTest<> {
+ protected:
+    std::vector<hnswlib::labeltype> labels;
+    std::string path = "add_points_index.bin";
+
+    // 5000 elements, the serial elements and a few rounds
+    HnswAddPointsTest() : RandomDataTest(5000, 100) {
+        for (size_t i = 0; i < n; i++) {
+            labels.push_back(3 * i);
+        }
+    }
+
+    void TearDown() override {
+        remove(path.c_str());
+    }
+
+    std::vector<char> saved(hnswlib::HierarchicalNSW<float> &alg) {
+        alg.saveIndex(path);
+        return read_file(path);
+    }
+
+    // the fraction of the exact k nearest neighbors found at ef 50
+    float recall(hnswlib::HierarchicalNSW<float> &alg) {
+        hnswlib::L2Space space(dim);
+        hnswlib::BruteforceSearch<float> brute(&space, n);
+        for (size_t i = 0; i < n; i++) {
+            brute.addPoint(data.data() + i * dim, labels[i]);
+        }
+        alg.setEf(50);
+        size_t found = 0;
+        for (size_t q = 0; q < nq; q++) {
+            std::set<hnswlib::labeltype> expected;
+            auto exact = brute.searchKnn(queries.data() + q * dim, k);
+            for (; !exact.empty(); exact.pop())
+                expected.insert(exact.top().second);
+            auto result = alg.searchKnn(queries.data() + q * dim, k);
+            for (; !result.empty(); result.pop())
+                found += expected.count(result.top().second);
+        }
+        return (float) found / (nq * k);
+    }
+};
+
+TEST_F(HnswAddPointsTest, DeterministicWhateverTheThreads) {
+    hnswlib::L2Space space(dim);
+    std::vector<char> reference;
+    for (size_t threads : {1, 3, 4}) {
+        hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 100, 7);
+        alg.addPoints(data.data(), labels.data(), n, threads, hnswlib::BUILD_DETERMINISTIC);
+        EXPECT_EQ(n, alg.getCurrentElementCount());
+        std::vector<char> graph = saved(alg);
+        if (reference.empty()) {
+            reference = graph;
+            EXPECT_GT(recall(alg), 0.9f);
+        } else {
+            EXPECT_TRUE(reference == graph) << threads << " threads";
+        }
+    }
+
+    // another seed makes another graph
+    hnswlib::HierarchicalNSW<float> other(&space, n, 16, 100, 8);
+    other.addPoints(data.data(), labels.data(), n, 4, hnswlib::BUILD_DETERMINISTIC);
+    EXPECT_FALSE(reference == saved(other));
+}
+
+TEST_F(HnswAddPointsTest, FastBuildAndUpdates) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 100);
+    alg.addPoints(data.data(), labels.data(), n, 4);
+    EXPECT_EQ(n, alg.getCurrentElementCount());
+    EXPECT_GT(recall(alg), 0.9f);
+    for (size_t i = 0; i < n; i += 97) {
+        std::vector<float> stored = alg.getDataByLabel<float>(labels[i]);
+        EXPECT_EQ(std::vector<float>(data.begin() + i * dim, data.begin() + (i + 1) * dim), stored);
+    }
+
+    // labels in the index or repeated in the input update their element
+    std::vector<float> moved(data.begin(), data.begin() + 2 * dim);
+    std::vector<hnswlib::labeltype> same = {labels[5], labels[5]};
+    for (hnswlib::BuildMode mode : {hnswlib::BUILD_FAST, hnswlib::BUILD_DETERMINISTIC}) {
+        alg.addPoints(moved.data(), same.data(), 2, 2, mode);
+        EXPECT_EQ(n, alg.getCurrentElementCount());
+        EXPECT_EQ(std::vector<float>(moved.begin() + dim, moved.end()), alg.getDataByLabel<float>(labels[5]));
+    }
+
+    std::vector<hnswlib::labeltype> extra = {1, 2};
+    EXPECT_THROW(alg.addPoints(moved.data(), extra.data(), 2, 2, hnswlib::BUILD_DETERMINISTIC), std::runtime_error);
+}
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+class HnswLayoutTest : public RandomDataTest<> {
+ protected:
+    HnswLayoutTest() : RandomDataTest(500, 20) {}
+
+    void fill(hnswlib::HierarchicalNSW<float> &alg, size_t from, size_t to) {
+        for (size_t i = from; i < to; i++) {
+            alg.addPoint(data.data() + i * dim, i * 3);
+        }
+    }
+};
+
+TEST_F(HnswLayoutTest, SplitMatchesInterleaved) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> interleaved(&space, n / 2);
+    hnswlib::HierarchicalNSW<float> split(&space, n / 2, 16, 200, 100, false, hnswlib::LEVEL0_SPLIT);
+    fill(interleaved, 0, n / 2);
+    fill(split, 0, n / 2);
+    // growing reallocates the three arrays separately
+    interleaved.resizeIndex(n);
+    split.resizeIndex(n);
+    fill(interleaved, n / 2, n);
+    fill(split, n / 2, n);
+
+    EXPECT_LT(split.size_data_per_element_, interleaved.size_data_per_element_);
+    for (size_t q = 0; q < nq; q++) {
+        const float *query = queries.data() + q * dim;
+        EXPECT_EQ(search(interleaved, query, k), search(split, query, k));
+    }
+    std::vector<float> vec = split.getDataByLabel<float>(7 * 3);
+    EXPECT_EQ(std::vector<float>(data.begin() + 7 * dim, data.begin() + 8 * dim), vec);
+}
+
+TEST_F(HnswLayoutTest, SplitSaveLoad) {
+    std::string path = "split_layout_index.bin";
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> split(&space, n, 16, 200, 100, false, hnswlib::LEVEL0_SPLIT);
+    fill(split, 0, n);
+    split.markDelete(5 * 3);
+    split.saveIndex(path);
+    EXPECT_EQ(split.indexFileSize(), file_size(path));
+
+    hnswlib::HierarchicalNSW<float> loaded(&space, path);
+    EXPECT_EQ(hnswlib::LEVEL0_SPLIT, loaded.level0_layout_);
+    EXPECT_EQ(1u, loaded.getDeletedCount());
+    for (size_t q = 0; q < nq; q++) {
+        const float *query = queries.data() + q * dim;
+        EXPECT_EQ(search(split, query, k), search(loaded, query, k));
+    }
+
+    hnswlib::L2Space other_space(dim + 1);
+    EXPECT_THROW(hnswlib::HierarchicalNSW<float>(&other_space, path), std::runtime_error);
+    remove(path.c_str());
+}
+
+TEST_F(HnswLayoutTest, LoadsIndexWithoutVersion) {
+    std::string path = "versioned_index.bin";
+    std::string old_path = "unversioned_index.bin";
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n);
+    fill(alg, 0, n);
+    alg.saveIndex(path);
+
+    // files written before the format version have the same content without the header
+    size_t header_size = sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(size_t);
+    std::vector<char> bytes = read_file(path);
+    std::ofstream output(old_path, std::ios::binary);
+    output.write(bytes.data() + header_size, bytes.size() - header_size);
+    output.close();
+
+    hnswlib::HierarchicalNSW<float> loaded(&space, old_path);
+    EXPECT_EQ(hnswlib::LEVEL0_INTERLEAVED, loaded.level0_layout_);
+    for (size_t q = 0; q < nq; q++) {
+        const float *query = queries.data() + q * dim;
+        EXPECT_EQ(search(alg, query, k), search(loaded, query, k));
+    }
+    remove(path.c_str());
+    remove(old_path.c_str());
+}
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+class HnswMmapTest : public RandomDataTest<testing::TestWithParam<hnswlib::Level0Layout>> {
+ protected:
+    std::string path = test_file_path("mapped_index.bin");
+
+    HnswMmapTest() : RandomDataTest(1000, 20) {}
+
+    void TearDown() override {
+        remove(path.c_str());
+    }
+};
+
+TEST_P(HnswMmapTest, MappedIndexMatchesBuiltIndex) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 200, 100, true, GetParam());
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i * 2);
+    }
+    alg.markDelete(4);
+    alg.markDelete(300);
+    alg.saveIndex(path, true);
+    EXPECT_EQ(alg.indexFileSize(true), file_size(path));
+
+    hnswlib::HierarchicalNSW<float> mapped(&space);
+    mapped.mapIndex(path, &space);
+    hnswlib::HierarchicalNSW<float> mapped_again(&space);
+    mapped_again.mapIndex(path, &space);
+    hnswlib::HierarchicalNSW<float> loaded(&space, path, false, n + 10, true);
+    EXPECT_EQ(GetParam(), mapped.level0_layout_);
+    EXPECT_EQ(2u, mapped.getDeletedCount());
+    EXPECT_EQ(2u, loaded.getDeletedCount());
+    for (size_t q = 0; q < nq; q++) {
+        const float *query = queries.data() + q * dim;
+        auto expected = search(alg, query, k);
+        EXPECT_EQ(expected, search(mapped, query, k));
+        EXPECT_EQ(expected, search(mapped_again, query, k));
+        EXPECT_EQ(expected, search(loaded, query, k));
+    }
+    EXPECT_EQ(std::vector<float>(data.begin() + 7 * dim, data.begin() + 8 * dim), mapped.getDataByLabel<float>(14));
+
+    // the mapping is read-only, a loaded copy is not
+    EXPECT_THROW(mapped.addPoint(data.data(), 5000), std::runtime_error);
+    EXPECT_THROW(mapped.markDelete(10), std::runtime_error);
+    EXPECT_THROW(mapped.unmarkDelete(4), std::runtime_error);
+    EXPECT_THROW(mapped.resizeIndex(2 * n), std::runtime_error);
+    EXPECT_THROW(mapped.reorderIndex(), std::runtime_error);
+    loaded.addPoint(data.data() + 7 * dim, 5000, true);
+    EXPECT_EQ(1u, loaded.getDeletedCount());
+    loaded.markDelete(10);
+}
+
+TEST_P(HnswMmapTest, RejectsStreamedAndTruncatedFiles) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 200, 100, false, GetParam());
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+    hnswlib::HierarchicalNSW<float> mapped(&space);
+    alg.saveIndex(path);
+    EXPECT_THROW(mapped.mapIndex(path, &space), std::runtime_error);
+
+    alg.saveIndex(path, true);
+    std::vector<char> bytes = read_file(path);
+    std::ofstream output(path, std::ios::binary);
+    output.write(bytes.data(), bytes.size() - 100);
+    output.close();
+    EXPECT_THROW(mapped.mapIndex(path, &space), std::runtime_error);
+    EXPECT_THROW(hnswlib::HierarchicalNSW<float>(&space, path), std::runtime_error);
+}
+
+TEST_P(HnswMmapTest, SaveOverMappedFileKeepsMapping) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 200, 100, false, GetParam());
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+    alg.saveIndex(path, true);
+    hnswlib::HierarchicalNSW<float> mapped(&space);
+    mapped.mapIndex(path, &space);
+
+    // a smaller index saved over the file must not cut the old mapping short
+    hnswlib::HierarchicalNSW<float> small(&space, 10, 16, 200, 100, false, GetParam());
+    for (size_t i = 0; i < 10; i++) {
+        small.addPoint(data.data() + i * dim, i);
+    }
+    small.saveIndex(path, true);
+    EXPECT_EQ(small.indexFileSize(true), file_size(path));
+    EXPECT_FALSE(std::ifstream(path + ".tmp").good());
+    for (size_t q = 0; q < nq; q++) {
+        const float *query = queries.data() + q * dim;
+        EXPECT_EQ(search(alg, query, k), search(mapped, query, k));
+    }
+    hnswlib::HierarchicalNSW<float> remapped(&space);
+    remapped.mapIndex(path, &space);
+    EXPECT_EQ(10u, remapped.getCurrentElementCount());
+}
+
+INSTANTIATE_TEST_SUITE_P(Layouts, HnswMmapTest,
+    testing::Values(hnswlib::LEVEL0_INTERLEAVED, hnswlib::LEVEL0_SPLIT));
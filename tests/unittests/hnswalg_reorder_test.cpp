@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <cstdio>
+#include <vector>
+
+class HnswReorderTest
+    : public RandomDataTest<testing::TestWithParam<std::tuple<hnswlib::ReorderMethod, hnswlib::Level0Layout>>> {
+ protected:
+    HnswReorderTest() : RandomDataTest(1000, 20) {}
+};
+
+TEST_P(HnswReorderTest, KeepsResults) {
+    hnswlib::ReorderMethod method = std::get<0>(GetParam());
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n + 1, 16, 200, 100, true, std::get<1>(GetParam()));
+    alg.setRerankSpace(&space);
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i + 10);
+    }
+    alg.markDelete(17);
+    alg.setEf(50);
+
+    std::vector<Results> before;
+    for (size_t q = 0; q < nq; q++) {
+        before.push_back(search(alg, queries.data() + q * dim, k));
+    }
+    alg.reorderIndex(method);
+    if (method == hnswlib::REORDER_BFS) {
+        EXPECT_EQ(0u, alg.enterpoint_node_);
+    }
+    for (size_t q = 0; q < nq; q++) {
+        EXPECT_EQ(before[q], search(alg, queries.data() + q * dim, k));
+    }
+    for (size_t i = 0; i < n; i += 97) {
+        EXPECT_EQ(std::vector<float>(data.begin() + i * dim, data.begin() + (i + 1) * dim),
+                  alg.getDataByLabel<float>(i + 10));
+    }
+
+    // the index stays usable: the deleted element is replaced and deletions still apply
+    const float *extra = queries.data();
+    EXPECT_EQ(1u, alg.getDeletedCount());
+    alg.addPoint(extra, n + 10, true);
+    EXPECT_EQ(0u, alg.getDeletedCount());
+    EXPECT_EQ(n, alg.getCurrentElementCount());
+    auto result = search(alg, extra, 1);
+    EXPECT_EQ(n + 10, result[0].second);
+    alg.markDelete(n + 10);
+    result = search(alg, extra, 1);
+    EXPECT_NE(n + 10, result[0].second);
+
+    std::string path = test_file_path("reordered_index.bin");
+    alg.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> loaded(&space, path);
+    loaded.setEf(50);
+    for (size_t q = 0; q < nq; q++) {
+        const float *query = queries.data() + q * dim;
+        EXPECT_EQ(search(alg, query, k), search(loaded, query, k));
+    }
+    remove(path.c_str());
+}
+
+INSTANTIATE_TEST_SUITE_P(Methods, HnswReorderTest,
+    testing::Combine(testing::Values(hnswlib::REORDER_BFS, hnswlib::REORDER_RCM),
+                     testing::Values(hnswlib::LEVEL0_INTERLEAVED, hnswlib::LEVEL0_SPLIT)));
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <vector>
+
+namespace {
+
+class LabelsBelow : public hnswlib::BaseFilterFunctor {
+    hnswlib::labeltype limit_;
+
+ public:
+    explicit LabelsBelow(hnswlib::labeltype limit) : limit_(limit) {}
+
+    bool operator()(hnswlib::labeltype label) {
+        return label < limit_;
+    }
+};
+
+}  // namespace
+
+class HnswSearchBatchTest : public RandomDataTest<testing::TestWithParam<hnswlib::VisitedMode>> {
+ protected:
+    // 37 queries, not a multiple of the interleaved group
+    HnswSearchBatchTest() : RandomDataTest(2000, 37) {}
+
+    void expectBatchMatches(hnswlib::HierarchicalNSW<float> &alg, hnswlib::BaseFilterFunctor *filter = nullptr) {
+        std::vector<std::pair<float, hnswlib::labeltype>> result(nq * k);
+        std::vector<size_t> counts(nq);
+        alg.searchKnnBatch(queries.data(), nq, k, result.data(), counts.data(), filter);
+        for (size_t q = 0; q < nq; q++) {
+            Results batch(result.begin() + q * k, result.begin() + q * k + counts[q]);
+            EXPECT_EQ(search(alg, queries.data() + q * dim, k, filter), batch);
+        }
+    }
+};
+
+TEST_P(HnswSearchBatchTest, MatchesSearchKnn) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n);
+    alg.setVisitedMode(GetParam());
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+    for (size_t ef : {10, 100}) {
+        alg.setEf(ef);
+        expectBatchMatches(alg);
+    }
+
+    // deletions and filters take the checked path
+    LabelsBelow filter(n / 10);
+    expectBatchMatches(alg, &filter);
+    for (size_t i = 0; i < n; i += 3) {
+        alg.markDelete(i);
+    }
+    expectBatchMatches(alg);
+}
+
+TEST_P(HnswSearchBatchTest, RerankedAndEmpty) {
+    hnswlib::L2Space space(dim);
+    hnswlib::L2SpaceSQ8 sq8(dim);
+    sq8.train(data.data(), n);
+    hnswlib::HierarchicalNSW<float> alg(&sq8, n);
+    alg.setVisitedMode(GetParam());
+    alg.setRerankSpace(&space);
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+    expectBatchMatches(alg);
+
+    hnswlib::HierarchicalNSW<float> empty(&space, 10);
+    std::vector<std::pair<float, hnswlib::labeltype>> result(nq * k);
+    std::vector<size_t> counts(nq, 1);
+    empty.searchKnnBatch(queries.data(), nq, k, result.data(), counts.data());
+    EXPECT_EQ(std::vector<size_t>(nq, 0), counts);
+    alg.searchKnnBatch(queries.data(), 0, k, result.data(), counts.data());
+}
+
+INSTANTIATE_TEST_SUITE_P(VisitedModes, HnswSearchBatchTest,
+    testing::Values(hnswlib::VISITED_DENSE, hnswlib::VISITED_SPARSE));
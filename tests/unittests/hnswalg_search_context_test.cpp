@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <atomic>
+#include <new>
+#include <vector>
+
+namespace {
+
+std::atomic<bool> count_allocations{false};
+std::atomic<size_t> allocations{0};
+
+class EvenLabels : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(hnswlib::labeltype label) {
+        return label % 2 == 0;
+    }
+};
+
+}  // namespace
+
+void *operator new(size_t size) {
+    if (count_allocations)
+        allocations++;
+    void *ptr = malloc(size);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+class HnswSearchContextTest : public RandomDataTest<> {
+ protected:
+    HnswSearchContextTest() : RandomDataTest(1000, 20) {}
+};
+
+TEST_F(HnswSearchContextTest, MatchesSearchKnn) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n);
+    alg.setRerankSpace(&space);
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+    hnswlib::HierarchicalNSW<float>::SearchContext context;
+    std::vector<std::pair<float, hnswlib::labeltype>> result(k);
+    EvenLabels even;
+    for (size_t q = 0; q < nq; q++) {
+        const float *query = queries.data() + q * dim;
+        size_t count = alg.searchKnn(query, k, context, result.data());
+        EXPECT_EQ(search(alg, query, k), Results(result.begin(), result.begin() + count));
+        count = alg.searchKnn(query, k, context, result.data(), &even);
+        EXPECT_EQ(search(alg, query, k, &even), Results(result.begin(), result.begin() + count));
+    }
+    alg.markDelete(3);
+    size_t count = alg.searchKnn(data.data() + 3 * dim, 1, context, result.data());
+    ASSERT_EQ(1u, count);
+    EXPECT_NE(3u, result[0].second);
+    EXPECT_EQ(search(alg, data.data() + 3 * dim, 1)[0], result[0]);
+
+    hnswlib::HierarchicalNSW<float> empty(&space, 10);
+    EXPECT_EQ(0u, empty.searchKnn(queries.data(), k, context, result.data()));
+}
+
+TEST_F(HnswSearchContextTest, NoAllocationsOnceWarm) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n);
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+    alg.setEf(50);
+    hnswlib::HierarchicalNSW<float>::SearchContext context;
+    std::vector<std::pair<float, hnswlib::labeltype>> result(k);
+    for (size_t q = 0; q < nq; q++) {
+        alg.searchKnn(queries.data() + q * dim, k, context, result.data());
+    }
+
+    allocations = 0;
+    count_allocations = true;
+    for (size_t q = 0; q < nq; q++) {
+        alg.searchKnn(queries.data() + q * dim, k, context, result.data());
+    }
+    count_allocations = false;
+    EXPECT_EQ(0u, allocations.load());
+
+    // searchKnn allocates its heaps and result on every query
+    count_allocations = true;
+    alg.searchKnn(queries.data(), k);
+    count_allocations = false;
+    EXPECT_LT(0u, allocations.load());
+}
+
+TEST_F(HnswSearchContextTest, CollectsStats) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n);
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+    alg.setEf(50);
+    hnswlib::HierarchicalNSW<float>::SearchContext context;
+    std::vector<std::pair<float, hnswlib::labeltype>> result(k);
+    for (size_t q = 0; q < nq; q++) {
+        const float *query = queries.data() + q * dim;
+        hnswlib::SearchStats stats;
+        auto with_stats = alg.searchKnnWithStats(query, k, stats);
+        auto without = alg.searchKnn(query, k);
+        ASSERT_EQ(without.size(), with_stats.size());
+        EXPECT_EQ(without.top(), with_stats.top());
+        EXPECT_EQ((size_t) alg.maxlevel_, stats.levels_descended);
+        EXPECT_GE(stats.hops, stats.levels_descended);
+        // every visited element had its distance computed, the upper levels add more
+        EXPECT_GT(stats.visited_nodes, 50u);
+        EXPECT_GT(stats.distance_computations, stats.visited_nodes);
+        EXPECT_GE(stats.heap_pushes, 50u);
+
+        size_t count = alg.searchKnn<true>(query, k, context, result.data());
+        EXPECT_EQ(search(alg, query, k), Results(result.begin(), result.begin() + count));
+        EXPECT_EQ(stats.hops, context.stats.hops);
+        EXPECT_EQ(stats.distance_computations, context.stats.distance_computations);
+        EXPECT_EQ(stats.visited_nodes, context.stats.visited_nodes);
+        EXPECT_EQ(stats.heap_pushes, context.stats.heap_pushes);
+    }
+
+    // without collect_metrics nothing is counted
+    context.stats.hops = 7;
+    alg.searchKnn(queries.data(), k, context, result.data());
+    EXPECT_EQ(7u, context.stats.hops);
+}
@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <random>
+#include <vector>
+
+namespace {
+
+class LabelFilter : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(hnswlib::labeltype label) override {
+        return label % 3 == 0;
+    }
+};
+
+}  // namespace
+
+TEST(IdFilterTest, BitsAndCount) {
+    hnswlib::IdFilter filter(130);
+    EXPECT_EQ(0u, filter.count());
+    filter.allow(0);
+    filter.allow(64);
+    filter.allow(129);
+    filter.allow(129);
+    EXPECT_EQ(3u, filter.count());
+    EXPECT_TRUE(filter.isAllowed(64));
+    EXPECT_FALSE(filter.isAllowed(65));
+    EXPECT_FALSE(filter.isAllowed(1000));
+    EXPECT_THROW(filter.allow(130), std::runtime_error);
+
+    filter.resize(100);
+    EXPECT_EQ(2u, filter.count());
+    EXPECT_FALSE(filter.isAllowed(129));
+    filter.resize(200);
+    EXPECT_FALSE(filter.isAllowed(129));
+    EXPECT_TRUE(filter.isAllowed(64));
+}
+
+TEST(IdFilterTest, MatchesLabelFilter) {
+    size_t dim = 16;
+    size_t n = 3000;
+    size_t k = 10;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, n * dim);
+
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n + 10, 16, 200);
+    // labels differ from the internal ids
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, 7 * i);
+    }
+    alg.markDelete(7 * 30);
+    alg.setEf(50);
+
+    std::vector<hnswlib::labeltype> labels;
+    for (size_t i = 0; i < n; i++) {
+        if ((7 * i) % 3 == 0)
+            labels.push_back(7 * i);
+    }
+    labels.push_back(1);  // not in the index
+    hnswlib::IdFilter id_filter = alg.createIdFilter(labels.data(), labels.size());
+    EXPECT_EQ(n / 3 - 1, id_filter.count());  // without the deleted 7 * 30
+    LabelFilter label_filter;
+
+    hnswlib::HierarchicalNSW<float>::SearchContext context;
+    std::vector<std::pair<float, hnswlib::labeltype>> result(k);
+    std::vector<std::pair<float, hnswlib::labeltype>> batch_result(n / 10 * k);
+    std::vector<size_t> counts(n / 10);
+    alg.searchKnnBatch(data.data(), n / 10, k, batch_result.data(), counts.data(), &id_filter);
+    for (size_t q = 0; q < n / 10; q++) {
+        const float *query = data.data() + q * dim;
+        Results expected = closerFirst(alg.searchKnn(query, k, &label_filter));
+        ASSERT_EQ(k, expected.size());
+        for (auto &item : expected) {
+            EXPECT_EQ(0u, item.second % 3);
+            EXPECT_NE(7u * 30, item.second);
+        }
+        EXPECT_EQ(expected, closerFirst(alg.searchKnn(query, k, &id_filter)));
+        size_t count = alg.searchKnn(query, k, context, result.data(), &id_filter);
+        EXPECT_EQ(expected, Results(result.begin(), result.begin() + count));
+        ASSERT_EQ(k, counts[q]);
+        EXPECT_EQ(expected, Results(batch_result.begin() + q * k, batch_result.begin() + (q + 1) * k));
+    }
+
+    // elements added after the filter was built are not allowed
+    alg.addPoint(data.data(), 3 * 1000003);
+    Results filtered = closerFirst(alg.searchKnn(data.data(), k, &id_filter));
+    for (auto &item : filtered) {
+        EXPECT_NE(3u * 1000003, item.second);
+    }
+}
+
+TEST(IdFilterTest, ReplaceAndReorderInvalidateFilters) {
+    size_t dim = 16;
+    size_t n = 1000;
+    size_t k = 10;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, (n + 1) * dim);
+
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 200, 100, true);
+    std::vector<hnswlib::labeltype> labels;
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+        labels.push_back(i);
+    }
+    alg.markDelete(5);
+    hnswlib::IdFilter id_filter = alg.createIdFilter(labels.data(), labels.size());
+    EXPECT_EQ(n - 1, id_filter.count());
+    hnswlib::IdFilter by_hand(n);
+    by_hand.allow(5);
+    hnswlib::IdFilter combined = by_hand;
+    combined.unionWith(id_filter);
+    EXPECT_EQ(id_filter.generation(), combined.generation());
+    search(alg, data.data(), k, &id_filter);
+
+    // the new element takes the internal id of label 5, which the filter did not allow
+    const float *extra = data.data() + n * dim;
+    alg.addPoint(extra, n + 10, true);
+    EXPECT_THROW(search(alg, extra, k, &id_filter), std::runtime_error);
+    EXPECT_THROW(search(alg, extra, k, &combined), std::runtime_error);
+    hnswlib::HierarchicalNSW<float>::SearchContext context;
+    std::vector<std::pair<float, hnswlib::labeltype>> result(k);
+    EXPECT_THROW(alg.searchKnn(extra, k, context, result.data(), &id_filter), std::runtime_error);
+    std::vector<size_t> counts(1);
+    EXPECT_THROW(alg.searchKnnBatch(extra, 1, k, result.data(), counts.data(), &id_filter), std::runtime_error);
+    // a filter built by hand is the caller's to keep up to date
+    EXPECT_EQ(n + 10, search(alg, extra, 1, &by_hand)[0].second);
+
+    id_filter = alg.createIdFilter(labels.data(), labels.size());
+    for (auto &item : search(alg, extra, k, &id_filter)) {
+        EXPECT_NE(n + 10, item.second);
+    }
+
+    alg.reorderIndex();
+    EXPECT_THROW(search(alg, extra, k, &id_filter), std::runtime_error);
+    id_filter = alg.createIdFilter(labels.data(), labels.size());
+    EXPECT_EQ(k, search(alg, extra, k, &id_filter).size());
+}
+
+TEST(IdFilterTest, SelectiveFilterScansAllowedElements) {
+    size_t dim = 16;
+    size_t n = 20000;
+    size_t k = 10;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, n * dim);
+
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 100);
+    hnswlib::BruteforceSearch<float> brute(&space, n);
+    std::vector<hnswlib::labeltype> labels;
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, 5 * i);
+        if (i % 200 == 0) {
+            labels.push_back(5 * i);
+            brute.addPoint(data.data() + i * dim, 5 * i);
+        }
+    }
+    alg.markDelete(labels[3]);
+    brute.removePoint(labels[3]);
+    hnswlib::IdFilter id_filter = alg.createIdFilter(labels.data(), labels.size());
+
+    // 100 allowed elements of 20000 are far below the graph search threshold
+    hnswlib::HierarchicalNSW<float>::SearchContext context;
+    std::vector<std::pair<float, hnswlib::labeltype>> result(k);
+    for (size_t q = 0; q < 50; q++) {
+        const float *query = data.data() + (7 * q + 1) * dim;
+        Results expected = closerFirst(brute.searchKnn(query, k));
+        hnswlib::SearchStats stats;
+        EXPECT_EQ(expected, closerFirst(alg.searchKnnWithStats(query, k, stats, &id_filter)));
+        EXPECT_EQ(0u, stats.hops);
+        EXPECT_EQ(labels.size() - 1, stats.distance_computations);
+        size_t count = alg.searchKnn(query, k, context, result.data(), &id_filter);
+        EXPECT_EQ(expected, Results(result.begin(), result.begin() + count));
+    }
+
+    // the modes force either search
+    alg.setFilterMode(hnswlib::FILTER_GRAPH);
+    hnswlib::SearchStats stats;
+    alg.searchKnnWithStats(data.data(), k, stats, &id_filter);
+    EXPECT_LT(0u, stats.hops);
+
+    hnswlib::IdFilter all_filter(n);
+    for (hnswlib::tableint id = 0; id < n; id++) {
+        all_filter.allow(id);
+    }
+    alg.setFilterMode(hnswlib::FILTER_SCAN);
+    alg.searchKnnWithStats(data.data(), k, stats, &all_filter);
+    EXPECT_EQ(0u, stats.hops);
+    EXPECT_EQ(n - 1, stats.distance_computations);
+}
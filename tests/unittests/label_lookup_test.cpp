@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include <thread>
+#include <vector>
+
+TEST(LabelLookupTest, AddFindReplace) {
+    hnswlib::LabelLookup lookup;
+    // labels are 64-bit, these differ only above the low 32 bits
+    hnswlib::labeltype big = (hnswlib::labeltype) 1 << 40;
+    lookup.add_label(7, 1);
+    lookup.add_label(big + 7, 2);
+    EXPECT_TRUE(lookup.find_label(7));
+    EXPECT_TRUE(lookup.find_label(big + 7));
+    EXPECT_FALSE(lookup.find_label(8));
+    EXPECT_EQ(1u, lookup.get_id(7));
+    EXPECT_EQ(2u, lookup.find_label_get_id(big + 7));
+    EXPECT_THROW(lookup.find_label_get_id(8), std::runtime_error);
+
+    lookup.replace_label(7, 8, 1);
+    EXPECT_FALSE(lookup.find_label(7));
+    EXPECT_EQ(1u, lookup.find_label_get_id(8));
+
+    lookup.clear();
+    EXPECT_FALSE(lookup.find_label(8));
+    EXPECT_FALSE(lookup.find_label(big + 7));
+}
+
+TEST(LabelLookupTest, ConcurrentWritersAndReaders) {
+    hnswlib::LabelLookup lookup;
+    size_t num_threads = 4;
+    size_t per_thread = 20000;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < per_thread; i++) {
+                hnswlib::labeltype label = i * num_threads + t;
+                lookup.add_label(label * 1000, (hnswlib::tableint) label);
+                // labels written by this thread stay visible while the others write
+                hnswlib::labeltype earlier = (i / 2) * num_threads + t;
+                ASSERT_EQ(earlier, lookup.find_label_get_id(earlier * 1000));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (hnswlib::labeltype label = 0; label < num_threads * per_thread; label++) {
+        ASSERT_EQ(label, lookup.get_id(label * 1000));
+    }
+}
@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include <thread>
+#include <vector>
+
+TEST(LinkArenaTest, AllocationsAreZeroedAndStable) {
+    hnswlib::LinkArena arena;
+    size_t n = 20000;
+    arena.resize(n);
+    // 20000 * 100 bytes spans two chunks, the 3 MiB allocation takes three more
+    for (hnswlib::tableint i = 0; i < n; i++) {
+        size_t size = i == 12345 ? 3 << 20 : 100;
+        char *links = arena.allocate(i, size);
+        for (size_t j = 0; j < size; j += 97) {
+            ASSERT_EQ(0, links[j]);
+        }
+        memset(links, i % 251, size);
+    }
+    for (hnswlib::tableint i = 0; i < n; i++) {
+        size_t size = i == 12345 ? 3 << 20 : 100;
+        char *links = arena.get(i);
+        EXPECT_EQ((char) (i % 251), links[0]);
+        EXPECT_EQ((char) (i % 251), links[size - 1]);
+    }
+
+    // growing the offset table keeps the lists
+    arena.resize(2 * n);
+    EXPECT_EQ((char) (7 % 251), arena.get(7)[99]);
+}
+
+TEST(LinkArenaTest, UsesBlocksInPlace) {
+    hnswlib::LinkArena arena;
+    arena.resize(3);
+    arena.allocate(0, 16);
+    std::vector<char> block(3 << 20);
+    block[0] = 1;
+    block[(2 << 20) + 5] = 2;
+    size_t offset = arena.addBlock(block.data(), block.size(), false);
+    arena.setOffset(1, offset);
+    arena.setOffset(2, offset + (2 << 20));
+    EXPECT_EQ(block.data(), arena.get(1));
+    EXPECT_EQ(block.data() + (2 << 20), arena.get(2));
+    EXPECT_EQ(2, arena.get(2)[5]);
+    EXPECT_EQ(offset + (2 << 20), arena.getOffset(2));
+}
+
+TEST(LinkArenaTest, ConcurrentAllocations) {
+    hnswlib::LinkArena arena;
+    size_t num_threads = 4;
+    size_t per_thread = 50000;
+    arena.resize(num_threads * per_thread);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < per_thread; i++) {
+                hnswlib::tableint id = t * per_thread + i;
+                char *links = arena.allocate(id, 68);
+                memcpy(links, &id, sizeof(id));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (hnswlib::tableint id = 0; id < num_threads * per_thread; id++) {
+        hnswlib::tableint stored;
+        memcpy(&stored, arena.get(id), sizeof(stored));
+        ASSERT_EQ(id, stored);
+    }
+}
@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <cstdio>
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+class NamespaceTest : public RandomDataTest<> {
+ protected:
+    std::string path = "namespaces_index.bin";
+
+    NamespaceTest() : RandomDataTest(10000, 0) {}
+
+    void TearDown() override {
+        remove(path.c_str());
+        remove((path + ".namespaces").c_str());
+    }
+
+    // the exact k closest elements of the namespace, among those the index has alive
+    Results exact(hnswlib::HierarchicalNSW<float> &alg, const float *query, hnswlib::namespacetype ns,
+                  hnswlib::BaseFilterFunctor *filter = nullptr) {
+        hnswlib::L2Space space(dim);
+        hnswlib::BruteforceSearch<float> brute(&space, n);
+        for (size_t i = 0; i < n; i++) {
+            hnswlib::tableint id;
+            if (!alg.label_lookup.try_get_id(i, id) || alg.isMarkedDeleted(id) || alg.getNamespace(i) != ns)
+                continue;
+            if (!filter || (*filter)(i))
+                brute.addPoint(data.data() + i * dim, i);
+        }
+        return closerFirst(brute.searchKnn(query, k));
+    }
+};
+
+class ThirdLabels : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(hnswlib::labeltype label) override {
+        return label % 3 == 0;
+    }
+};
+
+TEST_F(NamespaceTest, SmallNamespacesAreScanned) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 100);
+    alg.enableNamespaces();
+    // 100 tenants of about 85 elements, and elements without a namespace
+    for (size_t i = 0; i < n; i++) {
+        if (i % 7 == 6)
+            alg.addPoint(data.data() + i * dim, i);
+        else
+            alg.addPointToNamespace(data.data() + i * dim, i, i % 100);
+    }
+    alg.markDelete(100 * 7 + 3);
+    EXPECT_EQ(hnswlib::NO_NAMESPACE, alg.getNamespace(6));
+    alg.setEf(k);
+
+    hnswlib::HierarchicalNSW<float>::SearchContext context;
+    std::vector<std::pair<float, hnswlib::labeltype>> result(k);
+    ThirdLabels third;
+    for (hnswlib::namespacetype ns = 0; ns < 20; ns++) {
+        const float *query = data.data() + (n - 1 - ns) * dim;
+        hnswlib::NamespaceFilter filter = alg.createNamespaceFilter(ns);
+        Results expected = exact(alg, query, ns);
+        ASSERT_EQ(k, expected.size());
+        hnswlib::SearchStats stats;
+        EXPECT_EQ(expected, closerFirst(alg.searchKnnWithStats(query, k, stats, &filter)));
+        EXPECT_EQ(0u, stats.hops);
+        size_t count = alg.searchKnn(query, k, context, result.data(), &filter);
+        EXPECT_EQ(expected, Results(result.begin(), result.begin() + count));
+
+        // a filter within the namespace
+        hnswlib::NamespaceFilter third_filter = alg.createNamespaceFilter(ns, &third);
+        EXPECT_EQ(exact(alg, query, ns, &third), closerFirst(alg.searchKnn(query, k, &third_filter)));
+    }
+    hnswlib::NamespaceFilter unknown = alg.createNamespaceFilter(1000);
+    EXPECT_TRUE(alg.searchKnn(data.data(), k, &unknown).empty());
+}
+
+TEST_F(NamespaceTest, SearchesRunWhileElementsMove) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 100);
+    alg.enableNamespaces();
+    // namespace 0 is searched through the graph, 1 to 10 are scanned
+    auto namespaceOf = [](size_t i, size_t round) { return (i + round) % 2 ? 1 + (i + round) / 2 % 10 : 0; };
+    for (size_t i = 0; i < n; i++) {
+        alg.addPointToNamespace(data.data() + i * dim, i, namespaceOf(i, 0));
+    }
+
+    // the searches share the namespace store with a thread moving elements between tenants
+    std::atomic<bool> done{false};
+    std::vector<std::thread> searchers;
+    for (size_t t = 0; t < 3; t++) {
+        searchers.emplace_back([&, t]() {
+            hnswlib::HierarchicalNSW<float>::SearchContext context;
+            std::vector<std::pair<float, hnswlib::labeltype>> result(k);
+            for (size_t q = 0; !done; q++) {
+                hnswlib::NamespaceFilter filter = alg.createNamespaceFilter((t + q) % 11);
+                size_t count = alg.searchKnn(data.data() + q % n * dim, k, context, result.data(), &filter);
+                EXPECT_LE(count, k);
+            }
+        });
+    }
+    for (size_t round = 1; round <= 20; round++) {
+        for (size_t i = 0; i < 1000; i++) {
+            alg.setNamespace(i, namespaceOf(i, round));
+        }
+    }
+    done = true;
+    for (std::thread &searcher : searchers) {
+        searcher.join();
+    }
+
+    for (hnswlib::namespacetype ns = 0; ns <= 10; ns++) {
+        hnswlib::NamespaceFilter filter = alg.createNamespaceFilter(ns);
+        const float *query = data.data() + ns * dim;
+        Results result = closerFirst(alg.searchKnn(query, k, &filter));
+        ASSERT_EQ(k, result.size());
+        for (auto &item : result) {
+            EXPECT_EQ(ns, alg.getNamespace(item.second));
+        }
+        if (ns > 0)
+            EXPECT_EQ(exact(alg, query, ns), result);
+    }
+}
+
+TEST_F(NamespaceTest, LargeNamespacesSearchTheGraph) {
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n, 16, 100);
+    alg.enableNamespaces();
+    // two tenants of 5000 elements, too many to scan at ef 10
+    for (size_t i = 0; i < n; i++) {
+        alg.addPointToNamespace(data.data() + i * dim, i, i % 2);
+    }
+    alg.setEf(k);
+
+    size_t nq = 100;
+    std::vector<std::pair<float, hnswlib::labeltype>> batch_result(nq * k);
+    std::vector<size_t> counts(nq);
+    hnswlib::NamespaceFilter filter = alg.createNamespaceFilter(1);
+    alg.searchKnnBatch(data.data(), nq, k, batch_result.data(), counts.data(), &filter);
+    size_t found = 0;
+    for (size_t q = 0; q < nq; q++) {
+        const float *query = data.data() + q * dim;
+        hnswlib::SearchStats stats;
+        Results result = closerFirst(alg.searchKnnWithStats(query, k, stats, &filter));
+        EXPECT_LT(0u, stats.hops);
+        ASSERT_EQ(k, result.size());
+        for (auto &item : result) {
+            EXPECT_EQ(1u, item.second % 2);
+        }
+        ASSERT_EQ(k, counts[q]);
+        EXPECT_EQ(result, Results(batch_result.begin() + q * k, batch_result.begin() + (q + 1) * k));
+
+        std::set<hnswlib::labeltype> expected;
+        for (auto &item : exact(alg, query, 1))
+            expected.insert(item.second);
+        for (auto &item : result)
+            found += expected.count(item.second);
+    }
+    EXPECT_GT((float) found / (nq * k), 0.9f);
+}
+
+TEST_F(NamespaceTest, SurvivesChangesSaveLoadAndReorder) {
+    hnswlib::L2Space space(dim);
+    size_t m = 2000;
+    hnswlib::HierarchicalNSW<float> alg(&space, m, 16, 100, 100, true);
+    alg.enableNamespaces();
+    for (size_t i = 0; i < m; i++) {
+        alg.addPointToNamespace(data.data() + i * dim, i, i % 50);
+    }
+    alg.setEf(k);
+    const float *query = data.data() + (n - 1) * dim;
+
+    // moved and replaced elements leave their namespace
+    alg.setNamespace(3, 7);
+    EXPECT_EQ(7u, alg.getNamespace(3));
+    alg.markDelete(57);
+    alg.addPoint(data.data() + (n - 2) * dim, 57000, true);
+    EXPECT_EQ(hnswlib::NO_NAMESPACE, alg.getNamespace(57000));
+    Results expected = exact(alg, query, 7);
+    hnswlib::NamespaceFilter filter = alg.createNamespaceFilter(7);
+    EXPECT_EQ(expected, closerFirst(alg.searchKnn(query, k, &filter)));
+
+    for (bool page_aligned : {false, true}) {
+        alg.saveIndex(path, page_aligned);
+        hnswlib::HierarchicalNSW<float> loaded(&space, path);
+        loaded.setEf(k);
+        hnswlib::NamespaceFilter loaded_filter = loaded.createNamespaceFilter(7);
+        EXPECT_EQ(expected, closerFirst(loaded.searchKnn(query, k, &loaded_filter)));
+    }
+    hnswlib::HierarchicalNSW<float> mapped(&space);
+    mapped.mapIndex(path, &space);
+    mapped.setEf(k);
+    hnswlib::NamespaceFilter mapped_filter = mapped.createNamespaceFilter(7);
+    EXPECT_EQ(expected, closerFirst(mapped.searchKnn(query, k, &mapped_filter)));
+
+    alg.reorderIndex();
+    EXPECT_EQ(expected, closerFirst(alg.searchKnn(query, k, &filter)));
+    EXPECT_EQ(7u, alg.getNamespace(3));
+
+    // an index saved without namespaces does not pick up stale ones
+    hnswlib::HierarchicalNSW<float> plain(&space, m, 16, 100);
+    plain.addPoint(data.data(), 1);
+    plain.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> plain_loaded(&space, path);
+    EXPECT_THROW(plain_loaded.createNamespaceFilter(0), std::runtime_error);
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+
+const size_t kDims[] = {1, 63, 64, 65, 128, 300, 512, 520, 1024};
+
+}  // namespace
+
+TEST(SpaceBinaryTest, KernelsMatchScalar) {
+    std::mt19937 rng(47);
+    for (size_t dim : kDims) {
+        hnswlib::BinarySpace space(dim);
+        EXPECT_EQ((dim + 63) / 64 * 8, space.get_data_size());
+        std::vector<uint64_t> ca((dim + 63) / 64), cb((dim + 63) / 64);
+        for (int iter = 0; iter < 10; ++iter) {
+            std::vector<float> a = random_vector(rng, dim);
+            std::vector<float> b = random_vector(rng, dim);
+            space.encode(a.data(), ca.data());
+            space.encode(b.data(), cb.data());
+
+            float expected = 0;
+            for (size_t i = 0; i < dim; i++) {
+                expected += (a[i] > 0) != (b[i] > 0);
+            }
+            EXPECT_EQ(expected, hnswlib::Hamming(ca.data(), cb.data(), space.get_dist_func_param())) << "dim=" << dim;
+            EXPECT_EQ(expected, space.get_dist_func()(ca.data(), cb.data(), space.get_dist_func_param())) << "dim=" << dim;
+        }
+    }
+}
+
+TEST(SpaceBinaryTest, EncodeDecode) {
+    size_t dim = 70;
+    std::mt19937 rng(47);
+    std::vector<float> v = random_vector(rng, dim);
+    hnswlib::BinarySpace space(dim);
+    std::vector<uint64_t> code(2);
+    std::vector<float> decoded(dim);
+    space.encode(v.data(), code.data());
+    space.decode(code.data(), decoded.data());
+    for (size_t i = 0; i < dim; i++) {
+        EXPECT_EQ(v[i] > 0 ? 1.0f : -1.0f, decoded[i]);
+    }
+}
+
+TEST(SpaceBinaryTest, SearchWithRerank) {
+    size_t dim = 128;
+    int n = 2000;
+    int k = 10;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, dim * n);
+    std::vector<float> queries = random_vector(rng, dim * 20);
+
+    hnswlib::InnerProductSpace float_space(dim);
+    hnswlib::BinarySpace space(dim);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    alg_hnsw.setRerankSpace(&float_space);
+    hnswlib::BruteforceSearch<float> alg_brute(&float_space, n);
+    for (int i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + i * dim, i);
+        alg_brute.addPoint(data.data() + i * dim, i);
+    }
+
+    // a wide candidate list makes up for the coarse Hamming distances
+    alg_hnsw.setEf(400);
+    int correct = 0;
+    for (int q = 0; q < 20; q++) {
+        const float *query = queries.data() + q * dim;
+        auto gt = alg_brute.searchKnn(query, k);
+        std::vector<hnswlib::labeltype> expected;
+        while (!gt.empty()) {
+            expected.push_back(gt.top().second);
+            gt.pop();
+        }
+        auto result = alg_hnsw.searchKnn(query, k);
+        while (!result.empty()) {
+            // the distance of the kernel the rerank uses, whose summation order depends on the CPU
+            float exact = float_space.get_dist_func()(query, data.data() + result.top().second * dim,
+                                                      float_space.get_dist_func_param());
+            EXPECT_FLOAT_EQ(exact, result.top().first);
+            if (std::find(expected.begin(), expected.end(), result.top().second) != expected.end())
+                correct++;
+            result.pop();
+        }
+    }
+    EXPECT_GT(correct, 0.6 * 20 * k);
+}
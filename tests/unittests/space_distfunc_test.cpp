@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+
+// every dimension class of the dispatch table: multiples of 16 and 4, residuals and tiny vectors,
+// and the fixed-dimension kernels (96, 128, 768, 1536)
+const size_t kDims[] = {1, 3, 4, 7, 8, 12, 16, 17, 20, 31, 32, 48, 64, 96, 100, 128, 130, 768, 1536};
+
+}  // namespace
+
+TEST(SpaceDistFuncTest, L2MatchesScalar) {
+    std::mt19937 rng(47);
+    for (size_t dim : kDims) {
+        hnswlib::L2Space space(dim);
+        hnswlib::DISTFUNC<float> distfunc = space.get_dist_func();
+        for (int iter = 0; iter < 10; ++iter) {
+            std::vector<float> a = random_vector(rng, dim);
+            std::vector<float> b = random_vector(rng, dim);
+            float expected = hnswlib::L2Sqr(a.data(), b.data(), &dim);
+            float actual = distfunc(a.data(), b.data(), space.get_dist_func_param());
+            EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + expected)) << "dim=" << dim;
+        }
+    }
+}
+
+TEST(SpaceDistFuncTest, InnerProductMatchesScalar) {
+    std::mt19937 rng(47);
+    for (size_t dim : kDims) {
+        hnswlib::InnerProductSpace space(dim);
+        hnswlib::DISTFUNC<float> distfunc = space.get_dist_func();
+        for (int iter = 0; iter < 10; ++iter) {
+            std::vector<float> a = random_vector(rng, dim);
+            std::vector<float> b = random_vector(rng, dim);
+            float expected = hnswlib::InnerProductDistance(a.data(), b.data(), &dim);
+            float actual = distfunc(a.data(), b.data(), space.get_dist_func_param());
+            EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + std::abs(expected))) << "dim=" << dim;
+        }
+    }
+}
+
+TEST(SpaceDistFuncTest, DispatchTableIsShared) {
+    // spaces of the same dimension class resolve to the same kernel
+    hnswlib::L2Space space1(32), space2(64);
+    EXPECT_EQ(space1.get_dist_func(), space2.get_dist_func());
+    EXPECT_EQ(space1.get_dist_func(), hnswlib::L2SqrDistFuncTable().simd16);
+}
+
+TEST(SpaceDistFuncTest, FixedDimKernelIsPreferred) {
+    hnswlib::L2Space space768(768), space784(784);
+    hnswlib::InnerProductSpace ip_space768(768);
+#if defined(USE_SSE)
+    EXPECT_NE(space768.get_dist_func(), hnswlib::L2SqrDistFuncTable().simd16);
+    EXPECT_NE(ip_space768.get_dist_func(), hnswlib::InnerProductDistanceDistFuncTable().simd16);
+    // dimensions outside the list keep the generic kernels
+    EXPECT_EQ(space784.get_dist_func(), hnswlib::L2SqrDistFuncTable().simd16);
+#endif
+}
+
+template<typename Space>
+void check_batch_matches_single() {
+    std::mt19937 rng(47);
+    for (size_t dim : kDims) {
+        Space space(dim);
+        hnswlib::DISTFUNC_BATCH<float> batchfunc = space.get_batch_dist_func();
+        if (!batchfunc) continue;  // not compiled in or below the kernel width
+        EXPECT_EQ(batchfunc, space.get_query_batch_dist_func());
+
+        std::vector<float> query = random_vector(rng, dim);
+        std::vector<std::vector<float>> vectors;
+        std::vector<const void *> pointers;
+        for (int i = 0; i < 11; ++i) {  // two groups of four and a remainder
+            vectors.push_back(random_vector(rng, dim));
+        }
+        for (auto &v : vectors) {
+            pointers.push_back(v.data());
+        }
+        std::vector<float> dists(vectors.size());
+        batchfunc(query.data(), pointers.data(), pointers.size(), space.get_dist_func_param(), dists.data());
+        for (size_t i = 0; i < vectors.size(); ++i) {
+            float expected = space.get_dist_func()(query.data(), vectors[i].data(), space.get_dist_func_param());
+            EXPECT_NEAR(expected, dists[i], 1e-4 * (1.0f + std::abs(expected))) << "dim=" << dim;
+        }
+    }
+}
+
+TEST(SpaceDistFuncTest, L2BatchMatchesSingle) {
+    check_batch_matches_single<hnswlib::L2Space>();
+}
+
+TEST(SpaceDistFuncTest, InnerProductBatchMatchesSingle) {
+    check_batch_matches_single<hnswlib::InnerProductSpace>();
+}
+
+TEST(SpaceDistFuncTest, L2BoundedAbandonsAboveBound) {
+    std::mt19937 rng(47);
+    for (size_t dim : kDims) {
+        hnswlib::L2Space space(dim, true);
+        hnswlib::DISTFUNC_BOUNDED<float> boundedfunc = space.get_bounded_dist_func();
+        if (!boundedfunc) continue;  // not compiled in or too few dimensions to gain anything
+        for (int iter = 0; iter < 10; ++iter) {
+            std::vector<float> a = random_vector(rng, dim);
+            std::vector<float> b = random_vector(rng, dim);
+            float exact = space.get_dist_func()(a.data(), b.data(), space.get_dist_func_param());
+            float above = boundedfunc(a.data(), b.data(), space.get_dist_func_param(), exact * 1.01f);
+            EXPECT_NEAR(exact, above, 1e-4 * (1.0f + exact)) << "dim=" << dim;
+            float below = boundedfunc(a.data(), b.data(), space.get_dist_func_param(), exact * 0.5f);
+            EXPECT_GT(below, exact * 0.5f) << "dim=" << dim;
+            EXPECT_LE(below, exact * (1.0f + 1e-4f)) << "dim=" << dim;
+        }
+    }
+    hnswlib::L2Space default_space(1024);
+    EXPECT_EQ(nullptr, default_space.get_bounded_dist_func());
+    // inner product partial sums can decrease, so there is no bounded kernel
+    hnswlib::InnerProductSpace ip_space(128);
+    EXPECT_EQ(nullptr, ip_space.get_bounded_dist_func());
+}
+
+TEST(SpaceDistFuncTest, EarlyAbandonSearchRecall) {
+    size_t dim = 128;
+    int n = 500;
+    int k = 10;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, dim * n);
+    hnswlib::L2Space space(dim, true);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (int i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + i * dim, i);
+        alg_brute.addPoint(data.data() + i * dim, i);
+    }
+    alg_hnsw.setEf(100);
+    int correct = 0;
+    for (int q = 0; q < 20; q++) {
+        std::vector<float> query = random_vector(rng, dim);
+        auto result = alg_hnsw.searchKnn(query.data(), k);
+        auto gt = alg_brute.searchKnn(query.data(), k);
+        std::vector<hnswlib::labeltype> expected;
+        while (!gt.empty()) {
+            expected.push_back(gt.top().second);
+            gt.pop();
+        }
+        ASSERT_EQ((size_t) k, result.size());
+        while (!result.empty()) {
+            float exact = space.get_dist_func()(query.data(), data.data() + result.top().second * dim, &dim);
+            EXPECT_NEAR(exact, result.top().first, 1e-3);
+            if (std::find(expected.begin(), expected.end(), result.top().second) != expected.end())
+                correct++;
+            result.pop();
+        }
+    }
+    EXPECT_GT(correct, 0.9 * 20 * k);
+}
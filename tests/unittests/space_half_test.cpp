@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+
+template<typename Codec>
+std::vector<typename Codec::storage_t> encode(const std::vector<float> &v) {
+    std::vector<typename Codec::storage_t> out(v.size());
+    for (size_t i = 0; i < v.size(); ++i) {
+        out[i] = Codec::from_float(v[i]);
+    }
+    return out;
+}
+
+const size_t kDims[] = {1, 7, 8, 15, 16, 17, 33, 100, 128, 768};
+
+}  // namespace
+
+TEST(SpaceHalfTest, Float16Conversion) {
+    using hnswlib::Float16;
+    EXPECT_EQ(0x3c00, Float16::from_float(1.0f));
+    EXPECT_EQ(0xc000, Float16::from_float(-2.0f));
+    EXPECT_EQ(0x7bff, Float16::from_float(65504.0f));
+    EXPECT_EQ(0x7c00, Float16::from_float(1e6f));
+    EXPECT_EQ(0x0001, Float16::from_float(5.9604645e-8f));  // smallest subnormal
+    EXPECT_EQ(0x0000, Float16::from_float(1e-9f));
+    EXPECT_EQ(0x3c00, Float16::from_float(1.0f + 1.0f / 4096));  // tie rounds to even
+    EXPECT_EQ(0x3c02, Float16::from_float(1.0f + 3.0f / 2048));
+    // compare bits, isnan is unreliable under -Ofast
+    EXPECT_EQ(0x7e00, Float16::from_float(std::numeric_limits<float>::quiet_NaN()) & 0x7e00);
+
+    // every finite half survives a round trip through float
+    for (uint32_t h = 0; h < 0x10000; ++h) {
+        if ((h & 0x7c00) == 0x7c00) continue;
+        EXPECT_EQ(h, Float16::from_float(Float16::to_float((uint16_t) h)));
+    }
+}
+
+TEST(SpaceHalfTest, BFloat16Conversion) {
+    using hnswlib::BFloat16;
+    EXPECT_EQ(0x3f80, BFloat16::from_float(1.0f));
+    EXPECT_EQ(1.0f, BFloat16::to_float(BFloat16::from_float(1.0f + 1.0f / 256)));  // tie rounds to even
+    EXPECT_EQ(0x7fc0, BFloat16::from_float(std::numeric_limits<float>::quiet_NaN()) & 0x7fc0);
+
+    std::mt19937 rng(47);
+    std::vector<float> v = random_vector(rng, 1000);
+    for (float f : v) {
+        EXPECT_NEAR(f, BFloat16::to_float(BFloat16::from_float(f)), std::abs(f) / 128);
+    }
+}
+
+TEST(SpaceHalfTest, KernelsMatchScalar) {
+    using namespace hnswlib;
+    std::mt19937 rng(47);
+    for (size_t dim : kDims) {
+        for (int iter = 0; iter < 5; ++iter) {
+            std::vector<float> a = random_vector(rng, dim);
+            std::vector<float> b = random_vector(rng, dim);
+            std::vector<uint16_t> a16 = encode<Float16>(a), b16 = encode<Float16>(b);
+            std::vector<uint16_t> abf = encode<BFloat16>(a), bbf = encode<BFloat16>(b);
+
+            float expected, actual;
+            expected = HalfDistance<L2Metric, Float16, Float16>(a16.data(), b16.data(), &dim);
+            actual = HalfSelectDistFunc<L2Metric, Float16, Float16>()(a16.data(), b16.data(), &dim);
+            EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + expected)) << "dim=" << dim;
+
+            expected = HalfDistance<L2Metric, Float32, BFloat16>(a.data(), bbf.data(), &dim);
+            actual = HalfSelectDistFunc<L2Metric, Float32, BFloat16>()(a.data(), bbf.data(), &dim);
+            EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + expected)) << "dim=" << dim;
+
+            expected = HalfDistance<InnerProductMetric, Float32, Float16>(a.data(), b16.data(), &dim);
+            actual = HalfSelectDistFunc<InnerProductMetric, Float32, Float16>()(a.data(), b16.data(), &dim);
+            EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + std::abs(expected))) << "dim=" << dim;
+
+            expected = HalfDistance<InnerProductMetric, BFloat16, BFloat16>(abf.data(), bbf.data(), &dim);
+            actual = HalfSelectDistFunc<InnerProductMetric, BFloat16, BFloat16>()(abf.data(), bbf.data(), &dim);
+            EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + std::abs(expected))) << "dim=" << dim;
+
+            // the query kernel does not round the query
+            float exact = L2Sqr(a.data(), b.data(), &dim);
+            float half = L2SpaceFP16(dim).get_query_dist_func()(a.data(), b16.data(), &dim);
+            EXPECT_NEAR(exact, half, 1e-2 * (1.0f + exact)) << "dim=" << dim;
+        }
+    }
+}
+
+template<typename Space>
+void check_self_search() {
+    int dim = 32;
+    int n = 1000;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, dim * n);
+
+    Space space(dim);
+    EXPECT_EQ(dim * sizeof(uint16_t), space.get_data_size());
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (int i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + i * dim, i);
+        alg_brute.addPoint(data.data() + i * dim, i);
+    }
+
+    int correct = 0;
+    for (int i = 0; i < n; i++) {
+        auto result = alg_hnsw.searchKnn(data.data() + i * dim, 1);
+        if (result.top().second == (hnswlib::labeltype) i) correct++;
+        EXPECT_EQ((hnswlib::labeltype) i, alg_brute.searchKnn(data.data() + i * dim, 1).top().second);
+    }
+    EXPECT_GT(correct, 0.95 * n);
+
+    // stored vectors are decoded back to float
+    std::vector<float> stored = alg_hnsw.template getDataByLabel<float>(3);
+    ASSERT_EQ((size_t) dim, stored.size());
+    for (int j = 0; j < dim; j++) {
+        EXPECT_NEAR(data[3 * dim + j], stored[j], 1e-2);
+    }
+}
+
+TEST(SpaceHalfTest, L2FP16Search) {
+    check_self_search<hnswlib::L2SpaceFP16>();
+}
+
+TEST(SpaceHalfTest, L2BF16Search) {
+    check_self_search<hnswlib::L2SpaceBF16>();
+}
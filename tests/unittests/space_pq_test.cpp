@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+TEST(SpacePQTest, TableDistanceMatchesDecoded) {
+    size_t dim = 32;
+    size_t n = 1000;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, dim * n);
+
+    EXPECT_THROW(hnswlib::L2SpacePQ(dim, 5), std::runtime_error);
+    hnswlib::L2SpacePQ space(dim, 8);
+    EXPECT_EQ(8, space.get_data_size());
+    EXPECT_THROW(space.train(data.data(), 100), std::runtime_error);
+    space.train(data.data(), n, 10);
+
+    std::vector<char> state;
+    std::vector<float> query = random_vector(rng, dim);
+    const void *table = space.prepare_query_state(query.data(), state);
+    std::vector<uint8_t> code_a(8), code_b(8);
+    std::vector<float> decoded_a(dim), decoded_b(dim);
+    for (size_t j = 0; j + 1 < 50; j++) {
+        space.encode(data.data() + j * dim, code_a.data());
+        space.encode(data.data() + (j + 1) * dim, code_b.data());
+        space.decode(code_a.data(), decoded_a.data());
+        space.decode(code_b.data(), decoded_b.data());
+
+        float expected = hnswlib::L2Sqr(query.data(), decoded_a.data(), &dim);
+        float actual = space.get_query_dist_func()(table, code_a.data(), space.get_dist_func_param());
+        EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + expected));
+
+        expected = hnswlib::L2Sqr(decoded_a.data(), decoded_b.data(), &dim);
+        actual = space.get_dist_func()(code_a.data(), code_b.data(), space.get_dist_func_param());
+        EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + expected));
+    }
+
+    hnswlib::InnerProductSpacePQ ip_space(dim, 8);
+    ip_space.train(data.data(), n, 10);
+    table = ip_space.prepare_query_state(query.data(), state);
+    ip_space.encode(data.data(), code_a.data());
+    ip_space.decode(code_a.data(), decoded_a.data());
+    float expected = hnswlib::InnerProductDistance(query.data(), decoded_a.data(), &dim);
+    float actual = ip_space.get_query_dist_func()(table, code_a.data(), ip_space.get_dist_func_param());
+    EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + std::abs(expected)));
+}
+
+TEST(SpacePQTest, CodebookSaveLoad) {
+    size_t dim = 16;
+    size_t n = 500;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, dim * n);
+    std::string path = "pq_codebook.bin";
+
+    hnswlib::L2SpacePQ space(dim, 4);
+    space.train(data.data(), n, 5);
+    space.saveCodebook(path);
+
+    hnswlib::L2SpacePQ loaded(dim, 4);
+    EXPECT_FALSE(loaded.isTrained());
+    loaded.loadCodebook(path);
+    EXPECT_TRUE(loaded.isTrained());
+    hnswlib::L2SpacePQ other(dim, 8);
+    EXPECT_THROW(other.loadCodebook(path), std::runtime_error);
+
+    std::vector<uint8_t> code(4), loaded_code(4);
+    for (size_t j = 0; j < n; j++) {
+        space.encode(data.data() + j * dim, code.data());
+        loaded.encode(data.data() + j * dim, loaded_code.data());
+        EXPECT_EQ(code, loaded_code);
+    }
+    remove(path.c_str());
+}
+
+TEST(SpacePQTest, SearchWithRerank) {
+    size_t dim = 32;
+    int n = 2000;
+    int k = 10;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, dim * n);
+    std::vector<float> queries = random_vector(rng, dim * 20);
+
+    hnswlib::L2Space float_space(dim);
+    hnswlib::L2SpacePQ space(dim, 16);
+    space.train(data.data(), n, 10);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    alg_hnsw.setRerankSpace(&float_space);
+    hnswlib::BruteforceSearch<float> alg_brute(&float_space, n);
+    hnswlib::BruteforceSearch<float> alg_brute_pq(&space, n);
+    for (int i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + i * dim, i);
+        alg_brute.addPoint(data.data() + i * dim, i);
+        alg_brute_pq.addPoint(data.data() + i * dim, i);
+    }
+
+    alg_hnsw.setEf(100);
+    int correct = 0;
+    for (int q = 0; q < 20; q++) {
+        const float *query = queries.data() + q * dim;
+        auto gt = alg_brute.searchKnn(query, k);
+        std::vector<hnswlib::labeltype> expected;
+        while (!gt.empty()) {
+            expected.push_back(gt.top().second);
+            gt.pop();
+        }
+        auto result = alg_hnsw.searchKnn(query, k);
+        while (!result.empty()) {
+            if (std::find(expected.begin(), expected.end(), result.top().second) != expected.end())
+                correct++;
+            result.pop();
+        }
+        // the brute force search walks the same lookup table
+        EXPECT_EQ((size_t) k, alg_brute_pq.searchKnn(query, k).size());
+    }
+    EXPECT_GT(correct, 0.8 * 20 * k);
+}
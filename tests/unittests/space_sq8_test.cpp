@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+const size_t kDims[] = {1, 7, 8, 15, 16, 17, 33, 100, 128, 768};
+
+}  // namespace
+
+TEST(SpaceSQ8Test, EncodeDecode) {
+    size_t dim = 16;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, dim * 100);
+
+    hnswlib::L2SpaceSQ8 space(dim);
+    EXPECT_EQ(dim, space.get_data_size());
+    std::vector<uint8_t> code(dim);
+    EXPECT_THROW(space.encode(data.data(), code.data()), std::runtime_error);
+
+    space.train(data.data(), 100);
+    std::vector<float> hi = space.getMax();
+    std::vector<float> decoded(dim);
+    for (size_t j = 0; j < 100; j++) {
+        space.encode(data.data() + j * dim, code.data());
+        space.decode(code.data(), decoded.data());
+        for (size_t i = 0; i < dim; i++) {
+            float step = (hi[i] - space.getMin()[i]) / 255;
+            EXPECT_NEAR(data[j * dim + i], decoded[i], step / 2 + 1e-6);
+        }
+    }
+
+    // out of range values are clamped
+    std::vector<float> outlier(dim, 100.0f);
+    space.encode(outlier.data(), code.data());
+    EXPECT_EQ(255, code[0]);
+}
+
+TEST(SpaceSQ8Test, KernelsMatchScalar) {
+    using namespace hnswlib;
+    std::mt19937 rng(47);
+    for (size_t dim : kDims) {
+        std::vector<float> train = random_vector(rng, dim * 10);
+        L2SpaceSQ8 space(dim);
+        space.train(train.data(), 10);
+        void *param = space.get_dist_func_param();
+        for (int iter = 0; iter < 5; ++iter) {
+            std::vector<float> a = random_vector(rng, dim);
+            std::vector<float> b = random_vector(rng, dim);
+            std::vector<uint8_t> ca(dim), cb(dim);
+            space.encode(a.data(), ca.data());
+            space.encode(b.data(), cb.data());
+
+            float expected = SQ8Distance<L2Metric>(ca.data(), cb.data(), param);
+            float actual = space.get_dist_func()(ca.data(), cb.data(), param);
+            EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + expected)) << "dim=" << dim;
+
+            expected = SQ8QueryDistance<L2Metric>(a.data(), cb.data(), param);
+            actual = space.get_query_dist_func()(a.data(), cb.data(), param);
+            EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + expected)) << "dim=" << dim;
+
+            expected = SQ8QueryDistance<InnerProductMetric>(a.data(), cb.data(), param);
+            actual = SQ8SelectDistFunc<InnerProductMetric, true>()(a.data(), cb.data(), param);
+            EXPECT_NEAR(expected, actual, 1e-4 * (1.0f + std::abs(expected))) << "dim=" << dim;
+        }
+    }
+}
+
+TEST(SpaceSQ8Test, RerankReturnsExactDistances) {
+    size_t dim = 32;
+    int n = 1000;
+    int k = 10;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, dim * n);
+    std::vector<float> queries = random_vector(rng, dim * 20);
+
+    hnswlib::L2Space float_space(dim);
+    hnswlib::L2SpaceSQ8 space(dim);
+    space.train(data.data(), n);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+    alg_hnsw.setRerankSpace(&float_space);
+    hnswlib::BruteforceSearch<float> alg_brute(&float_space, n);
+    for (int i = 0; i < n; i++) {
+        alg_hnsw.addPoint(data.data() + i * dim, i);
+        alg_brute.addPoint(data.data() + i * dim, i);
+    }
+    EXPECT_THROW(alg_hnsw.setRerankSpace(&float_space), std::runtime_error);
+
+    alg_hnsw.setEf(50);
+    int correct = 0;
+    for (int q = 0; q < 20; q++) {
+        const float *query = queries.data() + q * dim;
+        auto result = alg_hnsw.searchKnn(query, k);
+        auto gt = alg_brute.searchKnn(query, k);
+        std::vector<hnswlib::labeltype> expected;
+        while (!gt.empty()) {
+            expected.push_back(gt.top().second);
+            gt.pop();
+        }
+        while (!result.empty()) {
+            // the distance of the kernel the rerank uses, whose summation order depends on the CPU
+            float exact = float_space.get_dist_func()(query, data.data() + result.top().second * dim,
+                                                      float_space.get_dist_func_param());
+            EXPECT_FLOAT_EQ(exact, result.top().first);
+            if (std::find(expected.begin(), expected.end(), result.top().second) != expected.end())
+                correct++;
+            result.pop();
+        }
+    }
+    EXPECT_GT(correct, 0.9 * 20 * k);
+}
+
+TEST(SpaceSQ8Test, MappedRerankStoreSurvivesReload) {
+    int dim = 16;
+    int n = 200;
+    std::mt19937 rng(47);
+    std::vector<float> data = random_vector(rng, dim * n);
+    std::string index_path = "sq8_index.bin";
+    std::string rerank_path = "sq8_rerank.bin";
+
+    hnswlib::L2Space float_space(dim);
+    hnswlib::L2SpaceSQ8 space(dim);
+    space.train(data.data(), n);
+    {
+        hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+        alg_hnsw.setRerankSpace(&float_space, rerank_path);
+        for (int i = 0; i < n; i++) {
+            alg_hnsw.addPoint(data.data() + i * dim, i);
+        }
+        alg_hnsw.saveIndex(index_path);
+    }
+
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, index_path);
+    alg_hnsw.setRerankSpace(&float_space, rerank_path);
+    auto result = alg_hnsw.searchKnn(data.data() + 5 * dim, 1);
+    EXPECT_EQ(5, result.top().second);
+    EXPECT_EQ(0.0f, result.top().first);
+
+    remove(index_path.c_str());
+    remove(rerank_path.c_str());
+}
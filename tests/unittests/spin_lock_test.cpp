@@ -0,0 +1,43 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include <mutex>
+#include <thread>
+#include <vector>
+
+TEST(SpinLockTest, OneBytePerLock) {
+    EXPECT_EQ(1u, sizeof(hnswlib::SpinLock));
+    std::vector<hnswlib::SpinLock> locks(1000);
+    EXPECT_EQ(1u, (size_t) ((char *) &locks[1] - (char *) &locks[0]));
+}
+
+TEST(SpinLockTest, TryLock) {
+    hnswlib::SpinLock lock;
+    EXPECT_TRUE(lock.try_lock());
+    EXPECT_FALSE(lock.try_lock());
+    lock.unlock();
+    std::unique_lock<hnswlib::SpinLock> guard(lock, std::try_to_lock);
+    EXPECT_TRUE(guard.owns_lock());
+}
+
+TEST(SpinLockTest, MutualExclusion) {
+    // neighbouring locks share a cache line but are independent
+    std::vector<hnswlib::SpinLock> locks(2);
+    size_t counters[2] = {0, 0};
+    size_t num_threads = 4;
+    size_t iterations = 100000;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < iterations; i++) {
+                size_t id = (i + t) % 2;
+                std::unique_lock<hnswlib::SpinLock> guard(locks[id]);
+                counters[id]++;
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(num_threads * iterations, counters[0] + counters[1]);
+    EXPECT_EQ(num_threads * iterations / 2, counters[0]);
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Helpers shared by the unit tests.
+
+typedef std::vector<std::pair<float, hnswlib::labeltype>> Results;
+
+// dim values drawn uniformly from [-1, 1)
+inline std::vector<float> random_vector(std::mt19937 &rng, size_t dim) {
+    std::uniform_real_distribution<float> distrib(-1.0f, 1.0f);
+    std::vector<float> v(dim);
+    for (size_t i = 0; i < dim; ++i) {
+        v[i] = distrib(rng);
+    }
+    return v;
+}
+
+// the results of a search, closest first
+inline Results closerFirst(std::priority_queue<std::pair<float, hnswlib::labeltype>> result) {
+    Results items(result.size());
+    for (size_t i = items.size(); i > 0; i--) {
+        items[i - 1] = result.top();
+        result.pop();
+    }
+    return items;
+}
+
+// searchKnn's results, closest first
+inline Results search(hnswlib::HierarchicalNSW<float> &alg, const float *query, size_t k,
+                      hnswlib::BaseFilterFunctor *filter = nullptr) {
+    return closerFirst(alg.searchKnn(query, k, filter));
+}
+
+// path of a file private to the running test, so that tests run in parallel do not share files
+inline std::string test_file_path(const std::string &name) {
+    const testing::TestInfo *info = testing::UnitTest::GetInstance()->current_test_info();
+    std::string path = std::string(info->test_suite_name()) + "." + info->name() + "." + name;
+    std::replace(path.begin(), path.end(), '/', '_');
+    return path;
+}
+
+inline size_t file_size(const std::string &path) {
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    return (size_t) input.tellg();
+}
+
+inline std::vector<char> read_file(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+/*
+* A fixture with n random vectors of dimension dim and nq random queries, the same in
+* every run. Base is testing::Test, or testing::TestWithParam for parameterized tests.
+*/
+template <typename Base = testing::Test>
+class RandomDataTest : public Base {
+ protected:
+    size_t dim;
+    size_t n;
+    size_t nq;
+    size_t k = 10;
+    std::vector<float> data;
+    std::vector<float> queries;
+
+    RandomDataTest(size_t n, size_t nq, size_t dim = 16) : dim(dim), n(n), nq(nq) {
+        std::mt19937 rng(47);
+        data = random_vector(rng, dim * n);
+        queries = random_vector(rng, dim * nq);
+    }
+};
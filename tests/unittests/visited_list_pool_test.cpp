@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include <algorithm>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+TEST(VisitedListPoolTest, ReusesTheThreadsList) {
+    hnswlib::VisitedListPool pool(1, 100);
+    hnswlib::VisitedList *first = pool.getFreeVisitedList();
+    pool.releaseVisitedList(first);
+    hnswlib::VisitedList *again = pool.getFreeVisitedList();
+    EXPECT_EQ(first, again);
+    // a second list while the first is taken
+    hnswlib::VisitedList *other = pool.getFreeVisitedList();
+    EXPECT_NE(first, other);
+    EXPECT_EQ(100u, other->numelements);
+    pool.releaseVisitedList(again);
+    pool.releaseVisitedList(other);
+}
+
+TEST(VisitedListPoolTest, MoreListsThanSlots) {
+    hnswlib::VisitedListPool pool(1, 10);
+    std::vector<hnswlib::VisitedList *> taken;
+    for (size_t i = 0; i < 200; i++) {
+        taken.push_back(pool.getFreeVisitedList());
+    }
+    EXPECT_EQ(200u, std::set<hnswlib::VisitedList *>(taken.begin(), taken.end()).size());
+    for (hnswlib::VisitedList *vl : taken) {
+        pool.releaseVisitedList(vl);
+    }
+    // every list comes back once, the overflow included
+    std::vector<hnswlib::VisitedList *> retaken;
+    for (size_t i = 0; i < 200; i++) {
+        retaken.push_back(pool.getFreeVisitedList());
+    }
+    std::sort(taken.begin(), taken.end());
+    std::sort(retaken.begin(), retaken.end());
+    EXPECT_EQ(taken, retaken);
+    for (hnswlib::VisitedList *vl : retaken) {
+        pool.releaseVisitedList(vl);
+    }
+}
+
+TEST(VisitedListPoolTest, ConcurrentSearchesAcrossResize) {
+    size_t dim = 8;
+    size_t n = 2000;
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<float> distrib;
+    std::vector<float> data(dim * 2 * n);
+    for (float &x : data) {
+        x = distrib(rng);
+    }
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n);
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+
+    auto search_all = [&](size_t count) {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < 4; t++) {
+            threads.emplace_back([&, t]() {
+                for (size_t i = t; i < count; i += 4) {
+                    auto result = alg.searchKnn(data.data() + i * dim, 1);
+                    ASSERT_EQ(i, result.top().second);
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    };
+    search_all(n);
+    // the pool is rebuilt for the new size, new ids fit in the visited lists
+    alg.resizeIndex(2 * n);
+    for (size_t i = n; i < 2 * n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+    search_all(2 * n);
+}
+
+TEST(VisitedListPoolTest, SparseListGrowsAndResets) {
+    hnswlib::VisitedListPool pool(0, 1 << 30, true);
+    hnswlib::VisitedList *vl = pool.getFreeVisitedList();
+    EXPECT_TRUE(vl->isSparse());
+    // ids far apart and more of them than the initial table holds
+    for (unsigned int i = 0; i < 5000; i++) {
+        EXPECT_TRUE(vl->visit(i * 200003u));
+    }
+    for (unsigned int i = 0; i < 5000; i++) {
+        EXPECT_FALSE(vl->visit(i * 200003u));
+        EXPECT_TRUE(vl->isVisited(i * 200003u));
+    }
+    EXPECT_FALSE(vl->isVisited(1));
+    pool.releaseVisitedList(vl);
+
+    vl = pool.getFreeVisitedList();
+    EXPECT_FALSE(vl->isVisited(200003u));
+    EXPECT_TRUE(vl->visit(0));
+    pool.releaseVisitedList(vl);
+}
+
+TEST(VisitedListPoolTest, SparseListShrinksAfterShortSearches) {
+    hnswlib::VisitedList vl(1 << 30, true);
+    vl.reset();
+    size_t initial = vl.tableCapacity();
+    // one long walk grows the table
+    for (unsigned int i = 0; i < 100000; i++) {
+        vl.visit(i * 7919u);
+    }
+    size_t grown = vl.tableCapacity();
+    EXPECT_GE(grown, 200000u);
+    // a walk of the same size keeps it
+    vl.reset();
+    EXPECT_EQ(grown, vl.tableCapacity());
+    for (unsigned int i = 0; i < 100000; i++) {
+        EXPECT_TRUE(vl.visit(i * 7919u));
+    }
+
+    // after a short walk the next search starts from a small table
+    vl.reset();
+    for (unsigned int i = 0; i < 100; i++) {
+        vl.visit(i * 7919u);
+    }
+    vl.reset();
+    EXPECT_EQ(initial, vl.tableCapacity());
+    EXPECT_FALSE(vl.isVisited(7919u));
+    for (unsigned int i = 0; i < 5000; i++) {
+        EXPECT_TRUE(vl.visit(i * 13u));
+    }
+    for (unsigned int i = 0; i < 5000; i++) {
+        EXPECT_TRUE(vl.isVisited(i * 13u));
+    }
+    EXPECT_FALSE(vl.isVisited(7919u));
+
+    hnswlib::VisitedList dense(10);
+    EXPECT_EQ(0u, dense.tableCapacity());
+}
+
+TEST(VisitedListPoolTest, SparseAndDenseSearchesAgree) {
+    size_t dim = 8;
+    size_t n = 3000;
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<float> distrib;
+    std::vector<float> data(dim * n);
+    for (float &x : data) {
+        x = distrib(rng);
+    }
+    hnswlib::L2Space space(dim);
+    hnswlib::HierarchicalNSW<float> alg(&space, n);
+    // a small index uses dense lists unless told otherwise
+    EXPECT_FALSE(alg.useSparseVisited(10));
+    alg.setVisitedMode(hnswlib::VISITED_SPARSE);
+    EXPECT_TRUE(alg.useSparseVisited(10));
+    for (size_t i = 0; i < n; i++) {
+        alg.addPoint(data.data() + i * dim, i);
+    }
+    alg.setEf(40);
+    for (size_t q = 0; q < 100; q++) {
+        const float *query = data.data() + q * 29 * dim;
+        alg.setVisitedMode(hnswlib::VISITED_SPARSE);
+        auto sparse = alg.searchKnn(query, 10);
+        alg.setVisitedMode(hnswlib::VISITED_DENSE);
+        auto dense = alg.searchKnn(query, 10);
+        ASSERT_EQ(dense.size(), sparse.size());
+        while (!dense.empty()) {
+            EXPECT_EQ(dense.top(), sparse.top());
+            dense.pop();
+            sparse.pop();
+        }
+    }
+}
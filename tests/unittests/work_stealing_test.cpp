@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+#include "hnswlib/hnswlib.h"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST(WorkStealingTest, RunsEveryItemOnce) {
+    size_t begin = 10;
+    size_t end = 5010;
+    std::vector<std::atomic<int>> runs(end);
+    for (auto &count : runs) {
+        count = 0;
+    }
+    std::vector<std::atomic<size_t>> per_thread(4);
+    for (auto &count : per_thread) {
+        count = 0;
+    }
+    hnswlib::parallelFor(begin, end, 4, [&](size_t i, size_t thread_id) {
+        // the first share is far slower, the other threads take over its items
+        if (i < begin + 100)
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        runs[i]++;
+        per_thread[thread_id]++;
+    });
+    for (size_t i = 0; i < end; i++) {
+        EXPECT_EQ(i < begin ? 0 : 1, runs[i].load());
+    }
+    size_t total = 0;
+    for (auto &count : per_thread) {
+        total += count;
+    }
+    EXPECT_EQ(end - begin, total);
+}
+
+TEST(WorkStealingTest, OneThreadRunsInOrder) {
+    std::vector<size_t> order;
+    hnswlib::parallelFor(0, 100, 1, [&](size_t i, size_t thread_id) {
+        EXPECT_EQ(0u, thread_id);
+        order.push_back(i);
+    });
+    ASSERT_EQ(100u, order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        EXPECT_EQ(i, order[i]);
+    }
+    hnswlib::parallelFor(5, 5, 4, [&](size_t, size_t) { FAIL(); });
+}
+
+TEST(WorkStealingTest, RethrowsAndStops) {
+    std::atomic<size_t> runs(0);
+    EXPECT_THROW(hnswlib::parallelFor(0, 100000, 4, [&](size_t i, size_t) {
+        runs++;
+        if (i == 10)
+            throw std::runtime_error("item failed");
+    }), std::runtime_error);
+    EXPECT_LT(runs.load(), 100000u);
+}